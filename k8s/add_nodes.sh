@@ -61,14 +61,6 @@ add_pods() {
     exit 1
   fi
    
-  # split the proxies into an array and choose a random one as the seed
-  IFS=' ' read -ra ARR <<< "$PROXY_IPS"
-  if [ ${#ARR[@]} -eq 0 ]; then
-    SEED_SERVER=""
-  else
-    SEED_SERVER=${ARR[$RANDOM % ${#ARR[@]}]}
-  fi
-
   FINAL_NUM=$(($NUM_PREV + $2))
   ((NUM_PREV++))
 
@@ -96,7 +88,6 @@ add_pods() {
     # set the IPs of other system components
     sed -i "s|PROXY_IPS_DUMMY|\"$PROXY_IPS\"|g" tmp.yml
     sed -i "s|MON_IP_DUMMY|$MON_IP|g" tmp.yml
-    sed -i "s|SEED_SERVER_DUMMY|$SEED_SERVER|g" tmp.yml
 
     echo "Creating pod on the new instance..."
     kubectl create -f tmp.yml > /dev/null 2>&1
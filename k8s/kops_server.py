@@ -14,9 +14,11 @@ class KopsHandler(BaseHTTPRequestHandler):
             logging.info('Adding ' + num + ' new memory nodes...')
             if os.system('./add_nodes.sh ' + num + ' 0 0 0') == 0:
                 self.send_response(200)
+                self.end_headers()
                 self.wfile.write(bytes('Successfully added ' + num + ' memory node.', 'utf-8'))
             else:
                 self.send_response(500)
+                self.end_headers()
                 self.wfile.write(bytes('Unexpected error while adding nodes.', 'utf-8'))
         elif '/add/ebs' in self.path:
             num = list(filter(lambda a: a != '', self.path.split('/')))[-1]
@@ -24,9 +26,11 @@ class KopsHandler(BaseHTTPRequestHandler):
             logging.info('Adding ' + num + ' new EBS nodes...')
             if os.system('./add_nodes.sh 0 ' + num + ' 0 0') == 0:
                 self.send_response(200)
+                self.end_headers()
                 self.wfile.write(bytes('Successfully added ' + num + ' EBS node.', 'utf-8'))
             else:
                 self.send_response(500)
+                self.end_headers()
                 self.wfile.write(bytes('Unexpected error while adding nodes.', 'utf-8'))
         elif '/remove/ebs' in self.path:
             print('Removing an EBS node...')
@@ -34,9 +38,11 @@ class KopsHandler(BaseHTTPRequestHandler):
             nid = list(filter(lambda a: a != '', self.path.split('/')))[-1]
             if os.system('./remove_node.sh e ' + nid) == 0:
                 self.send_response(200)
+                self.end_headers()
                 self.wfile.write(bytes('Successfully removed an EBS node.', 'utf-8'))
             else:
                 self.send_response(500)
+                self.end_headers()
                 self.wfile.write(bytes('Unexpected error while removing a node.', 'utf-8'))
         elif '/remove/memory' in self.path:
             print('Removing a memory node...')
@@ -44,12 +50,15 @@ class KopsHandler(BaseHTTPRequestHandler):
             nid = list(filter(lambda a: a != '', self.path.split('/')))[-1]
             if os.system('./remove_node.sh m ' + nid) == 0:
                 self.send_response(200)
+                self.end_headers()
                 self.wfile.write(bytes('Successfully removed a memory node.', 'utf-8'))
             else:
                 self.send_response(500)
+                self.end_headers()
                 self.wfile.write(bytes('Unexpected error while removing a node.', 'utf-8'))
         else:
             self.send_response(404)
+            self.end_headers()
             self.wfile.write(bytes('Invalid path: ' + self.path, 'utf-8'))
 
 def run():
@@ -34,8 +34,7 @@ else
   echo "$PROXY_IPS"
   sh k8s/set_ips.sh "$PROXY_IPS" conf/server/proxy_address.txt
 
-  # set the seed server and the monitoring address
-  echo $SEED_SERVER > conf/server/seed_server.txt
+  # the monitoring node hands out the server list to joining nodes
   echo $MON_IP > conf/server/monitoring_address.txt
 
   if [ "$1" = "1" ] || [ "$1" = "2" ]; then
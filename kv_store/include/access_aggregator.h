@@ -0,0 +1,168 @@
+#ifndef __ACCESS_AGGREGATOR_H__
+#define __ACCESS_AGGREGATOR_H__
+
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+
+using namespace std;
+
+// The monitoring node's running totals of key accesses across server threads.
+// Every change a thread reports is folded in as it arrives, so a policy pass
+// never rebuilds the totals. Keys are indexed by their number of memory tier
+// replicas and, within that, ordered by total access, so promotion, demotion
+// and hot key passes only walk the keys past their threshold.
+class access_aggregator {
+public:
+  // keys ordered by total access, coldest first
+  typedef set<pair<unsigned, string>> index_t;
+
+private:
+  struct key_entry {
+    key_entry() : total_(0), reporters_(0), memory_replication_(0) {}
+    unsigned total_;
+    // the number of threads that report the key
+    unsigned reporters_;
+    unsigned memory_replication_;
+  };
+
+  // the count each thread last reported for each key
+  unordered_map<string, unordered_map<string, unsigned>> thread_access_;
+  unordered_map<string, key_entry> keys_;
+  // keys by number of memory tier replicas
+  unordered_map<unsigned, index_t> index_;
+  index_t empty_;
+  // the keys whose total changed since they were last drained
+  bool track_changes_;
+  unordered_set<string> changed_;
+
+  // replace a thread's count for a key; a key no thread reports is dropped
+  void adjust(const string& key, unsigned old_count, unsigned new_count, int reporters, unsigned memory_replication) {
+    auto it = keys_.find(key);
+    if (it == keys_.end()) {
+      it = keys_.insert(make_pair(key, key_entry())).first;
+      it->second.memory_replication_ = memory_replication;
+    } else {
+      index_[it->second.memory_replication_].erase(make_pair(it->second.total_, key));
+    }
+    it->second.total_ = it->second.total_ - old_count + new_count;
+    it->second.reporters_ += reporters;
+    if (track_changes_ && (old_count != new_count || it->second.reporters_ == 0)) {
+      changed_.insert(key);
+    }
+    if (it->second.reporters_ == 0) {
+      keys_.erase(it);
+    } else {
+      index_[it->second.memory_replication_].insert(make_pair(it->second.total_, key));
+    }
+  }
+
+public:
+  access_aggregator() : track_changes_(false) {}
+
+  bool has_thread(const string& thread) const {
+    return thread_access_.find(thread) != thread_access_.end();
+  }
+
+  // record the count a thread reports for a key; memory_replication is only
+  // used if the key is new
+  void update(const string& thread, const string& key, unsigned count, unsigned memory_replication) {
+    auto result = thread_access_[thread].insert(make_pair(key, count));
+    unsigned old_count = result.second ? 0 : result.first->second;
+    result.first->second = count;
+    adjust(key, old_count, count, result.second ? 1 : 0, memory_replication);
+  }
+
+  void erase(const string& thread, const string& key) {
+    auto thread_it = thread_access_.find(thread);
+    if (thread_it == thread_access_.end()) {
+      return;
+    }
+    auto it = thread_it->second.find(key);
+    if (it == thread_it->second.end()) {
+      return;
+    }
+    unsigned old_count = it->second;
+    thread_it->second.erase(it);
+    adjust(key, old_count, 0, -1, 0);
+  }
+
+  void remove_thread(const string& thread) {
+    auto thread_it = thread_access_.find(thread);
+    if (thread_it == thread_access_.end()) {
+      return;
+    }
+    unordered_map<string, unsigned> access;
+    access.swap(thread_it->second);
+    thread_access_.erase(thread_it);
+    for (auto it = access.begin(); it != access.end(); it++) {
+      adjust(it->first, it->second, 0, -1, 0);
+    }
+  }
+
+  void set_memory_replication(const string& key, unsigned memory_replication) {
+    auto it = keys_.find(key);
+    if (it == keys_.end() || it->second.memory_replication_ == memory_replication) {
+      return;
+    }
+    auto entry = make_pair(it->second.total_, key);
+    index_[it->second.memory_replication_].erase(entry);
+    index_[memory_replication].insert(entry);
+    it->second.memory_replication_ = memory_replication;
+  }
+
+  void track_changes(bool track) {
+    track_changes_ = track;
+  }
+
+  // move the keys whose total changed since the last call into changed
+  void drain_changed(unordered_set<string>& changed) {
+    changed.clear();
+    changed.swap(changed_);
+  }
+
+  bool has_key(const string& key) const {
+    return keys_.find(key) != keys_.end();
+  }
+
+  unsigned total(const string& key) const {
+    auto it = keys_.find(key);
+    return it == keys_.end() ? 0 : it->second.total_;
+  }
+
+  unsigned size() const {
+    return keys_.size();
+  }
+
+  // the keys with memory_replication memory tier replicas
+  const index_t& keys(unsigned memory_replication) const {
+    auto it = index_.find(memory_replication);
+    return it == index_.end() ? empty_ : it->second;
+  }
+
+  // the memory tier replica counts that have keys
+  set<unsigned> memory_replications() const {
+    set<unsigned> result;
+    for (auto it = index_.begin(); it != index_.end(); it++) {
+      if (it->second.size() > 0) {
+        result.insert(it->first);
+      }
+    }
+    return result;
+  }
+
+  // the first key in index with a total access above threshold
+  static index_t::const_iterator above(const index_t& index, unsigned threshold) {
+    return index.lower_bound(make_pair(threshold + 1, string()));
+  }
+
+  // the first key in index with a total access of at least threshold, i.e. the
+  // end of the keys below it
+  static index_t::const_iterator below_end(const index_t& index, unsigned threshold) {
+    return index.lower_bound(make_pair(threshold, string()));
+  }
+};
+
+#endif
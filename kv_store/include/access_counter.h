@@ -0,0 +1,90 @@
+#ifndef __ACCESS_COUNTER_H__
+#define __ACCESS_COUNTER_H__
+
+#include <chrono>
+#include <stdint.h>
+
+using namespace std;
+
+// Define server's key monitoring threshold (in second)
+#define KEY_MONITORING_THRESHOLD 900
+
+// Define the number of buckets that cover the key monitoring window; each
+// bucket counts the accesses of KEY_MONITORING_THRESHOLD / ACCESS_BUCKET_NUMBER
+// seconds
+#define ACCESS_BUCKET_NUMBER 15
+
+// Define the number of most accessed keys and of cold keys a thread reports
+#define ACCESS_REPORT_TOP_K 1000
+#define ACCESS_REPORT_COLD_NUMBER 1000
+
+// The accesses to a key over the last KEY_MONITORING_THRESHOLD seconds, kept as
+// a ring of per-interval counts. Recording an access is O(1) and the memory per
+// key is fixed no matter how hot the key is. Buckets are cleared lazily as time
+// moves past them, so idle keys cost nothing between reports.
+class access_counter {
+  uint32_t counts_[ACCESS_BUCKET_NUMBER];
+  // the interval the newest bucket counts
+  unsigned long long interval_;
+
+  static unsigned long long bucket_width() {
+    return KEY_MONITORING_THRESHOLD / ACCESS_BUCKET_NUMBER;
+  }
+
+  // clear the buckets of the intervals between the newest one and interval
+  void advance(unsigned long long interval) {
+    if (interval <= interval_) {
+      return;
+    }
+    unsigned long long stale = interval - interval_;
+    if (stale > ACCESS_BUCKET_NUMBER) {
+      stale = ACCESS_BUCKET_NUMBER;
+    }
+    for (unsigned long long i = 1; i <= stale; i++) {
+      counts_[(interval_ + i) % ACCESS_BUCKET_NUMBER] = 0;
+    }
+    interval_ = interval;
+  }
+
+public:
+  access_counter() : interval_(0) {
+    for (unsigned i = 0; i < ACCESS_BUCKET_NUMBER; i++) {
+      counts_[i] = 0;
+    }
+  }
+
+  static unsigned long long current_time() {
+    return chrono::duration_cast<chrono::seconds>(chrono::system_clock::now().time_since_epoch()).count();
+  }
+
+  // record an access at time (in second)
+  void record(unsigned long long time) {
+    advance(time / bucket_width());
+    counts_[interval_ % ACCESS_BUCKET_NUMBER] += 1;
+  }
+
+  void record() {
+    record(current_time());
+  }
+
+  // the number of accesses in the window ending at time (in second)
+  unsigned count(unsigned long long time) const {
+    unsigned long long interval = time / bucket_width();
+    if (interval >= interval_ + ACCESS_BUCKET_NUMBER) {
+      return 0;
+    }
+    // buckets older than the window are not cleared until the next access
+    unsigned long long live = ACCESS_BUCKET_NUMBER - (interval > interval_ ? interval - interval_ : 0);
+    unsigned total = 0;
+    for (unsigned long long i = 0; i < live; i++) {
+      total += counts_[(interval_ + ACCESS_BUCKET_NUMBER - i) % ACCESS_BUCKET_NUMBER];
+    }
+    return total;
+  }
+
+  unsigned count() const {
+    return count(current_time());
+  }
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef __ACCESS_FORECAST_H__
+#define __ACCESS_FORECAST_H__
+
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+// Define the weight of the newest observation in a key's smoothed access count
+#define FORECAST_LEVEL_WEIGHT 0.3
+// Define the weight of the newest observation in a key's access trend
+#define FORECAST_TREND_WEIGHT 0.2
+// Define how far ahead the forecast looks (in monitoring epoch)
+#define FORECAST_HORIZON 4
+// Define the number of epochs after which an unchanged key's forecast is taken
+// to have settled at its count
+#define FORECAST_SETTLE_EPOCHS 64
+
+// Smoothed access counts and trends per key (Holt's linear smoothing), used to
+// predict a key's access count a few epochs ahead. A key is only touched when
+// its count changes; the epochs in between are smoothed then, as if the last
+// count had been observed every epoch.
+class access_forecast {
+  struct key_forecast {
+    key_forecast() : level_(0), trend_(0), count_(0), epoch_(0), moved_epoch_(-1) {}
+    double level_;
+    double trend_;
+    // the last observed count and when it was observed
+    unsigned count_;
+    long long epoch_;
+    // when the policy last moved the key between tiers
+    long long moved_epoch_;
+  };
+
+  unordered_map<string, key_forecast> keys_;
+
+  // one smoothing step with count observed
+  static void step(key_forecast& f, unsigned count) {
+    double level = f.level_;
+    f.level_ = FORECAST_LEVEL_WEIGHT * count + (1 - FORECAST_LEVEL_WEIGHT) * (f.level_ + f.trend_);
+    f.trend_ = FORECAST_TREND_WEIGHT * (f.level_ - level) + (1 - FORECAST_TREND_WEIGHT) * f.trend_;
+  }
+
+  // bring a key's estimates up to epoch assuming its count did not change; a
+  // key idle for long enough has settled at its last count
+  static void advance(key_forecast& f, long long epoch) {
+    if (epoch <= f.epoch_) {
+      return;
+    }
+    if (epoch - f.epoch_ > FORECAST_SETTLE_EPOCHS) {
+      f.level_ = f.count_;
+      f.trend_ = 0;
+    } else {
+      for (long long i = f.epoch_; i < epoch; i++) {
+        step(f, f.count_);
+      }
+    }
+    f.epoch_ = epoch;
+  }
+
+public:
+  // record a key's access count as of epoch
+  void observe(const string& key, unsigned count, long long epoch) {
+    auto result = keys_.insert(make_pair(key, key_forecast()));
+    key_forecast& f = result.first->second;
+    if (result.second) {
+      // a new key starts at its first count with no trend
+      f.level_ = count;
+      f.count_ = count;
+      f.epoch_ = epoch;
+      return;
+    }
+    advance(f, epoch - 1);
+    step(f, count);
+    f.count_ = count;
+    f.epoch_ = epoch;
+  }
+
+  // the predicted access count FORECAST_HORIZON epochs after epoch
+  double predict(const string& key, long long epoch) const {
+    auto it = keys_.find(key);
+    if (it == keys_.end()) {
+      return 0;
+    }
+    key_forecast f = it->second;
+    advance(f, epoch);
+    double prediction = f.level_ + FORECAST_HORIZON * f.trend_;
+    return prediction > 0 ? prediction : 0;
+  }
+
+  void set_moved(const string& key, long long epoch) {
+    auto it = keys_.find(key);
+    if (it != keys_.end()) {
+      it->second.moved_epoch_ = epoch;
+    }
+  }
+
+  // the epochs since the policy last moved a key, or -1 if it never did
+  long long since_moved(const string& key, long long epoch) const {
+    auto it = keys_.find(key);
+    if (it == keys_.end() || it->second.moved_epoch_ < 0) {
+      return -1;
+    }
+    return epoch - it->second.moved_epoch_;
+  }
+
+  void erase(const string& key) {
+    keys_.erase(key);
+  }
+
+  // forget the keys whose count has been 0 for more than
+  // FORECAST_SETTLE_EPOCHS; their forecast has settled at 0 and they have not
+  // moved for as long
+  void expire(long long epoch) {
+    for (auto it = keys_.begin(); it != keys_.end();) {
+      if (it->second.count_ == 0 && epoch - it->second.epoch_ > FORECAST_SETTLE_EPOCHS &&
+          epoch - it->second.moved_epoch_ > FORECAST_SETTLE_EPOCHS) {
+        it = keys_.erase(it);
+      } else {
+        it++;
+      }
+    }
+  }
+
+  unsigned size() const {
+    return keys_.size();
+  }
+};
+
+#endif
@@ -0,0 +1,72 @@
+#ifndef __BOUNDED_LOAD_H__
+#define __BOUNDED_LOAD_H__
+
+#include <algorithm>
+#include <stdint.h>
+#include <vector>
+#include "key_hash.h"
+
+using namespace std;
+
+// Define bounded-load placement: a node whose occupancy exceeds
+// (1 + BOUNDED_LOAD_EPSILON) times its tier's average sheds the keys it has no
+// capacity for to the next node on the ring
+#define ENABLE_BOUNDED_LOAD false
+#define BOUNDED_LOAD_EPSILON 0.25
+// Define the unit of the share of keys a node sheds, and the number of steps
+// the share moves in
+#define LOAD_SHED_SCALE 65536
+#define LOAD_SHED_STEPS 16
+
+// whether a node shedding shed / LOAD_SHED_SCALE of its keys sheds this key;
+// the choice is salted with the node (node_hash) so that the next node does
+// not shed the same keys
+bool sheds_key(key_hash_t key_hash, key_hash_t node_hash, uint32_t shed) {
+  if (shed == 0) {
+    return false;
+  }
+  uint64_t z = ((uint64_t) node_hash << 32) | key_hash;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  z = z ^ (z >> 31);
+  return z % LOAD_SHED_SCALE < shed;
+}
+
+// the ids of the count replicas of a key on a ring whose nodes shed keys: the
+// first nodes clockwise that keep the key and, if too few do, the nodes that
+// shed it fill up the rest. node_hash gives the salt of a node for sheds_key
+template <typename Ring, typename NodeHash>
+vector<typename Ring::node_id_type> bounded_load_replicas(Ring& ring, key_hash_t key_hash, unsigned count, NodeHash node_hash) {
+  typedef typename Ring::node_id_type node_id_type;
+  vector<node_id_type> replicas;
+  auto pos = ring.find(key_hash);
+  if (pos == ring.end()) {
+    return replicas;
+  }
+  unsigned node_num = ring.nodes().size();
+  unsigned target = min(count, node_num);
+  vector<bool> visited(node_num, false);
+  vector<node_id_type> shed_nodes;
+  unsigned seen = 0;
+  while (replicas.size() < target && seen < node_num) {
+    node_id_type id = ring.node_id(pos);
+    if (!visited[id]) {
+      visited[id] = true;
+      seen += 1;
+      if (sheds_key(key_hash, node_hash(ring.node(id)), ring.shed(id))) {
+        shed_nodes.push_back(id);
+      } else {
+        replicas.push_back(id);
+      }
+    }
+    if (++pos == ring.end()) {
+      pos = ring.begin();
+    }
+  }
+  for (auto it = shed_nodes.begin(); it != shed_nodes.end() && replicas.size() < target; it++) {
+    replicas.push_back(*it);
+  }
+  return replicas;
+}
+
+#endif
@@ -5,9 +5,13 @@
 #include <string>
 #include <boost/functional/hash.hpp>
 #include <boost/format.hpp>
-#include <boost/crc.hpp>
 #include <functional>
 #include "consistent_hash_map.hpp"
+#include "rendezvous_hash.hpp"
+#include "key_hash.h"
+#include "bounded_load.h"
+#include "membership_log.h"
+#include "placement_table.h"
 #include "message.pb.h"
 #include "socket_cache.h"
 #include "zmq_util.h"
@@ -18,15 +22,26 @@ using namespace std;
 
 // Define server report threshold (in second)
 #define SERVER_REPORT_THRESHOLD 15
-// Define server's key monitoring threshold (in second)
-#define KEY_MONITORING_THRESHOLD 900
 // Define monitoring threshold (in second)
 #define MONITORING_THRESHOLD 30
+// Define how long the monitoring node keeps using the last stats a server
+// thread pushed (in second)
+#define STATS_EXPIRY_THRESHOLD 60
+// Define the deadline for collecting the responses to a batch of requests sent
+// at once (in millisecond)
+#define GATHER_TIMEOUT 10000
 // Define the threshold for retry rep factor query for gossip handling (in second)
 #define RETRY_THRESHOLD 10
 // Define the grace period for triggering elasticity action (in second)
 #define GRACE_PERIOD 120
 
+// Define the number of empty polls an event loop busy-spins before yielding
+#define IDLE_SPIN_COUNT 1000
+// Define the number of empty polls an event loop yields before blocking
+#define IDLE_YIELD_COUNT 100
+// Define the maximum time an idle event loop blocks in poll (in millisecond)
+#define IDLE_MAX_BLOCK_TIME 100
+
 // Define the replication factor for the metadata
 #define METADATA_REPLICATION_FACTOR 1
 
@@ -34,8 +49,6 @@ using namespace std;
 #define DEFAULT_GLOBAL_MEMORY_REPLICATION 1
 #define DEFAULT_GLOBAL_EBS_REPLICATION 0
 #define MINIMUM_REPLICA_NUMBER 1
-// Define the default local replication factor
-#define DEFAULT_LOCAL_REPLICATION 1
 
 // Define the number of memory threads
 #define MEMORY_THREAD_NUM 4
@@ -49,6 +62,9 @@ using namespace std;
 // Define the number of benchmark threads
 #define BENCHMARK_THREAD_NUM 16
 
+// Define the number of worker threads that share one zmq I/O thread
+#define WORKERS_PER_IO_THREAD 4
+
 // Define the number of virtual thread per each physical thread
 #define VIRTUAL_THREAD_NUM 3000
 
@@ -60,9 +76,6 @@ using namespace std;
 #define PROMOTE_THRESHOLD 0
 #define DEMOTE_THRESHOLD 1
 
-#define MIN_TIER 1
-#define MAX_TIER 2
-
 #define MINIMUM_MEMORY_NODE 10
 #define MINIMUM_EBS_NODE 0
 
@@ -87,15 +100,18 @@ unsigned EBS_NODE_CAPACITY = 64000000;
 #define REQUEST_PULLING_BASE_PORT 6460
 #define GOSSIP_BASE_PORT 7060
 #define REPLICATION_FACTOR_CHANGE_BASE_PORT 7160
+#define ANTI_ENTROPY_BASE_PORT 7260
+#define TRANSFER_ACK_BASE_PORT 7360
 
 // used by proxies
-#define SEED_BASE_PORT 6560
 #define NOTIFY_BASE_PORT 6660
 #define KEY_ADDRESS_BASE_PORT 6760
 
 // used by monitoring nodes
 #define DEPART_DONE_BASE_PORT 6760
 #define LATENCY_REPORT_BASE_PORT 6860
+#define MEMBERSHIP_BASE_PORT 6960
+#define STATS_BASE_PORT 7060
 
 // used by benchmark threads
 #define COMMAND_BASE_PORT 6560
@@ -172,6 +188,31 @@ public:
   string get_replication_factor_change_bind_addr() const {
     return "tcp://*:" + to_string(tid_ + REPLICATION_FACTOR_CHANGE_BASE_PORT);
   }
+  string get_anti_entropy_connect_addr() const {
+    return "tcp://" + ip_ + ":" + to_string(tid_ + ANTI_ENTROPY_BASE_PORT);
+  }
+  string get_anti_entropy_bind_addr() const {
+    return "tcp://*:" + to_string(tid_ + ANTI_ENTROPY_BASE_PORT);
+  }
+  string get_transfer_ack_connect_addr() const {
+    return "tcp://" + ip_ + ":" + to_string(tid_ + TRANSFER_ACK_BASE_PORT);
+  }
+  string get_transfer_ack_bind_addr() const {
+    return "tcp://*:" + to_string(tid_ + TRANSFER_ACK_BASE_PORT);
+  }
+  // control messages fanned out by thread 0 to its sibling threads
+  string get_node_join_inproc_addr() const {
+    return "inproc://node_join_" + to_string(tid_);
+  }
+  string get_node_depart_inproc_addr() const {
+    return "inproc://node_depart_" + to_string(tid_);
+  }
+  string get_self_depart_inproc_addr() const {
+    return "inproc://self_depart_" + to_string(tid_);
+  }
+  string get_replication_factor_change_inproc_addr() const {
+    return "inproc://replication_factor_change_" + to_string(tid_);
+  }
 };
 
 /*bool operator<(const server_thread_t& l, const server_thread_t& r) {
@@ -196,28 +237,16 @@ struct thread_hash {
   }
 };
 
+// virtual threads and keys are placed on the ring by the same CRC32C hash, so
+// a key's precomputed key_hash_t can be searched for directly
 struct global_hasher {
-  uint32_t operator()(const server_thread_t& th) {
-    boost::crc_32_type ret;
-    ret.process_bytes(th.get_virtual_id().c_str(), th.get_virtual_id().size());
-    return ret.checksum();
-  }
-  uint32_t operator()(const string& key) {
-    boost::crc_32_type ret;
-    ret.process_bytes(key.c_str(), key.size());
-    return ret.checksum();
+  key_hash_t operator()(const server_thread_t& th) {
+    return get_key_hash(th.get_virtual_id());
   }
-  typedef uint32_t result_type;
-};
-
-struct local_hasher {
-  hash<string>::result_type operator()(const server_thread_t& th) {
-    return hash<string>{}(to_string(th.get_tid()) + "_" + to_string(th.get_virtual_num()));
+  key_hash_t operator()(const string& key) {
+    return get_key_hash(key);
   }
-  hash<string>::result_type operator()(const string& key) {
-    return hash<string>{}(key);
-  }
-  typedef hash<string>::result_type result_type;
+  typedef key_hash_t result_type;
 };
 
 
@@ -235,12 +264,6 @@ public:
   unsigned get_tid() const {
     return tid_;
   }
-  string get_seed_connect_addr() const {
-    return "tcp://" + ip_ + ":" + to_string(tid_ + SEED_BASE_PORT);
-  }
-  string get_seed_bind_addr() const {
-    return "tcp://*:" + to_string(tid_ + SEED_BASE_PORT);
-  }
   string get_notify_connect_addr() const {
     return "tcp://" + ip_ + ":" + to_string(tid_ + NOTIFY_BASE_PORT);
   }
@@ -265,6 +288,10 @@ public:
   string get_replication_factor_change_bind_addr() const {
     return "tcp://*:" + to_string(tid_ + REPLICATION_FACTOR_CHANGE_BASE_PORT);
   }
+  // control messages fanned out by thread 0 to its sibling threads
+  string get_notify_inproc_addr() const {
+    return "inproc://notify_" + to_string(tid_);
+  }
 };
 
 
@@ -301,6 +328,18 @@ public:
   string get_latency_report_bind_addr() const {
     return "tcp://*:" + to_string(LATENCY_REPORT_BASE_PORT);
   }
+  string get_membership_connect_addr() const {
+    return "tcp://" + ip_ + ":" + to_string(MEMBERSHIP_BASE_PORT);
+  }
+  string get_membership_bind_addr() const {
+    return "tcp://*:" + to_string(MEMBERSHIP_BASE_PORT);
+  }
+  string get_stats_connect_addr() const {
+    return "tcp://" + ip_ + ":" + to_string(STATS_BASE_PORT);
+  }
+  string get_stats_bind_addr() const {
+    return "tcp://*:" + to_string(STATS_BASE_PORT);
+  }
 };
 
 class user_thread_t {
@@ -330,12 +369,6 @@ public:
   }
 };
 
-// represents the replication state for each key
-struct key_info {
-  unordered_map<unsigned, unsigned> global_replication_map_;
-  unordered_map<string, unsigned> local_replication_map_;
-};
-
 // read-only per-tier metadata
 struct tier_data {
   tier_data() : thread_number_(1), default_replication_(1), node_capacity_(0) {}
@@ -347,7 +380,9 @@ struct tier_data {
 };
 
 typedef consistent_hash_map<server_thread_t, global_hasher> global_hash_t;
-typedef consistent_hash_map<server_thread_t, local_hasher> local_hash_t;
+// worker threads within a node are chosen by rendezvous hashing over the
+// tier's thread count
+typedef rendezvous_hash local_hash_t;
 
 void split(const string &s, char delim, vector<string> &elems) {
   stringstream ss(s);
@@ -378,10 +413,22 @@ string get_ip(string node_type) {
 
 // assuming the replication factor will never be greater than the number of nodes in a tier
 // return a set of server_thread_t that are responsible for a key
-unordered_set<server_thread_t, thread_hash> responsible_global(string key, unsigned global_rep, global_hash_t& global_hash_ring) {
+unordered_set<server_thread_t, thread_hash> responsible_global(key_hash_t key_hash, unsigned global_rep, global_hash_t& global_hash_ring) {
   unordered_set<server_thread_t, thread_hash> threads;
-  auto pos = global_hash_ring.find(key);
-  if (pos != global_hash_ring.end()) {
+  auto pos = global_hash_ring.find(key_hash);
+  if (pos != global_hash_ring.end() && global_hash_ring.shedding()) {
+    // bounded loads: the replicas skip the nodes that shed the key
+    auto node_ids = bounded_load_replicas(global_hash_ring, key_hash, global_rep, [](const server_thread_t& node) { return get_key_hash(node.get_ip()); });
+    for (auto it = node_ids.begin(); it != node_ids.end(); it++) {
+      threads.insert(global_hash_ring.node(*it));
+    }
+  } else if (pos != global_hash_ring.end() && min<size_t>(global_rep, global_hash_ring.nodes().size()) <= global_hash_ring.preference_list_size()) {
+    // the replicas are the head of the arc's preference list
+    auto node_ids = global_hash_ring.preference_list(pos);
+    for (unsigned i = 0; i < global_rep && i < global_hash_ring.preference_list_size(); i++) {
+      threads.insert(global_hash_ring.node(node_ids[i]));
+    }
+  } else if (pos != global_hash_ring.end()) {
     // iterate for every value in the replication factor
     unsigned i = 0;
     while (i < global_rep && i != global_hash_ring.size() / VIRTUAL_THREAD_NUM) {
@@ -399,23 +446,17 @@ unordered_set<server_thread_t, thread_hash> responsible_global(string key, unsig
 
 // assuming the replication factor will never be greater than the number of worker threads
 // return a set of tids that are responsible for a key
-unordered_set<unsigned> responsible_local(string key, unsigned local_rep, local_hash_t& local_hash_ring) {
-  unordered_set<unsigned> tids;
-  auto pos = local_hash_ring.find(key);
-  if (pos != local_hash_ring.end()) {
-    // iterate for every value in the replication factor
-    unsigned i = 0;
-    while (i < local_rep && i != local_hash_ring.size() / VIRTUAL_THREAD_NUM) {
-      bool succeed = tids.insert(pos->second.get_tid()).second;
-      if (++pos == local_hash_ring.end()) {
-        pos = local_hash_ring.begin();
-      }
-      if (succeed) {
-        i += 1;
-      }
-    }
-  }
-  return tids;
+unordered_set<unsigned> responsible_local(key_hash_t key_hash, unsigned local_rep, local_hash_t& local_hash_ring) {
+  auto tids = local_hash_ring.find(key_hash, local_rep);
+  return unordered_set<unsigned>(tids.begin(), tids.end());
+}
+
+unordered_set<server_thread_t, thread_hash> responsible_global(const string& key, unsigned global_rep, global_hash_t& global_hash_ring) {
+  return responsible_global(get_key_hash(key), global_rep, global_hash_ring);
+}
+
+unordered_set<unsigned> responsible_local(const string& key, unsigned local_rep, local_hash_t& local_hash_ring) {
+  return responsible_local(get_key_hash(key), local_rep, local_hash_ring);
 }
 
 void prepare_get_tuple(communication::Request& req, string key) {
@@ -430,6 +471,19 @@ void prepare_put_tuple(communication::Request& req, string key, string value, un
   tp->set_timestamp(timestamp);
 }
 
+// also carry the key's hash so that the receiving server need not rehash it
+void prepare_put_tuple(communication::Request& req, const string& key, key_hash_t key_hash, const string& value, unsigned long long timestamp) {
+  communication::Request_Tuple* tp = req.add_tuple();
+  tp->set_key(key);
+  tp->set_key_hash(key_hash);
+  tp->set_value(value);
+  tp->set_timestamp(timestamp);
+}
+
+key_hash_t get_key_hash(const communication::Request_Tuple& tuple) {
+  return tuple.has_key_hash() ? tuple.key_hash() : get_key_hash(tuple.key());
+}
+
 template<typename REQ, typename RES>
 bool recursive_receive(zmq::socket_t& receiving_socket, zmq::message_t& message, REQ& req, RES& response, bool& succeed) {
   bool rc = receiving_socket.recv(&message);
@@ -472,6 +526,45 @@ RES send_request(REQ& req, zmq::socket_t& sending_socket, zmq::socket_t& receivi
   return response;
 }
 
+// send all requests at once and collect the responses as they arrive, matching
+// them to their requests by id; requests that have no response by the deadline
+// are left out of the returned map
+template<typename REQ, typename RES>
+unordered_map<string, RES> send_requests(unordered_map<string, REQ>& requests, SocketCache& pushers, zmq::socket_t& receiving_socket, long timeout = GATHER_TIMEOUT) {
+  unordered_map<string, string> pending;
+  for (auto it = requests.begin(); it != requests.end(); it++) {
+    string serialized_req;
+    it->second.SerializeToString(&serialized_req);
+    zmq_util::send_string(serialized_req, &pushers[it->first]);
+    pending[it->second.request_id()] = it->first;
+  }
+
+  unordered_map<string, RES> responses;
+  vector<zmq::pollitem_t> pollitems = {{static_cast<void*>(receiving_socket), 0, ZMQ_POLLIN, 0}};
+  auto deadline = chrono::system_clock::now() + chrono::milliseconds(timeout);
+  while (pending.size() > 0) {
+    long remaining = zmq_util::time_until(deadline);
+    if (remaining <= 0 || zmq_util::poll(remaining, &pollitems) <= 0) {
+      break;
+    }
+    zmq::message_t message;
+    if (!receiving_socket.recv(&message, ZMQ_DONTWAIT)) {
+      continue;
+    }
+    RES response;
+    response.ParseFromString(zmq_util::message_to_string(message));
+    auto it = pending.find(response.response_id());
+    if (it == pending.end()) {
+      // a late response to an earlier batch
+      cerr << "id mismatch!\n";
+      continue;
+    }
+    responses[it->second] = response;
+    pending.erase(it);
+  }
+  return responses;
+}
+
 void push_request(communication::Request& req, zmq::socket_t& socket) {
   string serialized_req;
   req.SerializeToString(&serialized_req);
@@ -480,39 +573,116 @@ void push_request(communication::Request& req, zmq::socket_t& socket) {
 
 template<typename H>
 bool insert_to_hash_ring(H& hash_ring, string ip, unsigned tid) {
-  bool succeed;
+  // insert all virtual threads at once so that the ring is only rebuilt once
+  vector<server_thread_t> virtual_threads;
   for (unsigned virtual_num = 0; virtual_num < VIRTUAL_THREAD_NUM; virtual_num++) {
-    succeed = hash_ring.insert(server_thread_t(ip, tid, virtual_num)).second;
+    virtual_threads.push_back(server_thread_t(ip, tid, virtual_num));
   }
-  return succeed;
+  return hash_ring.insert(virtual_threads) > 0;
 }
 
 template<typename H>
 void remove_from_hash_ring(H& hash_ring, string ip, unsigned tid) {
+  vector<server_thread_t> virtual_threads;
   for (unsigned virtual_num = 0; virtual_num < VIRTUAL_THREAD_NUM; virtual_num++) {
-    hash_ring.erase(server_thread_t(ip, tid, virtual_num));
+    virtual_threads.push_back(server_thread_t(ip, tid, virtual_num));
   }
+  hash_ring.erase(virtual_threads);
 }
 
-bool is_metadata(string key) {
-  vector<string> v;
-  split(key, '_', v);
-  if (v.size() > 1) {
-    return true;
+// register membership changes (deltas with epoch 0) with the monitoring node
+// and fetch the server list along with the epoch it reflects
+communication::Address register_membership(const communication::Membership& registration, zmq::socket_t& membership_requester) {
+  string serialized_registration;
+  registration.SerializeToString(&serialized_registration);
+  zmq_util::send_string(serialized_registration, &membership_requester);
+  communication::Address addresses;
+  addresses.ParseFromString(zmq_util::recv_string(&membership_requester));
+  return addresses;
+}
+
+void log_membership_delta(shared_ptr<spdlog::logger> logger, const communication::Membership_Delta& delta) {
+  if (delta.has_shed()) {
+    logger->info("Applied membership epoch {}: node {} on tier {} sheds {} of {} keys", delta.epoch(), delta.ip(), delta.tier_id(), delta.shed(), LOAD_SHED_SCALE);
   } else {
-    return false;
+    logger->info("Applied membership epoch {}: {} of node {} on tier {}", delta.epoch(), delta.join() ? "join" : "departure", delta.ip(), delta.tier_id());
+  }
+}
+
+// build the global hash rings from a server list
+void populate_hash_rings(const communication::Address& addresses, unordered_map<unsigned, global_hash_t>& global_hash_ring_map) {
+  for (int i = 0; i < addresses.tuple_size(); i++) {
+    auto& hash_ring = global_hash_ring_map[addresses.tuple(i).tier_id()];
+    insert_to_hash_ring<global_hash_t>(hash_ring, addresses.tuple(i).ip(), 0);
+    if (addresses.tuple(i).has_shed()) {
+      hash_ring.set_shed(server_thread_t(addresses.tuple(i).ip(), 0), addresses.tuple(i).shed());
+    }
+  }
+}
+
+// apply the deltas of a membership message to the global hash rings in epoch
+// order; returns the deltas that were applied
+vector<communication::Membership_Delta> apply_membership(
+    const communication::Membership& membership,
+    membership_log& log,
+    unordered_map<unsigned, global_hash_t>& global_hash_ring_map) {
+  vector<communication::Membership_Delta> applied;
+  for (int i = 0; i < membership.delta_size(); i++) {
+    auto ready = log.add(membership.delta(i));
+    for (auto it = ready.begin(); it != ready.end(); it++) {
+      if (it->has_shed()) {
+        global_hash_ring_map[it->tier_id()].set_shed(server_thread_t(it->ip(), 0), it->shed());
+      } else if (it->join()) {
+        insert_to_hash_ring<global_hash_t>(global_hash_ring_map[it->tier_id()], it->ip(), 0);
+      } else {
+        remove_from_hash_ring<global_hash_t>(global_hash_ring_map[it->tier_id()], it->ip(), 0);
+      }
+      applied.push_back(*it);
+    }
+  }
+  return applied;
+}
+
+// a membership message with the deltas a thread applied; thread 0 forwards
+// these rather than the message it received, so that deltas it held back reach
+// the other threads once a later message releases them
+string serialize_membership(const vector<communication::Membership_Delta>& applied) {
+  communication::Membership membership;
+  for (auto it = applied.begin(); it != applied.end(); it++) {
+    *membership.add_delta() = *it;
+  }
+  string serialized_membership;
+  membership.SerializeToString(&serialized_membership);
+  return serialized_membership;
+}
+
+// if another node has seen a newer epoch, ask the monitoring node to send the
+// missing deltas to sync_address
+void sync_membership(
+    unsigned long long observed_epoch,
+    membership_log& log,
+    const string& sync_address,
+    const monitoring_thread_t& mt,
+    SocketCache& pushers) {
+  if (log.need_sync(observed_epoch)) {
+    communication::Membership request;
+    request.set_epoch(log.epoch());
+    request.set_sync_address(sync_address);
+    string serialized_request;
+    request.SerializeToString(&serialized_request);
+    zmq_util::send_string(serialized_request, &pushers[mt.get_notify_connect_addr()]);
   }
 }
 
 unordered_set<server_thread_t, thread_hash> get_responsible_threads_metadata(
-    string& key,
+    key_hash_t key_hash,
     global_hash_t& global_memory_hash_ring,
     local_hash_t& local_memory_hash_ring) {
   unordered_set<server_thread_t, thread_hash> threads;
-  auto mts = responsible_global(key, METADATA_REPLICATION_FACTOR, global_memory_hash_ring);
+  auto mts = responsible_global(key_hash, METADATA_REPLICATION_FACTOR, global_memory_hash_ring);
   for (auto it = mts.begin(); it != mts.end(); it++) {
     string ip = it->get_ip();
-    auto tids = responsible_local(key, DEFAULT_LOCAL_REPLICATION, local_memory_hash_ring);
+    auto tids = responsible_local(key_hash, DEFAULT_LOCAL_REPLICATION, local_memory_hash_ring);
     for (auto iter = tids.begin(); iter != tids.end(); iter++) {
       threads.insert(server_thread_t(ip, *iter));
     }
@@ -520,6 +690,13 @@ unordered_set<server_thread_t, thread_hash> get_responsible_threads_metadata(
   return threads;
 }
 
+unordered_set<server_thread_t, thread_hash> get_responsible_threads_metadata(
+    const string& key,
+    global_hash_t& global_memory_hash_ring,
+    local_hash_t& local_memory_hash_ring) {
+  return get_responsible_threads_metadata(get_key_hash(key), global_memory_hash_ring, local_memory_hash_ring);
+}
+
 void issue_replication_factor_request(
     const string& respond_address,
     const string& key,
@@ -542,49 +719,95 @@ void issue_replication_factor_request(
   push_request(req, pushers[target_address]);
 }
 
+// get the threads of the given tiers responsible for a key placed as info
+unordered_set<server_thread_t, thread_hash> get_responsible_threads(
+    key_hash_t key_hash,
+    const key_info& info,
+    unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
+    unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
+    vector<unsigned>& tier_ids) {
+  unordered_set<server_thread_t, thread_hash> result;
+  for (auto id_iter = tier_ids.begin(); id_iter != tier_ids.end(); id_iter++) {
+    unsigned tier_id = *id_iter;
+    auto mts = responsible_global(key_hash, info.global_replication(tier_id), global_hash_ring_map[tier_id]);
+    for (auto it = mts.begin(); it != mts.end(); it++) {
+      string ip = it->get_ip();
+      auto tids = responsible_local(key_hash, info.local_replication(ip), local_hash_ring_map[tier_id]);
+      for (auto iter = tids.begin(); iter != tids.end(); iter++) {
+        result.insert(server_thread_t(ip, *iter));
+      }
+    }
+  }
+  return result;
+}
+
 // get all threads responsible for a key from the "node_type" tier
 // metadata flag = 0 means the key is a metadata. Otherwise, it is a regular data
 unordered_set<server_thread_t, thread_hash> get_responsible_threads(
-    string respond_address,
-    string key,
+    const string& respond_address,
+    const string& key,
+    key_hash_t key_hash,
     bool metadata,
     unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
     unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
-    unordered_map<string, key_info>& placement,
+    placement_map& placement,
     SocketCache& pushers,
     vector<unsigned>& tier_ids,
     bool& succeed,
     unsigned& seed) {
   if (metadata) {
     succeed = true;
-    return get_responsible_threads_metadata(key, global_hash_ring_map[1], local_hash_ring_map[1]);
-  } else {
-    unordered_set<server_thread_t, thread_hash> result;
-    if (placement.find(key) == placement.end()) {
-      issue_replication_factor_request(respond_address, key, global_hash_ring_map[1], local_hash_ring_map[1], pushers, seed);
-      succeed = false;
-    } else {
-      for (auto id_iter = tier_ids.begin(); id_iter != tier_ids.end(); id_iter++) {
-        unsigned tier_id = *id_iter;
-        auto mts = responsible_global(key, placement[key].global_replication_map_[tier_id], global_hash_ring_map[tier_id]);
-        for (auto it = mts.begin(); it != mts.end(); it++) {
-          string ip = it->get_ip();
-          if (placement[key].local_replication_map_.find(ip) == placement[key].local_replication_map_.end()) {
-            placement[key].local_replication_map_[ip] = DEFAULT_LOCAL_REPLICATION;
-          }
-          auto tids = responsible_local(key, placement[key].local_replication_map_[ip], local_hash_ring_map[tier_id]);
-          for (auto iter = tids.begin(); iter != tids.end(); iter++) {
-            result.insert(server_thread_t(ip, *iter));
-          }
-        }
-      }
-      succeed = true;
-    }
-    return result;
+    return get_responsible_threads_metadata(key_hash, global_hash_ring_map[1], local_hash_ring_map[1]);
   }
+  const key_info* info = placement.find(key);
+  if (info == NULL) {
+    issue_replication_factor_request(respond_address, key, global_hash_ring_map[1], local_hash_ring_map[1], pushers, seed);
+    succeed = false;
+    return unordered_set<server_thread_t, thread_hash>();
+  }
+  succeed = true;
+  return get_responsible_threads(key_hash, *info, global_hash_ring_map, local_hash_ring_map, tier_ids);
+}
+
+unordered_set<server_thread_t, thread_hash> get_responsible_threads(
+    const string& respond_address,
+    const string& key,
+    bool metadata,
+    unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
+    unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
+    placement_map& placement,
+    SocketCache& pushers,
+    vector<unsigned>& tier_ids,
+    bool& succeed,
+    unsigned& seed) {
+  return get_responsible_threads(respond_address, key, get_key_hash(key), metadata, global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
 }
 
-// query the proxy for a key and return all address
+// get all threads responsible for a regular key from placement, a table shared
+// with other threads; the caller must hold a read guard of the table
+unordered_set<server_thread_t, thread_hash> get_responsible_threads(
+    const string& respond_address,
+    const string& key,
+    key_hash_t key_hash,
+    unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
+    unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
+    const placement_table& placement,
+    SocketCache& pushers,
+    vector<unsigned>& tier_ids,
+    bool& succeed,
+    unsigned& seed) {
+  const key_info* info = placement.find(key);
+  if (info == NULL) {
+    issue_replication_factor_request(respond_address, key, global_hash_ring_map[1], local_hash_ring_map[1], pushers, seed);
+    succeed = false;
+    return unordered_set<server_thread_t, thread_hash>();
+  }
+  succeed = true;
+  return get_responsible_threads(key_hash, *info, global_hash_ring_map, local_hash_ring_map, tier_ids);
+}
+
+// query the proxy for a key and return all address; ring_epoch is the newest
+// membership epoch the caller has seen and is advanced by the response
 vector<string> get_address_from_proxy(
     user_thread_t& ut,
     string key,
@@ -593,9 +816,11 @@ vector<string> get_address_from_proxy(
     bool& succeed,
     string& ip,
     unsigned& thread_id,
-    unsigned& rid) {
+    unsigned& rid,
+    unsigned long long& ring_epoch) {
   communication::Key_Request key_req;
   key_req.set_respond_address(ut.get_key_address_connect_addr());
+  key_req.set_ring_epoch(ring_epoch);
   key_req.add_keys(key);
   string req_id = ip + ":" + to_string(thread_id) + "_" + to_string(rid);
   key_req.set_request_id(req_id);
@@ -607,6 +832,9 @@ vector<string> get_address_from_proxy(
     for (int j = 0; j < key_response.tuple(0).addresses_size(); j++) {
       result.push_back(key_response.tuple(0).addresses(j));
     }
+    if (key_response.ring_epoch() > ring_epoch) {
+      ring_epoch = key_response.ring_epoch();
+    }
   }
   return result;
 }
@@ -617,13 +845,12 @@ proxy_thread_t get_random_proxy_thread(vector<string>& proxy_address, unsigned&
   return proxy_thread_t(proxy_ip, tid);
 }
 
-void warmup(unordered_map<string, key_info>& placement) {
-  for (unsigned i = 1; i <= 1000000; i++) {
-    // key is 8 bytes
-    string key = string(8 - to_string(i).length(), '0') + to_string(i);
-    placement[key].global_replication_map_[1] = DEFAULT_GLOBAL_MEMORY_REPLICATION;
-    placement[key].global_replication_map_[2] = DEFAULT_GLOBAL_EBS_REPLICATION;
-  }
+// the placement of a key nobody changed the replication of
+key_info default_key_info() {
+  key_info info;
+  info.set_global_replication(1, DEFAULT_GLOBAL_MEMORY_REPLICATION);
+  info.set_global_replication(2, DEFAULT_GLOBAL_EBS_REPLICATION);
+  return info;
 }
 
 #endif
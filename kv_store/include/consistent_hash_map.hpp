@@ -1,7 +1,8 @@
-#include <map>
+#include <stdint.h>
 #include <string>
-#include <list>
-#include <functional> 
+#include <vector>
+#include <iterator>
+#include <functional>
 #include <algorithm>
 
 using namespace::std;
@@ -9,26 +10,82 @@ using namespace::std;
 #ifndef __CONSISTENT_HASH_H__
 #define __CONSISTENT_HASH_H__
 
+// Define the size of a cache line, used to prefetch the search path of the ring
+#define CACHE_LINE_SIZE 64
 
+// Define the longest replica preference list precomputed for every ring arc;
+// larger replication factors fall back to walking the ring
+#ifndef MAX_PREFERENCE_LIST_SIZE
+#define MAX_PREFERENCE_LIST_SIZE 4
+#endif
 
-template <typename T,
-        typename Hash,
-        typename Alloc = std::allocator<std::pair<const typename Hash::result_type,T > > >
+// The ring is stored as a sorted array of hash points with a parallel array of
+// small node ids indexing into a table of physical nodes; a node is identified
+// by T's operator==, so all virtual nodes of a physical node share one entry.
+// Lookups search a copy of the points laid out in Eytzinger (BFS) order, so the
+// first levels of every search share a handful of cache lines. Membership
+// changes insert or erase all virtual nodes of a physical node in one batch and
+// rebuild the arrays in linear time. Each point also stores the ordered list of
+// distinct nodes that follow it, so finding the replicas of a key is a single
+// search plus a slice. For bounded-load placement every node also carries the
+// share of its keys it sheds to the nodes after it; the ring only stores it.
+template <typename T, typename Hash>
 class consistent_hash_map
 {
 public:
- 
+
     typedef typename Hash::result_type size_type;
-    typedef std::map<size_type,T,std::less<size_type>,Alloc> map_type;
-    typedef typename map_type::value_type value_type;
-    typedef value_type& reference;
-    typedef const value_type& const_reference;
-    typedef typename map_type::iterator iterator;
-    typedef typename map_type::reverse_iterator reverse_iterator;
-    typedef Alloc allocator_type;
+    typedef uint16_t node_id_type;
+    typedef std::pair<size_type, const T&> value_type;
+
+    class iterator {
+    public:
+        typedef std::random_access_iterator_tag iterator_category;
+        typedef typename consistent_hash_map::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef value_type reference;
+
+        // value_type holds a reference into the node table, so -> hands out a
+        // temporary that owns the pair
+        struct pointer {
+            value_type value_;
+            const value_type* operator->() const { return &value_; }
+        };
+
+        iterator() : ring_(NULL), pos_(0) {}
+        iterator(const consistent_hash_map* ring, std::size_t pos) : ring_(ring), pos_(pos) {}
+
+        reference operator*() const {
+            return value_type(ring_->points_[pos_], ring_->nodes_[ring_->node_ids_[pos_]]);
+        }
+        pointer operator->() const {
+            pointer p = { **this };
+            return p;
+        }
+
+        iterator& operator++() { pos_++; return *this; }
+        iterator operator++(int) { iterator it = *this; pos_++; return it; }
+        iterator& operator--() { pos_--; return *this; }
+        iterator operator--(int) { iterator it = *this; pos_--; return it; }
+        iterator& operator+=(difference_type n) { pos_ += n; return *this; }
+        iterator& operator-=(difference_type n) { pos_ -= n; return *this; }
+        iterator operator+(difference_type n) const { return iterator(ring_, pos_ + n); }
+        iterator operator-(difference_type n) const { return iterator(ring_, pos_ - n); }
+        difference_type operator-(const iterator& r) const { return pos_ - r.pos_; }
+
+        bool operator==(const iterator& r) const { return pos_ == r.pos_; }
+        bool operator!=(const iterator& r) const { return pos_ != r.pos_; }
+        bool operator<(const iterator& r) const { return pos_ < r.pos_; }
+
+        std::size_t index() const { return pos_; }
+
+    private:
+        const consistent_hash_map* ring_;
+        std::size_t pos_;
+    };
 
 public:
-    
+
     consistent_hash_map() {
 
     }
@@ -38,39 +95,162 @@ public:
     }
 
 public:
+    // the number of virtual nodes (hash points) on the ring
     std::size_t size() const {
-        return nodes_.size();
+        return points_.size();
     }
 
     bool empty() const {
-        return nodes_.empty();
+        return points_.empty();
+    }
+
+    // the distinct physical nodes on the ring
+    const std::vector<T>& nodes() const {
+        return nodes_;
+    }
+
+    const T& node(node_id_type id) const {
+        return nodes_[id];
+    }
+
+    // the node owning the point at it
+    node_id_type node_id(const iterator& it) const {
+        return node_ids_[it.index()];
+    }
+
+    uint32_t shed(node_id_type id) const {
+        return sheds_[id];
+    }
+
+    // whether any node sheds keys
+    bool shedding() const {
+        return shedding_;
+    }
+
+    // set the share of its keys a node sheds; unknown nodes are ignored
+    void set_shed(const T& node, uint32_t shed) {
+        auto it = std::find(nodes_.begin(), nodes_.end(), node);
+        if (it != nodes_.end()) {
+            sheds_[it - nodes_.begin()] = shed;
+            update_shedding();
+        }
+    }
+
+    // the number of distinct nodes stored per point; it is the smaller of
+    // MAX_PREFERENCE_LIST_SIZE and the number of nodes
+    std::size_t preference_list_size() const {
+        return preference_list_size_;
+    }
+
+    // the distinct nodes met walking clockwise from it, nearest first
+    const node_id_type* preference_list(const iterator& it) const {
+        return &preference_lists_[it.index() * preference_list_size_];
     }
 
     std::pair<iterator,bool> insert(const T& node) {
         size_type hash = hasher_(node);
-        return nodes_.insert(value_type(hash,node));
+        bool inserted = insert(std::vector<T>(1, node)) > 0;
+        return std::make_pair(lower_bound(hash), inserted);
     }
 
+    // insert a batch of virtual nodes; a point whose hash is already taken is
+    // skipped, as with a map. Returns the number of points added
+    std::size_t insert(const std::vector<T>& virtual_nodes) {
+        std::vector<std::pair<size_type, node_id_type>> added;
+        added.reserve(virtual_nodes.size());
+        for (auto it = virtual_nodes.begin(); it != virtual_nodes.end(); it++) {
+            added.push_back(std::make_pair(hasher_(*it), get_node_id(*it)));
+        }
+        std::sort(added.begin(), added.end());
+
+        std::vector<size_type> points;
+        std::vector<node_id_type> node_ids;
+        points.reserve(points_.size() + added.size());
+        node_ids.reserve(points_.size() + added.size());
+        std::size_t count = 0;
+        std::size_t i = 0;
+        for (auto it = added.begin(); it != added.end(); it++) {
+            while (i < points_.size() && points_[i] < it->first) {
+                points.push_back(points_[i]);
+                node_ids.push_back(node_ids_[i]);
+                i++;
+            }
+            if ((i < points_.size() && points_[i] == it->first) || (points.size() > 0 && points.back() == it->first)) {
+                continue;
+            }
+            points.push_back(it->first);
+            node_ids.push_back(it->second);
+            count++;
+        }
+        points.insert(points.end(), points_.begin() + i, points_.end());
+        node_ids.insert(node_ids.end(), node_ids_.begin() + i, node_ids_.end());
 
-    void erase(iterator it) {
-        nodes_.erase(it);
+        points_.swap(points);
+        node_ids_.swap(node_ids);
+        compact_nodes();
+        rebuild_index();
+        return count;
     }
 
+    void erase(iterator it) {
+        points_.erase(points_.begin() + it.index());
+        node_ids_.erase(node_ids_.begin() + it.index());
+        compact_nodes();
+        rebuild_index();
+    }
 
     std::size_t erase(const T& node) {
-        size_type hash = hasher_(node);
-        return nodes_.erase(hash);
+        return erase(std::vector<T>(1, node));
+    }
+
+    // erase a batch of virtual nodes; a point is only removed if it belongs to
+    // the same physical node. Returns the number of points removed
+    std::size_t erase(const std::vector<T>& virtual_nodes) {
+        std::vector<std::pair<size_type, node_id_type>> removed;
+        removed.reserve(virtual_nodes.size());
+        for (auto it = virtual_nodes.begin(); it != virtual_nodes.end(); it++) {
+            auto node = std::find(nodes_.begin(), nodes_.end(), *it);
+            if (node != nodes_.end()) {
+                removed.push_back(std::make_pair(hasher_(*it), node - nodes_.begin()));
+            }
+        }
+        std::sort(removed.begin(), removed.end());
+
+        std::size_t count = 0;
+        std::size_t j = 0;
+        auto it = removed.begin();
+        for (std::size_t i = 0; i < points_.size(); i++) {
+            while (it != removed.end() && it->first < points_[i]) {
+                it++;
+            }
+            if (it != removed.end() && it->first == points_[i] && it->second == node_ids_[i]) {
+                count++;
+                continue;
+            }
+            points_[j] = points_[i];
+            node_ids_[j] = node_ids_[i];
+            j++;
+        }
+        points_.resize(j);
+        node_ids_.resize(j);
+
+        if (count > 0) {
+            compact_nodes();
+            rebuild_index();
+        }
+        return count;
     }
 
+    // the first point at or after hash, wrapping around to the start of the ring
     iterator find(size_type hash) {
-        if(nodes_.empty()) {
-            return nodes_.end();
+        if (points_.empty()) {
+            return end();
         }
 
-        iterator it = nodes_.lower_bound(hash);
+        iterator it = lower_bound(hash);
 
-        if (it == nodes_.end()) {
-            it = nodes_.begin();
+        if (it == end()) {
+            it = begin();
         }
 
         return it;
@@ -80,16 +260,133 @@ public:
         return find(hasher_(key));
     }
 
-    iterator begin() { return nodes_.begin(); }
-    iterator end() { return nodes_.end(); }
-    reverse_iterator rbegin() { return nodes_.rbegin(); }
-    reverse_iterator rend() { return nodes_.rend(); }
-
+    iterator begin() const { return iterator(this, 0); }
+    iterator end() const { return iterator(this, points_.size()); }
 
 private:
 
+    iterator lower_bound(size_type hash) const {
+        const std::size_t n = points_.size();
+        const size_type* tree = search_tree_.data();
+        std::size_t k = 1;
+        while (k <= n) {
+            // the descendants four levels down share one cache line
+            __builtin_prefetch(tree + k * (CACHE_LINE_SIZE / sizeof(size_type)));
+            k = 2 * k + (tree[k] < hash);
+        }
+        // undo the right turns taken after the last left turn
+        k >>= __builtin_ffsll(~k);
+        return iterator(this, k == 0 ? n : search_rank_[k]);
+    }
+
+    node_id_type get_node_id(const T& node) {
+        // virtual nodes are usually inserted in runs of the same physical node
+        if (!nodes_.empty() && nodes_.back() == node) {
+            return nodes_.size() - 1;
+        }
+        auto it = std::find(nodes_.begin(), nodes_.end(), node);
+        if (it != nodes_.end()) {
+            return it - nodes_.begin();
+        }
+        nodes_.push_back(node);
+        sheds_.push_back(0);
+        return nodes_.size() - 1;
+    }
+
+    void update_shedding() {
+        shedding_ = std::find_if(sheds_.begin(), sheds_.end(), [](uint32_t shed) { return shed != 0; }) != sheds_.end();
+    }
+
+    // drop nodes that no longer own any point and renumber the rest
+    void compact_nodes() {
+        std::vector<node_id_type> remap(nodes_.size(), 0);
+        std::vector<bool> used(nodes_.size(), false);
+        for (auto it = node_ids_.begin(); it != node_ids_.end(); it++) {
+            used[*it] = true;
+        }
+        std::size_t j = 0;
+        for (std::size_t i = 0; i < nodes_.size(); i++) {
+            if (used[i]) {
+                remap[i] = j;
+                if (i != j) {
+                    nodes_[j] = nodes_[i];
+                    sheds_[j] = sheds_[i];
+                }
+                j++;
+            }
+        }
+        if (j == nodes_.size()) {
+            return;
+        }
+        nodes_.erase(nodes_.begin() + j, nodes_.end());
+        sheds_.erase(sheds_.begin() + j, sheds_.end());
+        update_shedding();
+        for (auto it = node_ids_.begin(); it != node_ids_.end(); it++) {
+            *it = remap[*it];
+        }
+    }
+
+    void rebuild_index() {
+        search_tree_.assign(points_.size() + 1, 0);
+        search_rank_.assign(points_.size() + 1, 0);
+        std::size_t i = 0;
+        build_index(i, 1);
+        build_preference_lists();
+    }
+
+    // the list of a point is its own node followed by the list of the next
+    // point minus that node; walking backwards around the ring twice makes the
+    // lists that wrap past the end complete
+    void build_preference_lists() {
+        const std::size_t n = points_.size();
+        const std::size_t width = std::min<std::size_t>(MAX_PREFERENCE_LIST_SIZE, nodes_.size());
+        preference_list_size_ = width;
+        preference_lists_.assign(n * width, 0);
+        if (n == 0) {
+            return;
+        }
+
+        std::vector<node_id_type> next;
+        std::vector<node_id_type> current;
+        for (std::size_t step = 2 * n; step > 0; step--) {
+            std::size_t i = (step - 1) % n;
+            current.clear();
+            current.push_back(node_ids_[i]);
+            for (auto it = next.begin(); it != next.end() && current.size() < width; it++) {
+                if (*it != node_ids_[i]) {
+                    current.push_back(*it);
+                }
+            }
+            if (step <= n) {
+                std::copy(current.begin(), current.end(), preference_lists_.begin() + i * width);
+            }
+            next.swap(current);
+        }
+    }
+
+    void build_index(std::size_t& i, std::size_t k) {
+        if (k <= points_.size()) {
+            build_index(i, 2 * k);
+            search_tree_[k] = points_[i];
+            search_rank_[k] = i++;
+            build_index(i, 2 * k + 1);
+        }
+    }
+
     Hash hasher_;
-    map_type nodes_;
+    // sorted hash points and the node owning each of them
+    std::vector<size_type> points_;
+    std::vector<node_id_type> node_ids_;
+    std::vector<T> nodes_;
+    // the share of its keys each node sheds
+    std::vector<uint32_t> sheds_;
+    bool shedding_ = false;
+    // the points in Eytzinger order (1-based) and their position in points_
+    std::vector<size_type> search_tree_;
+    std::vector<uint32_t> search_rank_;
+    // preference_list_size_ node ids per point
+    std::size_t preference_list_size_ = 0;
+    std::vector<node_id_type> preference_lists_;
 };
 
 
@@ -0,0 +1,84 @@
+#ifndef __KEY_HASH_H__
+#define __KEY_HASH_H__
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+using namespace std;
+
+// Define the reflected Castagnoli polynomial used by CRC32C
+#define CRC32C_POLY 0x82F63B78
+
+// the hash of a key; it places the key on the global hash ring and picks its
+// worker threads, and is computed once per key and carried along with it
+typedef uint32_t key_hash_t;
+
+struct crc32c_table {
+  crc32c_table() {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (unsigned j = 0; j < 8; j++) {
+        crc = (crc >> 1) ^ ((crc & 1) ? CRC32C_POLY : 0);
+      }
+      table_[i] = crc;
+    }
+  }
+  uint32_t table_[256];
+};
+
+// byte at a time fallback for CPUs without SSE4.2
+uint32_t crc32c_portable(const char* data, size_t size) {
+  static const crc32c_table crc_table;
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < size; i++) {
+    crc = crc_table.table_[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t crc32c_hardware(const char* data, size_t size) {
+  uint64_t crc = 0xFFFFFFFF;
+  while (size >= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    crc = _mm_crc32_u64(crc, word);
+    data += 8;
+    size -= 8;
+  }
+  uint32_t crc32 = crc;
+  while (size > 0) {
+    crc32 = _mm_crc32_u8(crc32, *data);
+    data++;
+    size--;
+  }
+  return ~crc32;
+}
+#endif
+
+uint32_t crc32c(const char* data, size_t size) {
+#if defined(__x86_64__)
+  static const bool hardware = __builtin_cpu_supports("sse4.2");
+  if (hardware) {
+    return crc32c_hardware(data, size);
+  }
+#endif
+  return crc32c_portable(data, size);
+}
+
+key_hash_t get_key_hash(const string& key) {
+  return crc32c(key.data(), key.size());
+}
+
+// a metadata key has a '_' followed by at least one more character
+bool is_metadata(const string& key) {
+  size_t underscore = key.find('_');
+  return underscore != string::npos && underscore + 1 < key.size();
+}
+
+#endif
@@ -0,0 +1,122 @@
+#ifndef __LATENCY_HISTOGRAM_H__
+#define __LATENCY_HISTOGRAM_H__
+
+#include <stdint.h>
+#include <vector>
+#include "message.pb.h"
+
+using namespace std;
+
+// Define the number of sub-buckets per power of two as a power of two; 3 gives
+// 8 sub-buckets and a relative error of at most 1/8
+#define LATENCY_SUB_BUCKET_BITS 3
+// Define the largest latency a histogram tells apart as a power of two (in
+// microsecond); larger values land in the last bucket
+#define LATENCY_MAX_EXPONENT 36
+
+// A latency histogram with logarithmic buckets: values below 2^(bits + 1) get
+// a bucket each, and every larger power of two is split into 2^bits buckets of
+// equal width. Histograms of different threads merge by adding their counts,
+// so percentiles can be taken over a whole tier.
+class latency_histogram {
+  vector<uint64_t> counts_;
+  uint64_t total_;
+
+  static uint64_t sub_bucket_number() {
+    return 1ULL << LATENCY_SUB_BUCKET_BITS;
+  }
+
+public:
+  latency_histogram() : counts_(bucket_number(), 0), total_(0) {}
+
+  static unsigned bucket_number() {
+    return 2 * sub_bucket_number() + (LATENCY_MAX_EXPONENT - LATENCY_SUB_BUCKET_BITS) * sub_bucket_number();
+  }
+
+  // the bucket a value (in microsecond) falls in
+  static unsigned bucket(uint64_t value) {
+    if (value < 2 * sub_bucket_number()) {
+      return value;
+    }
+    unsigned exponent = 63 - __builtin_clzll(value);
+    if (exponent > LATENCY_MAX_EXPONENT) {
+      return bucket_number() - 1;
+    }
+    unsigned sub_bucket = (value >> (exponent - LATENCY_SUB_BUCKET_BITS)) - sub_bucket_number();
+    return 2 * sub_bucket_number() + (exponent - LATENCY_SUB_BUCKET_BITS - 1) * sub_bucket_number() + sub_bucket;
+  }
+
+  // the largest value in a bucket
+  static uint64_t bucket_upper(unsigned index) {
+    if (index < 2 * sub_bucket_number()) {
+      return index;
+    }
+    unsigned offset = index - 2 * sub_bucket_number();
+    unsigned exponent = offset / sub_bucket_number() + LATENCY_SUB_BUCKET_BITS + 1;
+    uint64_t lower = (sub_bucket_number() + offset % sub_bucket_number()) << (exponent - LATENCY_SUB_BUCKET_BITS);
+    return lower + (1ULL << (exponent - LATENCY_SUB_BUCKET_BITS)) - 1;
+  }
+
+  void record(uint64_t value, uint64_t count = 1) {
+    counts_[bucket(value)] += count;
+    total_ += count;
+  }
+
+  void merge(const latency_histogram& other) {
+    for (unsigned i = 0; i < counts_.size(); i++) {
+      counts_[i] += other.counts_[i];
+    }
+    total_ += other.total_;
+  }
+
+  uint64_t count() const {
+    return total_;
+  }
+
+  // an upper bound on the q-quantile, or 0 if nothing was recorded
+  uint64_t percentile(double q) const {
+    if (total_ == 0) {
+      return 0;
+    }
+    uint64_t rank = (uint64_t) (q * total_);
+    if (rank >= total_) {
+      rank = total_ - 1;
+    }
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < counts_.size(); i++) {
+      seen += counts_[i];
+      if (seen > rank) {
+        return bucket_upper(i);
+      }
+    }
+    return bucket_upper(counts_.size() - 1);
+  }
+
+  void clear() {
+    for (unsigned i = 0; i < counts_.size(); i++) {
+      counts_[i] = 0;
+    }
+    total_ = 0;
+  }
+
+  // only the non-empty buckets are sent
+  void to_proto(communication::Latency_Histogram& histogram) const {
+    for (unsigned i = 0; i < counts_.size(); i++) {
+      if (counts_[i] > 0) {
+        histogram.add_bucket(i);
+        histogram.add_count(counts_[i]);
+      }
+    }
+  }
+
+  void merge(const communication::Latency_Histogram& histogram) {
+    for (int i = 0; i < histogram.bucket_size() && i < histogram.count_size(); i++) {
+      if (histogram.bucket(i) < counts_.size()) {
+        counts_[histogram.bucket(i)] += histogram.count(i);
+        total_ += histogram.count(i);
+      }
+    }
+  }
+};
+
+#endif
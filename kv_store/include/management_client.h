@@ -0,0 +1,213 @@
+#ifndef __MANAGEMENT_CLIENT_H__
+#define __MANAGEMENT_CLIENT_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <netdb.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Define how long the management server may take to answer a request (in
+// millisecond); it only answers once the cluster operation has finished
+#define MANAGEMENT_TIMEOUT 600000
+// Define the number of attempts for a request the management server never
+// received or failed
+#define MANAGEMENT_RETRY 3
+// Define the wait before the first retry; it doubles with every retry (in
+// millisecond)
+#define MANAGEMENT_RETRY_BACKOFF 1000
+
+// called with the HTTP status of the last attempt, or 0 if there was no answer
+typedef function<void(int)> management_callback;
+
+// Sends POST requests to the management server from background threads, so
+// that adding and removing nodes, which takes minutes, does not block the
+// monitoring loop. Every request gets its own thread, so a slow request does
+// not hold up the ones posted after it. A request the server never received,
+// or that it failed with a 5xx status, is retried with exponential backoff;
+// one the server received but did not answer is not, since the operation may
+// still be running. Callbacks run on the thread that calls complete().
+class management_client {
+  string host_;
+  string port_;
+  long timeout_;
+  long backoff_;
+
+  // callbacks of the requests that have not completed, by request id
+  unordered_map<unsigned, management_callback> callbacks_;
+  unsigned next_id_;
+
+  // shared with the request threads
+  mutex mutex_;
+  condition_variable stopped_;
+  deque<pair<unsigned, int>> done_;
+  bool stop_;
+  // the threads of the requests whose callbacks have not run, by request id
+  unordered_map<unsigned, thread> workers_;
+
+  // one attempt; sets sent if the whole request went out
+  static int post(const string& host, const string& port, const string& path, long timeout, bool& sent) {
+    sent = false;
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* addresses;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+      return 0;
+    }
+    int fd = -1;
+    for (struct addrinfo* it = addresses; it != NULL; it = it->ai_next) {
+      fd = socket(it->ai_family, it->ai_socktype, it->ai_protocol);
+      if (fd < 0) {
+        continue;
+      }
+      // the send timeout also bounds connect
+      struct timeval tv;
+      tv.tv_sec = timeout / 1000;
+      tv.tv_usec = (timeout % 1000) * 1000;
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+      if (connect(fd, it->ai_addr, it->ai_addrlen) == 0) {
+        break;
+      }
+      close(fd);
+      fd = -1;
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+      return 0;
+    }
+
+    string message = "POST " + path + " HTTP/1.1\r\nHost: " + host + "\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+    size_t written = 0;
+    while (written < message.size()) {
+      ssize_t n = send(fd, message.data() + written, message.size() - written, MSG_NOSIGNAL);
+      if (n <= 0) {
+        close(fd);
+        return 0;
+      }
+      written += n;
+    }
+    sent = true;
+
+    // only the status line is of interest
+    string response;
+    char buffer[512];
+    while (response.find("\r\n") == string::npos) {
+      ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+      if (n <= 0) {
+        break;
+      }
+      response.append(buffer, n);
+    }
+    close(fd);
+    if (response.compare(0, 5, "HTTP/") != 0) {
+      return 0;
+    }
+    size_t space = response.find(' ');
+    if (space == string::npos || space + 4 > response.size()) {
+      return 0;
+    }
+    return atoi(response.substr(space + 1, 3).c_str());
+  }
+
+  void run(unsigned id, string path) {
+    int status = 0;
+    long backoff = backoff_;
+    for (unsigned attempt = 1; attempt <= MANAGEMENT_RETRY; attempt++) {
+      bool sent;
+      status = post(host_, port_, path, timeout_, sent);
+      bool retry = (!sent && status == 0) || status >= 500;
+      if (!retry || attempt == MANAGEMENT_RETRY) {
+        break;
+      }
+      unique_lock<mutex> lock(mutex_);
+      if (stopped_.wait_for(lock, chrono::milliseconds(backoff), [this] { return stop_; })) {
+        break;
+      }
+      backoff *= 2;
+    }
+    lock_guard<mutex> lock(mutex_);
+    done_.push_back(make_pair(id, status));
+  }
+
+public:
+  // address is host or host:port
+  management_client(const string& address, long timeout = MANAGEMENT_TIMEOUT, long backoff = MANAGEMENT_RETRY_BACKOFF) :
+    port_("80"), timeout_(timeout), backoff_(backoff), next_id_(0), stop_(false) {
+    size_t colon = address.rfind(':');
+    if (colon == string::npos) {
+      host_ = address;
+    } else {
+      host_ = address.substr(0, colon);
+      port_ = address.substr(colon + 1);
+    }
+  }
+
+  // requests waiting to be retried are abandoned, but attempts being sent are
+  // finished
+  ~management_client() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      stop_ = true;
+    }
+    stopped_.notify_all();
+    for (auto it = workers_.begin(); it != workers_.end(); it++) {
+      it->second.join();
+    }
+  }
+
+  // start a POST of path; returns the request id
+  unsigned post(const string& path, management_callback callback) {
+    unsigned id = next_id_++;
+    callbacks_[id] = callback;
+    workers_[id] = thread(&management_client::run, this, id, path);
+    return id;
+  }
+
+  // run the callbacks of the requests that completed since the last call;
+  // returns their number
+  unsigned complete() {
+    deque<pair<unsigned, int>> done;
+    {
+      lock_guard<mutex> lock(mutex_);
+      done.swap(done_);
+    }
+    for (auto it = done.begin(); it != done.end(); it++) {
+      auto worker_it = workers_.find(it->first);
+      if (worker_it != workers_.end()) {
+        worker_it->second.join();
+        workers_.erase(worker_it);
+      }
+      auto callback_it = callbacks_.find(it->first);
+      if (callback_it != callbacks_.end()) {
+        management_callback callback = callback_it->second;
+        callbacks_.erase(callback_it);
+        if (callback) {
+          callback(it->second);
+        }
+      }
+    }
+    return done.size();
+  }
+
+  // the number of requests whose callbacks have not run
+  unsigned pending() const {
+    return callbacks_.size();
+  }
+};
+
+#endif
@@ -0,0 +1,125 @@
+#ifndef __MEMBERSHIP_LOG_H__
+#define __MEMBERSHIP_LOG_H__
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include "message.pb.h"
+
+using namespace std;
+
+// Define how long a node waits for the missing changes before it asks for
+// them again (in millisecond)
+#define MEMBERSHIP_SYNC_TIMEOUT 5000
+
+// The ordered log of ring membership changes. Every change carries the epoch
+// the monitoring node assigned to it, and a node's ring reflects exactly the
+// changes up to its current epoch. Changes that arrive ahead of a missing one
+// are held back until the gap is filled, so all rings at the same epoch agree.
+// Only the monitoring node, which numbers the changes, keeps the applied ones
+// to resend them; other nodes drop a change once it is applied.
+class membership_log {
+  // changes by epoch, both applied and held back
+  map<unsigned long long, communication::Membership_Delta> deltas_;
+  // every change up to and including this epoch has been applied
+  unsigned long long epoch_;
+  // the newest epoch a sync has been requested for, and when
+  unsigned long long sync_epoch_;
+  chrono::steady_clock::time_point sync_time_;
+  // whether applied changes are kept
+  bool keep_history_;
+
+public:
+  // the log of the monitoring node
+  membership_log() : epoch_(0), sync_epoch_(0), keep_history_(true) {}
+  // start from a snapshot of the membership at epoch
+  membership_log(unsigned long long epoch) : epoch_(epoch), sync_epoch_(epoch), keep_history_(false) {}
+
+  unsigned long long epoch() const {
+    return epoch_;
+  }
+
+  // whether changes newer than a missing one are held back
+  bool has_gap() const {
+    return !deltas_.empty() && deltas_.rbegin()->first > epoch_;
+  }
+
+  unsigned long long newest_epoch() const {
+    return deltas_.empty() ? epoch_ : max(epoch_, deltas_.rbegin()->first);
+  }
+
+  // record a change; returns the changes that can now be applied, in epoch order
+  vector<communication::Membership_Delta> add(const communication::Membership_Delta& delta) {
+    vector<communication::Membership_Delta> ready;
+    if (delta.epoch() <= epoch_ || deltas_.find(delta.epoch()) != deltas_.end()) {
+      return ready;
+    }
+    deltas_[delta.epoch()] = delta;
+    for (auto it = deltas_.find(epoch_ + 1); it != deltas_.end() && it->first == epoch_ + 1; it++) {
+      ready.push_back(it->second);
+      epoch_ += 1;
+    }
+    if (!keep_history_) {
+      deltas_.erase(deltas_.begin(), deltas_.upper_bound(epoch_));
+    }
+    return ready;
+  }
+
+  // number a new change with the next epoch; only used by the monitoring node
+  communication::Membership_Delta append(bool join, unsigned tier_id, const string& ip) {
+    communication::Membership_Delta delta;
+    delta.set_epoch(epoch_ + 1);
+    delta.set_join(join);
+    delta.set_tier_id(tier_id);
+    delta.set_ip(ip);
+    deltas_[delta.epoch()] = delta;
+    epoch_ += 1;
+    return delta;
+  }
+
+  // number a change to the share of keys a node sheds; only used by the
+  // monitoring node
+  communication::Membership_Delta append_shed(unsigned tier_id, const string& ip, unsigned shed) {
+    communication::Membership_Delta delta;
+    delta.set_epoch(epoch_ + 1);
+    delta.set_join(true);
+    delta.set_tier_id(tier_id);
+    delta.set_ip(ip);
+    delta.set_shed(shed);
+    deltas_[delta.epoch()] = delta;
+    epoch_ += 1;
+    return delta;
+  }
+
+  // add every change after epoch that this log knows of; only the monitoring
+  // node's log keeps them
+  void get_deltas_since(unsigned long long epoch, communication::Membership& membership) const {
+    for (auto it = deltas_.upper_bound(epoch); it != deltas_.end() && it->first <= epoch_; it++) {
+      *membership.add_delta() = it->second;
+    }
+  }
+
+  // whether to ask for the changes up to observed_epoch; a sync is requested
+  // once for each newer epoch observed, and again if the changes have not
+  // arrived MEMBERSHIP_SYNC_TIMEOUT after the last request
+  bool need_sync(unsigned long long observed_epoch, chrono::steady_clock::time_point now = chrono::steady_clock::now()) {
+    if (observed_epoch <= epoch_) {
+      return false;
+    }
+    if (observed_epoch <= sync_epoch_ && now - sync_time_ < chrono::milliseconds(MEMBERSHIP_SYNC_TIMEOUT)) {
+      return false;
+    }
+    sync_epoch_ = max(sync_epoch_, observed_epoch);
+    sync_time_ = now;
+    return true;
+  }
+
+  // the number of changes held
+  unsigned size() const {
+    return deltas_.size();
+  }
+};
+
+#endif
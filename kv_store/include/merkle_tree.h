@@ -0,0 +1,92 @@
+#ifndef __MERKLE_TREE_H__
+#define __MERKLE_TREE_H__
+
+#include <stdint.h>
+#include <vector>
+#include "key_hash.h"
+
+using namespace std;
+
+// Define the depth of the Merkle trees replicas compare; the key hash space is
+// split into 2^MERKLE_TREE_DEPTH leaf ranges
+#define MERKLE_TREE_DEPTH 10
+
+// A Merkle tree over the key hash space. Every leaf covers a fixed range of key
+// hashes and holds the XOR of the digests of the key versions in it, so a write
+// folds into its leaf without touching the other keys. Inner nodes hash their
+// two children. Nodes are numbered from 1 in BFS order, so the children of node
+// i are 2i and 2i + 1 and the leaves are [2^depth, 2^(depth + 1)).
+class merkle_tree {
+  unsigned depth_;
+  vector<uint64_t> nodes_;
+
+  static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+  }
+
+public:
+  merkle_tree(unsigned depth = MERKLE_TREE_DEPTH) : depth_(depth), nodes_(2 << depth, 0) {
+    for (unsigned i = leaf_begin() - 1; i > 0; i--) {
+      nodes_[i] = combine(nodes_[2 * i], nodes_[2 * i + 1]);
+    }
+  }
+
+  static uint64_t key_digest(key_hash_t key_hash, unsigned long long timestamp) {
+    return mix(mix(timestamp) ^ key_hash);
+  }
+
+  static uint64_t combine(uint64_t left, uint64_t right) {
+    return mix(left * 0x9E3779B97F4A7C15ULL ^ right);
+  }
+
+  unsigned depth() const {
+    return depth_;
+  }
+
+  unsigned leaf_begin() const {
+    return 1u << depth_;
+  }
+
+  unsigned leaf_end() const {
+    return 2u << depth_;
+  }
+
+  bool is_leaf(unsigned node) const {
+    return node >= leaf_begin();
+  }
+
+  // the leaf node covering a key hash
+  unsigned leaf(key_hash_t key_hash) const {
+    return leaf_begin() + (unsigned) ((uint64_t) key_hash >> (32 - depth_));
+  }
+
+  uint64_t digest(unsigned node) const {
+    return nodes_[node];
+  }
+
+  uint64_t root() const {
+    return nodes_[1];
+  }
+
+  // add or remove a key version; XOR makes the two the same operation
+  void toggle(key_hash_t key_hash, unsigned long long timestamp) {
+    unsigned node = leaf(key_hash);
+    nodes_[node] ^= key_digest(key_hash, timestamp);
+    for (node >>= 1; node > 0; node >>= 1) {
+      nodes_[node] = combine(nodes_[2 * node], nodes_[2 * node + 1]);
+    }
+  }
+
+  // replace the version of a key
+  void update(key_hash_t key_hash, unsigned long long old_timestamp, unsigned long long new_timestamp) {
+    unsigned node = leaf(key_hash);
+    nodes_[node] ^= key_digest(key_hash, old_timestamp) ^ key_digest(key_hash, new_timestamp);
+    for (node >>= 1; node > 0; node >>= 1) {
+      nodes_[node] = combine(nodes_[2 * node], nodes_[2 * node + 1]);
+    }
+  }
+};
+
+#endif
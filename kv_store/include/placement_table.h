@@ -0,0 +1,340 @@
+#ifndef __PLACEMENT_TABLE_H__
+#define __PLACEMENT_TABLE_H__
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Define the number of shards of a placement table; a write copies the shards
+// of the keys it changes, so more shards make writes cheaper
+#define PLACEMENT_SHARD_NUM 4096
+
+// Define the range of tier ids
+#define MIN_TIER 1
+#define MAX_TIER 2
+
+// Define the default local replication factor
+#define DEFAULT_LOCAL_REPLICATION 1
+
+// represents the replication state for each key: a replication factor per
+// tier, and a local replication factor per node that was given one
+struct key_info {
+  key_info() : global_set_(0) {
+    for (unsigned i = 0; i <= MAX_TIER; i++) {
+      global_replication_[i] = 0;
+    }
+  }
+
+  // 0 for a tier that was never set
+  unsigned global_replication(unsigned tier_id) const {
+    return tier_id <= MAX_TIER ? global_replication_[tier_id] : 0;
+  }
+
+  bool has_global_replication(unsigned tier_id) const {
+    return tier_id <= MAX_TIER && (global_set_ & (1 << tier_id)) != 0;
+  }
+
+  void set_global_replication(unsigned tier_id, unsigned replication) {
+    if (tier_id <= MAX_TIER) {
+      global_replication_[tier_id] = replication;
+      global_set_ |= 1 << tier_id;
+    }
+  }
+
+  // DEFAULT_LOCAL_REPLICATION for a node that was never given one
+  unsigned local_replication(const string& ip) const {
+    for (auto it = local_replication_.begin(); it != local_replication_.end(); it++) {
+      if (it->first == ip) {
+        return it->second;
+      }
+    }
+    return DEFAULT_LOCAL_REPLICATION;
+  }
+
+  void set_local_replication(const string& ip, unsigned replication) {
+    for (auto it = local_replication_.begin(); it != local_replication_.end(); it++) {
+      if (it->first == ip) {
+        it->second = replication;
+        return;
+      }
+    }
+    local_replication_.push_back(make_pair(ip, replication));
+  }
+
+  // the nodes that were given a local replication factor
+  const vector<pair<string, unsigned>>& local_replications() const {
+    return local_replication_;
+  }
+
+  // take over the replication factors other sets
+  void merge(const key_info& other) {
+    for (unsigned i = 0; i <= MAX_TIER; i++) {
+      if (other.has_global_replication(i)) {
+        set_global_replication(i, other.global_replication_[i]);
+      }
+    }
+    for (auto it = other.local_replication_.begin(); it != other.local_replication_.end(); it++) {
+      set_local_replication(it->first, it->second);
+    }
+  }
+
+  // whether both place the key on the same nodes
+  bool same_placement(const key_info& other) const {
+    for (unsigned i = 0; i <= MAX_TIER; i++) {
+      if (global_replication_[i] != other.global_replication_[i]) {
+        return false;
+      }
+    }
+    for (auto it = local_replication_.begin(); it != local_replication_.end(); it++) {
+      if (it->second != other.local_replication(it->first)) {
+        return false;
+      }
+    }
+    for (auto it = other.local_replication_.begin(); it != other.local_replication_.end(); it++) {
+      if (it->second != local_replication(it->first)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+private:
+  unsigned global_replication_[MAX_TIER + 1];
+  // a bit per tier that was set
+  unsigned char global_set_;
+  vector<pair<string, unsigned>> local_replication_;
+};
+
+// The replication state of every key a thread knows about, stored as a
+// default placement and a table of the keys that differ from it. A key with
+// the default placement takes no memory. Without a default, a key missing
+// from the table is unknown.
+class placement_map {
+public:
+  typedef unordered_map<string, key_info>::const_iterator const_iterator;
+
+private:
+  unordered_map<string, key_info> exceptions_;
+  bool has_default_;
+  key_info default_;
+  key_info unknown_;
+
+public:
+  placement_map() : has_default_(false) {}
+
+  // every key not in the table gets info
+  void set_default(const key_info& info) {
+    has_default_ = true;
+    default_ = info;
+    for (auto it = exceptions_.begin(); it != exceptions_.end();) {
+      if (it->second.same_placement(default_)) {
+        it = exceptions_.erase(it);
+      } else {
+        it++;
+      }
+    }
+  }
+
+  // the key's replication state, or NULL if the key is unknown
+  const key_info* find(const string& key) const {
+    auto it = exceptions_.find(key);
+    if (it != exceptions_.end()) {
+      return &it->second;
+    }
+    return has_default_ ? &default_ : NULL;
+  }
+
+  // the key's replication state; an unknown key has no replica
+  const key_info& get(const string& key) const {
+    const key_info* info = find(key);
+    return info == NULL ? unknown_ : *info;
+  }
+
+  void set(const string& key, const key_info& info) {
+    if (has_default_ && info.same_placement(default_)) {
+      exceptions_.erase(key);
+    } else {
+      exceptions_[key] = info;
+    }
+  }
+
+  // apply the replication factors changes sets to the key
+  void merge(const string& key, const key_info& changes) {
+    key_info info = get(key);
+    info.merge(changes);
+    set(key, info);
+  }
+
+  // the keys that differ from the default
+  const_iterator begin() const {
+    return exceptions_.begin();
+  }
+
+  const_iterator end() const {
+    return exceptions_.end();
+  }
+
+  unsigned size() const {
+    return exceptions_.size();
+  }
+};
+
+// A key placement map shared by the worker threads of a process. Readers
+// never lock: the table is split into shards that are never changed in place.
+// A write copies the shards it touches, applies the changes and publishes the
+// copies with an atomic pointer swap. Each reader announces the epoch it
+// started reading in, and a replaced shard is freed once no reader that may
+// still see it is left. Writes are serialized, so they behave as if there were
+// a single writer. Like placement_map, only keys that differ from the default
+// are stored.
+class placement_table {
+public:
+  typedef unordered_map<string, key_info> shard_t;
+
+private:
+  // a reader's announced epoch, 0 if it is not reading; one cache line each
+  struct reader_slot {
+    reader_slot() : epoch_(0) {}
+    atomic<unsigned long long> epoch_;
+    char padding_[64 - sizeof(atomic<unsigned long long>)];
+  };
+
+  unsigned shard_number_;
+  unique_ptr<atomic<const shard_t*>[]> shards_;
+  unsigned reader_number_;
+  unique_ptr<reader_slot[]> readers_;
+  atomic<unsigned long long> epoch_;
+  bool has_default_;
+  key_info default_;
+
+  // held by writers
+  mutable mutex writer_mutex_;
+  // replaced shards and the epoch from which readers can no longer see them
+  vector<pair<unsigned long long, const shard_t*>> retired_;
+
+  unsigned shard(const string& key) const {
+    return hash<string>()(key) % shard_number_;
+  }
+
+  // free the replaced shards no reader can see any more
+  void reclaim() {
+    unsigned long long oldest = epoch_.load();
+    for (unsigned i = 0; i < reader_number_; i++) {
+      unsigned long long epoch = readers_[i].epoch_.load();
+      if (epoch != 0 && epoch < oldest) {
+        oldest = epoch;
+      }
+    }
+    unsigned kept = 0;
+    for (unsigned i = 0; i < retired_.size(); i++) {
+      if (retired_[i].first <= oldest) {
+        delete retired_[i].second;
+      } else {
+        retired_[kept++] = retired_[i];
+      }
+    }
+    retired_.resize(kept);
+  }
+
+public:
+  // reader_number is the number of threads that read the table
+  placement_table(unsigned reader_number, unsigned shard_number = PLACEMENT_SHARD_NUM) :
+    shard_number_(shard_number), shards_(new atomic<const shard_t*>[shard_number]),
+    reader_number_(reader_number), readers_(new reader_slot[reader_number]), epoch_(1), has_default_(false) {
+    for (unsigned i = 0; i < shard_number_; i++) {
+      shards_[i].store(new shard_t());
+    }
+  }
+
+  ~placement_table() {
+    for (unsigned i = 0; i < shard_number_; i++) {
+      delete shards_[i].load();
+    }
+    for (unsigned i = 0; i < retired_.size(); i++) {
+      delete retired_[i].second;
+    }
+  }
+
+  // every key not in the table gets info; only to be called before any other
+  // thread uses the table
+  void set_default(const key_info& info) {
+    has_default_ = true;
+    default_ = info;
+  }
+
+  // The key_info pointers find returns stay valid while a read_guard of the
+  // reading thread is alive. A thread holds at most one guard at a time.
+  class read_guard {
+    reader_slot& slot_;
+
+  public:
+    read_guard(placement_table& table, unsigned reader) : slot_(table.readers_[reader]) {
+      slot_.epoch_.store(table.epoch_.load());
+    }
+
+    ~read_guard() {
+      slot_.epoch_.store(0);
+    }
+  };
+
+  // the key's replication state, or NULL if the key is unknown; the caller
+  // must hold a read_guard
+  const key_info* find(const string& key) const {
+    const shard_t* map = shards_[shard(key)].load();
+    auto it = map->find(key);
+    if (it != map->end()) {
+      return &it->second;
+    }
+    return has_default_ ? &default_ : NULL;
+  }
+
+  // apply the replication factors in changes; the entries a change does not
+  // mention keep their value
+  void merge(const unordered_map<string, key_info>& changes) {
+    lock_guard<mutex> lock(writer_mutex_);
+    unordered_map<unsigned, shard_t*> copies;
+    for (auto it = changes.begin(); it != changes.end(); it++) {
+      unsigned index = shard(it->first);
+      auto copy_it = copies.find(index);
+      if (copy_it == copies.end()) {
+        copy_it = copies.insert(make_pair(index, new shard_t(*shards_[index].load()))).first;
+      }
+      shard_t& map = *copy_it->second;
+      auto key_it = map.find(it->first);
+      key_info info = key_it != map.end() ? key_it->second : (has_default_ ? default_ : key_info());
+      info.merge(it->second);
+      if (has_default_ && info.same_placement(default_)) {
+        map.erase(it->first);
+      } else {
+        map[it->first] = info;
+      }
+    }
+    if (copies.size() == 0) {
+      return;
+    }
+    for (auto it = copies.begin(); it != copies.end(); it++) {
+      retired_.push_back(make_pair(0, shards_[it->first].exchange(it->second)));
+    }
+    // readers that announce this epoch or a later one see the copies
+    unsigned long long epoch = epoch_.fetch_add(1) + 1;
+    for (auto it = retired_.rbegin(); it != retired_.rend() && it->first == 0; it++) {
+      it->first = epoch;
+    }
+    reclaim();
+  }
+
+  // the number of replaced shards not yet freed
+  unsigned retired() const {
+    lock_guard<mutex> lock(writer_mutex_);
+    return retired_.size();
+  }
+};
+
+#endif
@@ -0,0 +1,98 @@
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include "key_hash.h"
+
+using namespace::std;
+
+#ifndef __RENDEZVOUS_HASH_H__
+#define __RENDEZVOUS_HASH_H__
+
+
+// Highest random weight (rendezvous) hashing over a fixed number of buckets,
+// used to place keys on the worker threads of a node. Every bucket scores the
+// key and the key belongs to the buckets with the highest scores, so there is
+// no per-bucket state beyond the bucket count, and the buckets ranked by score
+// give an ordered top-k for replication.
+class rendezvous_hash
+{
+public:
+
+    rendezvous_hash() : size_(0) {
+
+    }
+
+    explicit rendezvous_hash(unsigned size) : size_(size) {
+
+    }
+
+public:
+    // the number of buckets
+    unsigned size() const {
+        return size_;
+    }
+
+    bool empty() const {
+        return size_ == 0;
+    }
+
+    // the highest scoring bucket; keys are hashed the way requests are routed
+    unsigned find(const string& key) const {
+        return find(get_key_hash(key));
+    }
+
+    unsigned find(uint64_t hash) const {
+        unsigned best = 0;
+        uint64_t best_score = 0;
+        for (unsigned bucket = 0; bucket < size_; bucket++) {
+            uint64_t s = score(hash, bucket);
+            if (bucket == 0 || s > best_score) {
+                best = bucket;
+                best_score = s;
+            }
+        }
+        return best;
+    }
+
+    // the count highest scoring buckets, highest first
+    vector<unsigned> find(const string& key, unsigned count) const {
+        return find(get_key_hash(key), count);
+    }
+
+    vector<unsigned> find(uint64_t hash, unsigned count) const {
+        count = min(count, size_);
+        if (count == 1) {
+            return vector<unsigned>(1, find(hash));
+        }
+
+        vector<pair<uint64_t, unsigned>> scores;
+        scores.reserve(size_);
+        for (unsigned bucket = 0; bucket < size_; bucket++) {
+            scores.push_back(make_pair(score(hash, bucket), bucket));
+        }
+        partial_sort(scores.begin(), scores.begin() + count, scores.end(), greater<pair<uint64_t, unsigned>>());
+
+        vector<unsigned> buckets;
+        for (unsigned i = 0; i < count; i++) {
+            buckets.push_back(scores[i].second);
+        }
+        return buckets;
+    }
+
+private:
+
+    // mix the key hash with the bucket id (splitmix64 finalizer)
+    static uint64_t score(uint64_t hash, unsigned bucket) {
+        uint64_t z = hash + (bucket + 1) * 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    unsigned size_;
+};
+
+
+#endif
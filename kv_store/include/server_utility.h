@@ -1,18 +1,62 @@
 #ifndef __SERVER_UTILITY_H__
 #define __SERVER_UTILITY_H__
 
+#include <algorithm>
+#include <chrono>
+#include <deque>
 #include <string>
+#include <unordered_set>
+#include <vector>
 #include "message.pb.h"
 #include "socket_cache.h"
 #include "zmq_util.h"
+#include "key_hash.h"
+#include "merkle_tree.h"
+#include "access_counter.h"
+#include "stats_frame.h"
+#include "latency_histogram.h"
+#include "transfer_receiver.h"
 
 using namespace std;
 
 // Define the garbage collect threshold
 #define GARBAGE_COLLECT_THRESHOLD 10000000
 
-// Define the gossip period (frequency)
-#define PERIOD 10000000
+// Define the longest a local write waits before it is gossiped (in microsecond)
+#define GOSSIP_MAX_STALENESS 1000000
+
+// Define the bytes and the number of keys written locally that trigger a gossip
+// flush before the staleness bound expires
+#define GOSSIP_BYTE_BUDGET 4194304
+#define GOSSIP_KEY_BUDGET 10000
+
+// Define the most keys and bytes gossiped in one event loop iteration; a larger
+// flush is spread over several iterations
+#define GOSSIP_CHUNK_KEYS 1000
+#define GOSSIP_CHUNK_BYTES 1048576
+
+// Define the anti-entropy period (in second)
+#define ANTI_ENTROPY_PERIOD 60
+
+// Define the most keys and bytes in one chunk of a rebalancing transfer
+#define TRANSFER_CHUNK_KEYS 1000
+#define TRANSFER_CHUNK_BYTES 1048576
+
+// Define the number of chunks a transfer may have unacknowledged at first
+#define TRANSFER_WINDOW 4
+
+// Define how long a transfer waits for an ack before it resends from the last
+// acknowledged chunk (in second)
+#define TRANSFER_TIMEOUT 5
+
+// Define the most bytes per second a thread streams to other threads while
+// rebalancing, and the burst it may send at once
+#define TRANSFER_BANDWIDTH_CAP 33554432
+#define TRANSFER_BURST 2097152
+
+// Define how long the migration scan may run in one event loop iteration (in
+// microsecond)
+#define MIGRATION_TIME_BUDGET 2000
 
 // Define the locatioon of the conf file with the ebs root path
 #define EBS_ROOT_FILE "conf/server/ebs_root.txt"
@@ -20,8 +64,9 @@ using namespace std;
 // TODO: reconsider type names here
 typedef KV_Store<string, RC_KVS_PairLattice<string>> Database;
 
-// a map that represents which keys should be sent to which IP-port combinations
-typedef unordered_map<string, unordered_set<string>> address_keyset_map;
+// a flat list of (key, IP-port combination) pairs saying which keys should be
+// sent where; send_gossip groups it by key
+typedef vector<pair<string, string>> key_address_list;
 
 class Serializer {
 public:
@@ -128,20 +173,240 @@ public:
 
 // used for key stat monitoring
 struct key_stat {
-  key_stat() : size_(0) {}
-  key_stat(unsigned size)
-    : size_(size) {}
+  key_stat() : size_(0), hash_(0), timestamp_(0) {}
+  key_stat(unsigned size, key_hash_t hash, unsigned long long timestamp)
+    : size_(size), hash_(hash), timestamp_(timestamp) {}
   unsigned size_;
+  // cached so that gossip and membership changes can route the key without
+  // rehashing it
+  key_hash_t hash_;
+  // the timestamp of the stored version, for anti-entropy
+  unsigned long long timestamp_;
+};
+
+// the Merkle trees of the keys this thread shares with each of its replica
+// peers, keyed by the peer's gossip address. A tree is built on the first
+// exchange with the peer, kept up to date on writes, and dropped when
+// placement changes
+typedef unordered_map<string, merkle_tree> replica_tree_map;
+
+// the keys written on this thread since they were last gossiped, with what is
+// needed to decide when to flush them
+class change_set {
+  unordered_set<string> keys_;
+  // bytes written, counting every write to a key
+  unsigned long long bytes_;
+  // when the oldest unflushed write was made
+  chrono::system_clock::time_point oldest_;
+
+public:
+  change_set() : bytes_(0) {}
+
+  unsigned size() const {
+    return keys_.size();
+  }
+
+  unsigned long long bytes() const {
+    return bytes_;
+  }
+
+  void insert(const string& key, unsigned long long bytes) {
+    if (keys_.empty()) {
+      oldest_ = chrono::system_clock::now();
+    }
+    keys_.insert(key);
+    bytes_ += bytes;
+  }
+
+  void erase(const string& key) {
+    keys_.erase(key);
+    if (keys_.empty()) {
+      bytes_ = 0;
+    }
+  }
+
+  // when the oldest write reaches the staleness bound
+  chrono::system_clock::time_point deadline() const {
+    if (keys_.empty()) {
+      return chrono::system_clock::time_point::max();
+    }
+    return oldest_ + chrono::microseconds(GOSSIP_MAX_STALENESS);
+  }
+
+  // whether the writes should be gossiped now
+  bool due(const chrono::system_clock::time_point& now) const {
+    return !keys_.empty() && (now >= deadline() || bytes_ >= GOSSIP_BYTE_BUDGET || keys_.size() >= GOSSIP_KEY_BUDGET);
+  }
+
+  // move the keys to the queue of keys to gossip
+  void drain(vector<string>& queue) {
+    queue.insert(queue.end(), keys_.begin(), keys_.end());
+    keys_.clear();
+    bytes_ = 0;
+  }
+};
+
+// a chunk of a transfer that has been sent but not acknowledged; it covers the
+// keys [begin_, end_) of the transfer
+struct transfer_chunk {
+  transfer_chunk(unsigned long long seq, unsigned begin, unsigned end)
+    : seq_(seq), begin_(begin), end_(end) {}
+  unsigned long long seq_;
+  unsigned begin_;
+  unsigned end_;
+};
+
+// the keys this thread is streaming to another thread while rebalancing. Only
+// the key names are queued; values are read when their chunk is sent, so a
+// transfer never holds more than TRANSFER_CHUNK_BYTES of values at a time. The
+// receiver acknowledges the chunks it got without a gap with more credit, and
+// keys the thread gives up are only dropped once every destination has
+// acknowledged them
+struct key_transfer {
+  key_transfer() : sent_(0), acked_(0), next_seq_(0), credit_(TRANSFER_WINDOW), bytes_sent_(0) {}
+  key_transfer(const server_thread_t& destination, const string& id)
+    : destination_(destination), id_(id), sent_(0), acked_(0), next_seq_(0), credit_(TRANSFER_WINDOW), bytes_sent_(0),
+      last_progress_(chrono::system_clock::now()) {}
+  server_thread_t destination_;
+  string id_;
+  // the keys to send, and whether this thread drops each once it is acknowledged
+  vector<pair<string, bool>> keys_;
+  // keys before sent_ have been sent and keys before acked_ acknowledged
+  unsigned sent_;
+  unsigned acked_;
+  unsigned long long next_seq_;
+  unsigned credit_;
+  deque<transfer_chunk> in_flight_;
+  // bytes sent since the last stat report
+  unsigned long long bytes_sent_;
+  chrono::system_clock::time_point last_progress_;
 };
 
+// transfers in progress, keyed by the destination's gossip address
+typedef unordered_map<string, key_transfer> transfer_map;
+
+// a token bucket capping the bytes per second sent by rebalancing transfers
+class transfer_rate_limiter {
+  double rate_;
+  double burst_;
+  double tokens_;
+  chrono::system_clock::time_point last_;
+
+  void refill(const chrono::system_clock::time_point& now) {
+    double elapsed = chrono::duration_cast<chrono::microseconds>(now - last_).count() / 1000000.0;
+    tokens_ = min(burst_, tokens_ + elapsed * rate_);
+    last_ = now;
+  }
+
+public:
+  transfer_rate_limiter(double rate = TRANSFER_BANDWIDTH_CAP, double burst = TRANSFER_BURST)
+    : rate_(rate), burst_(burst), tokens_(burst), last_(chrono::system_clock::now()) {}
+
+  // whether a chunk may be sent now; a chunk may overdraw the bucket, which
+  // then delays the next one
+  bool ready(const chrono::system_clock::time_point& now) {
+    refill(now);
+    return tokens_ > 0;
+  }
+
+  void consume(unsigned long long bytes) {
+    tokens_ -= bytes;
+  }
+
+  // when the bucket is refilled enough to send again
+  chrono::system_clock::time_point next_ready() const {
+    if (tokens_ > 0) {
+      return last_;
+    }
+    return last_ + chrono::microseconds((long long) (-tokens_ / rate_ * 1000000) + 1);
+  }
+};
+
+// a scan of key_stat_map that runs a few buckets per event loop iteration to
+// find the keys this thread no longer owns. A scan that sees the table rehash
+// starts over so that no key is missed
+struct migration_scan {
+  migration_scan() : active_(false), bucket_(0), bucket_count_(0) {}
+
+  // (re)start the scan from the first bucket; a scan that is still running
+  // keeps the tiers it was started for, so a later, narrower start does not
+  // drop them
+  void start(size_t bucket_count, const vector<unsigned>& tier_ids) {
+    if (!active_) {
+      tier_ids_.clear();
+    }
+    for (auto it = tier_ids.begin(); it != tier_ids.end(); it++) {
+      if (find(tier_ids_.begin(), tier_ids_.end(), *it) == tier_ids_.end()) {
+        tier_ids_.push_back(*it);
+      }
+    }
+    active_ = true;
+    bucket_ = 0;
+    bucket_count_ = bucket_count;
+  }
+
+  bool active_;
+  size_t bucket_;
+  size_t bucket_count_;
+  // the tiers whose replicas the keys go to
+  vector<unsigned> tier_ids_;
+};
+
+// summarize the key accesses of a thread for the monitoring node: the top
+// ACCESS_REPORT_TOP_K keys with their counts and up to
+// ACCESS_REPORT_COLD_NUMBER keys that are cold enough to demote. The report stays the same size however many keys the thread has,
+// and reports from different threads merge by adding the counts of each key.
+// Only keys the thread still stores are reported cold, and cold_cursor
+// rotates the sample so that successive reports cover all cold keys. Counters
+// of keys the thread does not store are dropped once they count nothing
+void summarize_access(unordered_map<string, access_counter>& key_access_map, const unordered_map<string, key_stat>& key_stat_map, size_t& cold_cursor, unsigned long long time, communication::Key_Access& access) {
+  vector<pair<unsigned, const string*>> counts;
+  vector<const string*> cold;
+  for (auto it = key_access_map.begin(); it != key_access_map.end();) {
+    unsigned count = it->second.count(time);
+    bool stored = key_stat_map.find(it->first) != key_stat_map.end();
+    if (count == 0 && !stored) {
+      it = key_access_map.erase(it);
+      continue;
+    }
+    if (count < DEMOTE_THRESHOLD) {
+      if (stored) {
+        cold.push_back(&it->first);
+      }
+    } else {
+      counts.push_back(make_pair(count, &it->first));
+    }
+    it++;
+  }
+  if (cold.size() > 0) {
+    size_t cold_number = min(cold.size(), (size_t) ACCESS_REPORT_COLD_NUMBER);
+    size_t start = cold_cursor % cold.size();
+    for (size_t i = 0; i < cold_number; i++) {
+      access.add_cold(*cold[(start + i) % cold.size()]);
+    }
+    cold_cursor = start + cold_number;
+  }
+  if (counts.size() > ACCESS_REPORT_TOP_K) {
+    nth_element(counts.begin(), counts.begin() + ACCESS_REPORT_TOP_K, counts.end(), greater<pair<unsigned, const string*>>());
+    counts.resize(ACCESS_REPORT_TOP_K);
+  }
+  for (auto it = counts.begin(); it != counts.end(); it++) {
+    communication::Key_Access_Tuple* tp = access.add_tuple();
+    tp->set_key(*it->second);
+    tp->set_access(it->first);
+  }
+}
+
 struct pending_request {
   pending_request() {}
-  pending_request(string type, const string& value, string addr, string respond_id)
-    : type_(type), value_(value), addr_(addr), respond_id_(respond_id) {}
+  pending_request(string type, const string& value, string addr, string respond_id, const chrono::system_clock::time_point& arrival)
+    : type_(type), value_(value), addr_(addr), respond_id_(respond_id), arrival_(arrival) {}
   string type_;
   string value_;
   string addr_;
   string respond_id_;
+  // when the request reached the thread, for its latency once answered
+  chrono::system_clock::time_point arrival_;
 };
 
 struct pending_gossip {
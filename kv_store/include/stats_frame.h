@@ -0,0 +1,111 @@
+#ifndef __STATS_FRAME_H__
+#define __STATS_FRAME_H__
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+#include "message.pb.h"
+
+using namespace std;
+
+// Define how often a server sends a full stats frame instead of the changes
+// since its previous frame; a monitoring node that missed a frame catches up
+// at the next full one
+#define STATS_FULL_FRAME_INTERVAL 8
+
+// Builds the stats frames a server thread pushes to the monitoring node. The
+// key access part of a frame only carries the keys whose reported count
+// changed and the keys that dropped out of the report.
+class stats_encoder {
+  // the key access counts as of the previous frame; cold keys count 0
+  unordered_map<string, unsigned> reported_;
+  unsigned long long seq_;
+
+public:
+  stats_encoder() : seq_(0) {}
+
+  void encode(const communication::Server_Stat& stat, const communication::Key_Access& access, communication::Stats_Frame& frame) {
+    unordered_map<string, unsigned> current;
+    for (int i = 0; i < access.tuple_size(); i++) {
+      current[access.tuple(i).key()] = access.tuple(i).access();
+    }
+    for (int i = 0; i < access.cold_size(); i++) {
+      current[access.cold(i)] = 0;
+    }
+
+    bool full = seq_ % STATS_FULL_FRAME_INTERVAL == 0;
+    frame.set_seq(seq_);
+    frame.set_full(full);
+    *frame.mutable_stat() = stat;
+    communication::Key_Access* delta = frame.mutable_access();
+    for (auto it = current.begin(); it != current.end(); it++) {
+      auto previous = reported_.find(it->first);
+      if (full || previous == reported_.end() || previous->second != it->second) {
+        communication::Key_Access_Tuple* tp = delta->add_tuple();
+        tp->set_key(it->first);
+        tp->set_access(it->second);
+      }
+    }
+    if (!full) {
+      for (auto it = reported_.begin(); it != reported_.end(); it++) {
+        if (current.find(it->first) == current.end()) {
+          frame.add_removed(it->first);
+        }
+      }
+    }
+    reported_.swap(current);
+    seq_ += 1;
+  }
+};
+
+// The monitoring node's view of one server thread, rebuilt from its frames.
+// A view that missed a frame ignores deltas until the next full frame.
+class stats_view {
+  unsigned long long seq_;
+  bool synced_;
+  communication::Server_Stat stat_;
+  unordered_map<string, unsigned> access_;
+  chrono::system_clock::time_point updated_;
+
+public:
+  stats_view() : seq_(0), synced_(false) {}
+
+  bool synced() const {
+    return synced_;
+  }
+
+  const communication::Server_Stat& stat() const {
+    return stat_;
+  }
+
+  const unordered_map<string, unsigned>& access() const {
+    return access_;
+  }
+
+  chrono::system_clock::time_point updated() const {
+    return updated_;
+  }
+
+  void apply(const communication::Stats_Frame& frame) {
+    // the occupancy and storage are always sent whole
+    stat_ = frame.stat();
+    updated_ = chrono::system_clock::now();
+    if (frame.full()) {
+      access_.clear();
+      synced_ = true;
+    } else if (!synced_ || frame.seq() != seq_ + 1) {
+      synced_ = false;
+      seq_ = frame.seq();
+      return;
+    }
+    seq_ = frame.seq();
+    for (int i = 0; i < frame.access().tuple_size(); i++) {
+      access_[frame.access().tuple(i).key()] = frame.access().tuple(i).access();
+    }
+    for (int i = 0; i < frame.removed_size(); i++) {
+      access_.erase(frame.removed(i));
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef __THREAD_AFFINITY_H__
+#define __THREAD_AFFINITY_H__
+
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Define the environment variable that selects how worker threads are pinned:
+// "none" (the default), "compact" (fill one NUMA node before the next),
+// "scatter" (round robin across NUMA nodes), or an explicit comma separated
+// list of cores indexed by thread id
+#define CORE_PINNING_ENV "CORE_PINNING"
+
+// Define the sysfs directory that describes the NUMA topology
+#define NUMA_NODE_ROOT "/sys/devices/system/node/"
+
+struct numa_node {
+  numa_node() : id_(0) {}
+  numa_node(unsigned id, vector<unsigned> cores) : id_(id), cores_(cores) {}
+  unsigned id_;
+  vector<unsigned> cores_;
+};
+
+// the core (and its NUMA node) that a worker thread runs on
+struct core_assignment {
+  core_assignment() : pinned_(false), core_(0), node_(0) {}
+  bool pinned_;
+  unsigned core_;
+  unsigned node_;
+  vector<unsigned> node_cores_;
+};
+
+// parse a kernel cpu list such as "0-3,8-11"
+vector<unsigned> parse_cpu_list(const string& s) {
+  vector<unsigned> cores;
+  stringstream ss(s);
+  string range;
+  while (getline(ss, range, ',')) {
+    if (range.empty()) {
+      continue;
+    }
+    size_t dash = range.find('-');
+    unsigned first = stoul(range.substr(0, dash));
+    unsigned last = (dash == string::npos) ? first : stoul(range.substr(dash + 1));
+    for (unsigned core = first; core <= last; core++) {
+      cores.push_back(core);
+    }
+  }
+  return cores;
+}
+
+// return the cores this process may run on, grouped by NUMA node; a machine
+// without NUMA information is treated as a single node
+vector<numa_node> get_numa_layout() {
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+
+  vector<numa_node> layout;
+  DIR* dir = opendir(NUMA_NODE_ROOT);
+  if (dir != NULL) {
+    struct dirent* entry;
+    while ((entry = readdir(dir)) != NULL) {
+      unsigned id;
+      string name = entry->d_name;
+      if (name.compare(0, 4, "node") != 0 || sscanf(name.c_str(), "node%u", &id) != 1) {
+        continue;
+      }
+      ifstream input(NUMA_NODE_ROOT + name + "/cpulist");
+      string line;
+      getline(input, line);
+      vector<unsigned> cores;
+      auto listed = parse_cpu_list(line);
+      for (auto it = listed.begin(); it != listed.end(); it++) {
+        if (CPU_ISSET(*it, &allowed)) {
+          cores.push_back(*it);
+        }
+      }
+      // memory-only nodes have no cores to run on
+      if (cores.size() > 0) {
+        layout.push_back(numa_node(id, cores));
+      }
+    }
+    closedir(dir);
+  }
+
+  if (layout.size() == 0) {
+    vector<unsigned> cores;
+    for (unsigned core = 0; core < CPU_SETSIZE; core++) {
+      if (CPU_ISSET(core, &allowed)) {
+        cores.push_back(core);
+      }
+    }
+    layout.push_back(numa_node(0, cores));
+  }
+
+  sort(layout.begin(), layout.end(), [](const numa_node& l, const numa_node& r) {
+    return l.id_ < r.id_;
+  });
+  return layout;
+}
+
+// pick the core for a worker thread according to the CORE_PINNING policy
+core_assignment assign_core(unsigned thread_id) {
+  core_assignment assignment;
+  const char* policy = getenv(CORE_PINNING_ENV);
+  if (policy == NULL || string(policy) == "" || string(policy) == "none") {
+    return assignment;
+  }
+
+  auto layout = get_numa_layout();
+  vector<unsigned> flat;
+  for (auto it = layout.begin(); it != layout.end(); it++) {
+    flat.insert(flat.end(), it->cores_.begin(), it->cores_.end());
+  }
+  if (flat.size() == 0) {
+    return assignment;
+  }
+
+  string mode = policy;
+  if (mode == "compact") {
+    assignment.core_ = flat[thread_id % flat.size()];
+  } else if (mode == "scatter") {
+    auto node = &layout[thread_id % layout.size()];
+    assignment.core_ = node->cores_[(thread_id / layout.size()) % node->cores_.size()];
+  } else {
+    auto cores = parse_cpu_list(mode);
+    if (cores.size() == 0) {
+      return assignment;
+    }
+    assignment.core_ = cores[thread_id % cores.size()];
+  }
+
+  for (auto it = layout.begin(); it != layout.end(); it++) {
+    if (find(it->cores_.begin(), it->cores_.end(), assignment.core_) != it->cores_.end()) {
+      assignment.pinned_ = true;
+      assignment.node_ = it->id_;
+      assignment.node_cores_ = it->cores_;
+    }
+  }
+  return assignment;
+}
+
+bool set_thread_affinity(const vector<unsigned>& cores) {
+  cpu_set_t mask;
+  CPU_ZERO(&mask);
+  for (auto it = cores.begin(); it != cores.end(); it++) {
+    CPU_SET(*it, &mask);
+  }
+  return pthread_setaffinity_np(pthread_self(), sizeof(mask), &mask) == 0;
+}
+
+// bind the calling thread to every core of its assigned NUMA node; threads
+// spawned afterwards inherit this mask and therefore stay on the same socket.
+// zmq starts the I/O threads of a context when its first socket is created,
+// so that socket has to be created while the thread is still node bound
+bool bind_to_node(const core_assignment& assignment) {
+  if (!assignment.pinned_) {
+    return false;
+  }
+  return set_thread_affinity(assignment.node_cores_);
+}
+
+// bind the calling thread to its assigned core; memory it touches from now on
+// (its store, buffers and malloc arena) is allocated on the local NUMA node
+bool bind_to_core(const core_assignment& assignment) {
+  if (!assignment.pinned_) {
+    return false;
+  }
+  return set_thread_affinity(vector<unsigned>(1, assignment.core_));
+}
+
+string describe_assignment(unsigned thread_id, const core_assignment& assignment) {
+  if (!assignment.pinned_) {
+    return "thread " + to_string(thread_id) + " is not pinned";
+  }
+  string node_cores;
+  for (auto it = assignment.node_cores_.begin(); it != assignment.node_cores_.end(); it++) {
+    node_cores += (it == assignment.node_cores_.begin() ? "" : ",") + to_string(*it);
+  }
+  return "thread " + to_string(thread_id) + " is pinned to core " + to_string(assignment.core_) +
+    " on NUMA node " + to_string(assignment.node_) + " (node cores " + node_cores + ")";
+}
+
+#endif
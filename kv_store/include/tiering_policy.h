@@ -0,0 +1,434 @@
+#ifndef __TIERING_POLICY_H__
+#define __TIERING_POLICY_H__
+
+#include <algorithm>
+#include <cmath>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "access_aggregator.h"
+#include "access_forecast.h"
+#include "common.h"
+#include "latency_histogram.h"
+
+#include "spdlog/spdlog.h"
+
+using namespace std;
+
+// Define whether the monitoring node runs the tiering policy; it is off by
+// default since the monitoring loop never ran these passes before, but they
+// are always compiled and kvs_policy_simulator runs them unconditionally
+#define ENABLE_TIERING_POLICY false
+
+// Define the number of nodes to add concurrently
+#define NODE_ADD 2
+
+// Define whether promotion and demotion follow each key's access forecast
+// instead of its current access count
+#define ENABLE_PREDICTIVE_TIERING false
+// Define the number of accesses a key is predicted to gain over the promotion
+// threshold before it is worth copying to the memory tier
+#define MIGRATION_COST 2
+// Define the number of epochs a key stays in a tier after it is moved
+#define MIN_TIER_RESIDENCE 10
+
+// The tiering policy decides, once per monitoring epoch, which keys move
+// between the memory and ebs tiers, which keys get more or fewer replicas and
+// when nodes are added or removed. It only sees a summary of the cluster and
+// acts through a policy_executor, so the monitoring node and the offline
+// simulator run the same decisions.
+
+// the cluster as of one monitoring epoch
+struct policy_input {
+  policy_input() :
+    memory_node_number_(0), ebs_node_number_(0),
+    memory_node_capacity_(0), ebs_node_capacity_(0),
+    total_memory_consumption_(0), total_ebs_consumption_(0),
+    average_ebs_consumption_percentage_(0), min_memory_occupancy_(1.0),
+    avg_latency_(0), grace_elapsed_(0) {}
+  unsigned memory_node_number_;
+  unsigned ebs_node_number_;
+  unsigned long long memory_node_capacity_;
+  unsigned long long ebs_node_capacity_;
+  unsigned long long total_memory_consumption_;
+  unsigned long long total_ebs_consumption_;
+  double average_ebs_consumption_percentage_;
+  // the least occupied memory node
+  double min_memory_occupancy_;
+  string min_memory_node_;
+  // the average latency clients report
+  double avg_latency_;
+  // the request latency servers measured in each tier (in microsecond)
+  latency_histogram memory_latency_;
+  latency_histogram ebs_latency_;
+  // the time since the last node was added or removed (in second)
+  long long grace_elapsed_;
+};
+
+// what the policy keeps across epochs: the node additions and removals in
+// progress and, in predictive mode, the access forecast
+struct policy_state {
+  policy_state() :
+    adding_memory_node_(0), adding_ebs_node_(0), removing_memory_node_(false), removing_ebs_node_(false),
+    predictive_(ENABLE_PREDICTIVE_TIERING), epoch_(0) {}
+  unsigned adding_memory_node_;
+  unsigned adding_ebs_node_;
+  bool removing_memory_node_;
+  bool removing_ebs_node_;
+  bool predictive_;
+  long long epoch_;
+  access_forecast forecast_;
+};
+
+// carries out the policy's decisions
+class policy_executor {
+public:
+  virtual ~policy_executor() {}
+  // change the replication of the requested keys and update placement; keys
+  // whose change fails keep their old placement
+  virtual void change_replication_factor(unordered_map<string, key_info>& requests) = 0;
+  virtual void add_node(unsigned tier_id, unsigned number) = 0;
+  // remove a node of the tier; ip is empty if any node may go
+  virtual void remove_node(unsigned tier_id, const string& ip) = 0;
+};
+
+// fold the access counts that changed since the last epoch into the forecast.
+// A key no thread reports any more, because it left a thread's top keys or
+// cold sample, is taken to have no accesses: its forecast fades out and it
+// keeps its last move, so a key that comes back is not moved again early
+void update_forecast(policy_state& state, access_aggregator& key_access) {
+  unordered_set<string> changed;
+  key_access.drain_changed(changed);
+  for (auto it = changed.begin(); it != changed.end(); it++) {
+    state.forecast_.observe(*it, key_access.total(*it), state.epoch_);
+  }
+  if (state.epoch_ % FORECAST_SETTLE_EPOCHS == 0) {
+    state.forecast_.expire(state.epoch_);
+  }
+}
+
+// in predictive mode a key is promoted when its predicted accesses pay for the
+// copy, and is not moved again until it has stayed MIN_TIER_RESIDENCE epochs
+bool should_promote(const string& key, const policy_state& state) {
+  if (!state.predictive_) {
+    return true;
+  }
+  long long since_moved = state.forecast_.since_moved(key, state.epoch_);
+  if (since_moved >= 0 && since_moved < MIN_TIER_RESIDENCE) {
+    return false;
+  }
+  return state.forecast_.predict(key, state.epoch_) > PROMOTE_THRESHOLD + MIGRATION_COST;
+}
+
+// in predictive mode a key is demoted when it is predicted to stay cold; the
+// forecast lags a sudden drop, which keeps bursty keys in memory
+bool should_demote(const string& key, const policy_state& state) {
+  if (!state.predictive_) {
+    return true;
+  }
+  long long since_moved = state.forecast_.since_moved(key, state.epoch_);
+  if (since_moved >= 0 && since_moved < MIN_TIER_RESIDENCE) {
+    return false;
+  }
+  return state.forecast_.predict(key, state.epoch_) < DEMOTE_THRESHOLD;
+}
+
+// remember which requested keys moved between tiers
+void record_moves(unordered_map<string, key_info>& requests, placement_map& placement, policy_state& state) {
+  for (auto it = requests.begin(); it != requests.end(); it++) {
+    if (placement.get(it->first).global_replication(1) == it->second.global_replication(1)) {
+      state.forecast_.set_moved(it->first, state.epoch_);
+    }
+  }
+}
+
+// lower the memory replication of the keys that are replicated on every memory
+// node, so that one can be removed
+void prepare_memory_node_removal(
+    const policy_input& input,
+    placement_map& placement,
+    access_aggregator& key_access,
+    policy_executor& executor,
+    shared_ptr<spdlog::logger> logger) {
+  unordered_map<string, key_info> requests;
+  const access_aggregator::index_t& keys = key_access.keys(input.memory_node_number_);
+  for (auto it = keys.begin(); it != keys.end(); it++) {
+    string key = it->second;
+    key_info new_rep_factor;
+    new_rep_factor.set_global_replication(1, placement.get(key).global_replication(1) - 1);
+    if (new_rep_factor.global_replication(1) + placement.get(key).global_replication(2) < MINIMUM_REPLICA_NUMBER) {
+      new_rep_factor.set_global_replication(2, MINIMUM_REPLICA_NUMBER - new_rep_factor.global_replication(1));
+      if (new_rep_factor.global_replication(2) > input.ebs_node_number_) {
+        logger->info("Error: number of ebs replica exceed number of ebs nodes");
+      }
+    } else {
+      new_rep_factor.set_global_replication(2, placement.get(key).global_replication(2));
+    }
+    requests[key] = new_rep_factor;
+    logger->info("reduce replication for key {}. M: {}->{}. E: {}->{}", key, placement.get(key).global_replication(1), new_rep_factor.global_replication(1), placement.get(key).global_replication(2), new_rep_factor.global_replication(2));
+  }
+  executor.change_replication_factor(requests);
+}
+
+void run_tiering_policy(
+    const policy_input& input,
+    policy_state& state,
+    placement_map& placement,
+    access_aggregator& key_access,
+    policy_executor& executor,
+    shared_ptr<spdlog::logger> logger) {
+  unsigned memory_node_number = input.memory_node_number_;
+  unsigned ebs_node_number = input.ebs_node_number_;
+  unsigned long long total_memory_consumption = input.total_memory_consumption_;
+  unsigned long long total_ebs_consumption = input.total_ebs_consumption_;
+  bool in_grace_period = input.grace_elapsed_ <= GRACE_PERIOD;
+
+  state.epoch_ += 1;
+  if (state.predictive_) {
+    update_forecast(state, key_access);
+  }
+
+  unsigned required_memory_node = ceil(total_memory_consumption / (MEM_CAPACITY_MAX * input.memory_node_capacity_));
+  unsigned required_ebs_node = ceil(total_ebs_consumption / (EBS_CAPACITY_MAX * input.ebs_node_capacity_));
+  logger->info("required memory node is {}", required_memory_node);
+  logger->info("required ebs node is {}", required_ebs_node);
+
+  // 1. first check storage consumption and trigger elasticity if necessary
+  if (memory_node_number != 0 && state.adding_memory_node_ == 0 && required_memory_node > memory_node_number) {
+    logger->info("memory consumption exceeds threshold!");
+    if (!in_grace_period) {
+      logger->info("trigger add {} memory node", to_string(NODE_ADD));
+      executor.add_node(1, NODE_ADD);
+      state.adding_memory_node_ = NODE_ADD;
+    } else {
+      logger->info("in grace period, not adding memory nodes");
+    }
+  }
+
+  if (ebs_node_number != 0 && state.adding_ebs_node_ == 0 && required_ebs_node > ebs_node_number) {
+    logger->info("ebs consumption exceeds threshold!");
+    if (!in_grace_period) {
+      logger->info("trigger add {} ebs node", to_string(NODE_ADD));
+      executor.add_node(2, NODE_ADD);
+      state.adding_ebs_node_ = NODE_ADD;
+    } else {
+      logger->info("in grace period, not adding ebs nodes");
+    }
+  }
+
+  if (ebs_node_number != 0 && input.average_ebs_consumption_percentage_ < EBS_CAPACITY_MIN && !state.removing_ebs_node_ && ebs_node_number > max(required_ebs_node, (unsigned)MINIMUM_EBS_NODE)) {
+    logger->info("removing ebs node to save cost");
+    if (!in_grace_period) {
+      logger->info("sending remove ebs node msg");
+      executor.remove_node(2, "");
+      state.removing_ebs_node_ = true;
+    } else {
+      logger->info("in grace period, not removing node");
+    }
+  }
+
+  unordered_map<string, key_info> requests;
+  unsigned total_rep_to_change = 0;
+  // 2. check key access summary to promote hot keys to memory tier; only keys
+  // with no memory replica are candidates, hottest first
+  unsigned slot = (MEM_CAPACITY_MAX * input.memory_node_capacity_ * memory_node_number - total_memory_consumption) / VALUE_SIZE;
+  bool overflow = false;
+  const access_aggregator::index_t& ebs_keys = key_access.keys(0);
+  for (auto it = ebs_keys.rbegin(); it != ebs_keys.rend() && it->first > PROMOTE_THRESHOLD; it++) {
+    string key = it->second;
+    if (!should_promote(key, state)) {
+      continue;
+    }
+    total_rep_to_change += 1;
+    if (total_rep_to_change > slot) {
+      overflow = true;
+    } else {
+      key_info new_rep_factor;
+      new_rep_factor.set_global_replication(1, placement.get(key).global_replication(1) + 1);
+      new_rep_factor.set_global_replication(2, placement.get(key).global_replication(2) - 1);
+      requests[key] = new_rep_factor;
+    }
+  }
+  executor.change_replication_factor(requests);
+  record_moves(requests, placement, state);
+  logger->info("number of keys to be promoted is {}", total_rep_to_change);
+  logger->info("available memory slot is {}", slot);
+  if (overflow && state.adding_memory_node_ == 0 && !in_grace_period) {
+    unsigned long long promote_data_size = total_rep_to_change * VALUE_SIZE;
+    unsigned total_memory_node_needed = ceil((total_memory_consumption + promote_data_size) / (MEM_CAPACITY_MAX * input.memory_node_capacity_));
+    if (total_memory_node_needed > memory_node_number) {
+      logger->info("memory node insufficient to promote keys!");
+      unsigned node_to_add = ceil(1.5 * (total_memory_node_needed - memory_node_number));
+      logger->info("trigger add {} memory node", to_string(node_to_add));
+      executor.add_node(1, node_to_add);
+      state.adding_memory_node_ = node_to_add;
+    }
+  } else if (overflow) {
+    logger->info("in grace period or adding nodes");
+  }
+
+  requests.clear();
+  total_rep_to_change = 0;
+
+  // 3. check key access summary to demote cold keys to ebs tier; only keys
+  // with a memory replica are candidates, coldest first
+  if (!in_grace_period) {
+    unsigned slot = (EBS_CAPACITY_MAX * input.ebs_node_capacity_ * ebs_node_number - total_ebs_consumption) / VALUE_SIZE;
+    bool overflow = false;
+    auto replications = key_access.memory_replications();
+    for (auto rep_iter = replications.upper_bound(0); rep_iter != replications.end(); rep_iter++) {
+      const access_aggregator::index_t& keys = key_access.keys(*rep_iter);
+      for (auto it = keys.begin(); it != access_aggregator::below_end(keys, DEMOTE_THRESHOLD); it++) {
+        string key = it->second;
+        if (!should_demote(key, state)) {
+          continue;
+        }
+        total_rep_to_change += 1;
+        if (total_rep_to_change > slot) {
+          overflow = true;
+        } else {
+          key_info new_rep_factor;
+          new_rep_factor.set_global_replication(1, 0);
+          new_rep_factor.set_global_replication(2, MINIMUM_REPLICA_NUMBER);
+          requests[key] = new_rep_factor;
+        }
+      }
+    }
+    executor.change_replication_factor(requests);
+    record_moves(requests, placement, state);
+    logger->info("number of keys to be demoted is {}", total_rep_to_change);
+    logger->info("available ebs slot is {}", slot);
+    if (overflow && state.adding_ebs_node_ == 0) {
+      unsigned long long demote_data_size = total_rep_to_change * VALUE_SIZE;
+      unsigned total_ebs_node_needed = ceil((total_ebs_consumption + demote_data_size) / (EBS_CAPACITY_MAX * input.ebs_node_capacity_));
+      if (total_ebs_node_needed > ebs_node_number) {
+        logger->info("ebs node insufficient to demote keys!");
+        unsigned node_to_add = ceil(1.5 * (total_ebs_node_needed - ebs_node_number));
+        logger->info("trigger add {} ebs node", to_string(node_to_add));
+        executor.add_node(2, node_to_add);
+        state.adding_ebs_node_ = node_to_add;
+      }
+    } else if (overflow) {
+      logger->info("already adding ebs nodes");
+    }
+  } else {
+    logger->info("in grace period, not demoting keys");
+  }
+
+  requests.clear();
+  total_rep_to_change = 0;
+
+  // 4. check latency to see if the SLO has been violated; the SLO is defined on
+  // the p99 the memory tier measures, and the clients' average is only used
+  // while no memory node has reported latencies
+  double latency = input.avg_latency_;
+  if (input.memory_latency_.count() > 0) {
+    latency = input.memory_latency_.percentile(0.99);
+  }
+  logger->info("latency checked against the SLO is {}", latency);
+  // 4.1 if latency is too high
+  if (latency > SLO_WORST && state.adding_memory_node_ == 0) {
+    logger->info("latency is too high!");
+    // figure out if we should do hot key replication or add nodes
+    if (input.min_memory_occupancy_ > 0.08) {
+      // add nodes
+      logger->info("all nodes are busy, adding new nodes");
+      // trigger elasticity
+      if (!in_grace_period) {
+        logger->info("trigger add {} memory node", to_string(NODE_ADD));
+        executor.add_node(1, NODE_ADD);
+        state.adding_memory_node_ = NODE_ADD;
+      } else {
+        logger->info("in grace period, not adding nodes");
+      }
+    } else {
+      // hot key replication
+      // find hot keys
+      logger->info("not all nodes are busy, finding hot keys...");
+      auto replications = key_access.memory_replications();
+      for (auto rep_iter = replications.begin(); rep_iter != replications.end(); rep_iter++) {
+        const access_aggregator::index_t& keys = key_access.keys(*rep_iter);
+        for (auto it = access_aggregator::above(keys, HOT_KEY_THRESHOLD); it != keys.end(); it++) {
+          string key = it->second;
+          unsigned total_access = it->first;
+          logger->info("key {} accessed more than {} times. Accessed {} times", key, HOT_KEY_THRESHOLD, total_access);
+          if (memory_node_number - placement.get(key).global_replication(1) > 0 && placement.get(key).global_replication(2) > 0) {
+            key_info new_rep_factor;
+            new_rep_factor.set_global_replication(1, placement.get(key).global_replication(1) + 1);
+            new_rep_factor.set_global_replication(2, placement.get(key).global_replication(2) - 1);
+            requests[key] = new_rep_factor;
+            logger->info("global hot key replication for key {}. M: {}->{}. E: {}->{}", key, placement.get(key).global_replication(1), placement.get(key).global_replication(1) + 1, placement.get(key).global_replication(2), placement.get(key).global_replication(2) - 1);
+          } else if (memory_node_number - placement.get(key).global_replication(1) > 0 && placement.get(key).global_replication(2) == 0) {
+            key_info new_rep_factor;
+            new_rep_factor.set_global_replication(1, placement.get(key).global_replication(1) + 1);
+            new_rep_factor.set_global_replication(2, placement.get(key).global_replication(2));
+            requests[key] = new_rep_factor;
+            logger->info("global hot key replication for key {}. M: {}->{}. E: {}->{}", key, placement.get(key).global_replication(1), placement.get(key).global_replication(1) + 1, placement.get(key).global_replication(2), placement.get(key).global_replication(2));
+          } else {
+            logger->info("cannot perform hot key replication to key {} due to node limit", key);
+          }
+        }
+      }
+      executor.change_replication_factor(requests);
+    }
+  }
+  requests.clear();
+  logger->info("adding {} memory nodes in progress", state.adding_memory_node_);
+  logger->info("adding {} ebs nodes in progress", state.adding_ebs_node_);
+
+  // 4.2 if latency is too low, consider removing a memory node
+  if (latency < SLO_BEST && !state.removing_memory_node_ && memory_node_number > max(required_memory_node, (unsigned)MINIMUM_MEMORY_NODE)) {
+    logger->info("latency is too low!");
+    if (!in_grace_period) {
+      // before sending remove command, first adjust relevant key's replication factor
+      prepare_memory_node_removal(input, placement, key_access, executor, logger);
+      logger->info("sending remove memory node msg");
+      executor.remove_node(1, "");
+      state.removing_memory_node_ = true;
+    } else {
+      logger->info("in grace period, not removing node");
+    }
+  }
+
+  // 4.3 if latency is fine, check if there is underutilized memory node
+  if (latency >= SLO_BEST && latency <= SLO_WORST && !state.removing_memory_node_ && memory_node_number > max(required_memory_node, (unsigned)MINIMUM_MEMORY_NODE)) {
+    if (input.min_memory_occupancy_ < 0.02) {
+      logger->info("node {} is severely underutilized, consider removing", input.min_memory_node_);
+      if (!in_grace_period) {
+        // before sending remove command, first adjust relevant key's replication factor
+        prepare_memory_node_removal(input, placement, key_access, executor, logger);
+        logger->info("sending remove memory node msg");
+        executor.remove_node(1, input.min_memory_node_);
+        state.removing_memory_node_ = true;
+      } else {
+        logger->info("in grace period");
+      }
+    }
+  }
+
+  // finally, consider reducing the replication factor of some keys that are not so hot anymore
+  auto replications = key_access.memory_replications();
+  for (auto rep_iter = replications.upper_bound(1); rep_iter != replications.end(); rep_iter++) {
+    const access_aggregator::index_t& keys = key_access.keys(*rep_iter);
+    for (auto it = keys.begin(); it != access_aggregator::above(keys, HOT_KEY_THRESHOLD); it++) {
+      string key = it->second;
+      unsigned total_access = it->first;
+      logger->info("key {} accessed less than {} times. Accessed {} times", key, HOT_KEY_THRESHOLD, total_access);
+      key_info new_rep_factor;
+      new_rep_factor.set_global_replication(1, placement.get(key).global_replication(1) - 1);
+      if (new_rep_factor.global_replication(1) + placement.get(key).global_replication(2) < MINIMUM_REPLICA_NUMBER) {
+        new_rep_factor.set_global_replication(2, MINIMUM_REPLICA_NUMBER - new_rep_factor.global_replication(1));
+        if (new_rep_factor.global_replication(2) > ebs_node_number) {
+          logger->info("Error: number of ebs replica exceed number of ebs nodes");
+        }
+      } else {
+        new_rep_factor.set_global_replication(2, placement.get(key).global_replication(2));
+      }
+      requests[key] = new_rep_factor;
+      logger->info("reducing replication factor for key {}. M: {}->{}. E: {}->{}", key, placement.get(key).global_replication(1), placement.get(key).global_replication(1) - 1, placement.get(key).global_replication(2), placement.get(key).global_replication(2) + 1);
+    }
+  }
+  executor.change_replication_factor(requests);
+}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef __TRANSFER_RECEIVER_H__
+#define __TRANSFER_RECEIVER_H__
+
+#include <chrono>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+// Define how long a receiver remembers a transfer it got no chunk of (in
+// second)
+#define TRANSFER_RECEIVER_EXPIRY 60
+
+// The receiving side of rebalancing transfers. Acks are cumulative, so a
+// receiver may only acknowledge the keys that arrived without a gap: if a
+// chunk is lost and the next one arrives, acknowledging the later chunk would
+// let the sender drop the keys of the lost one. A chunk covers the keys
+// [begin, end) of its transfer and carries how far the sender already knows
+// the receiver got, so forgetting a transfer only delays its acks.
+class transfer_receiver {
+  struct progress {
+    // the keys before received_ arrived without a gap
+    unsigned received_;
+    chrono::steady_clock::time_point last_chunk_;
+  };
+
+  unordered_map<string, progress> transfers_;
+
+public:
+  // record a chunk; returns whether it extends or repeats the keys received
+  // without a gap, in which case received is set to their number and the
+  // chunk should be acknowledged
+  bool receive(const string& id, unsigned acked, unsigned begin, unsigned end, unsigned& received,
+      chrono::steady_clock::time_point now = chrono::steady_clock::now()) {
+    auto it = transfers_.find(id);
+    if (it == transfers_.end()) {
+      it = transfers_.insert(make_pair(id, progress{0, now})).first;
+    }
+    progress& p = it->second;
+    p.last_chunk_ = now;
+    if (acked > p.received_) {
+      p.received_ = acked;
+    }
+    if (begin > p.received_) {
+      return false;
+    }
+    if (end > p.received_) {
+      p.received_ = end;
+    }
+    received = p.received_;
+    return true;
+  }
+
+  // forget the transfers that sent nothing for TRANSFER_RECEIVER_EXPIRY
+  void expire(chrono::steady_clock::time_point now = chrono::steady_clock::now()) {
+    for (auto it = transfers_.begin(); it != transfers_.end();) {
+      if (now - it->second.last_chunk_ >= chrono::seconds(TRANSFER_RECEIVER_EXPIRY)) {
+        it = transfers_.erase(it);
+      } else {
+        it++;
+      }
+    }
+  }
+
+  unsigned size() const {
+    return transfers_.size();
+  }
+};
+
+#endif
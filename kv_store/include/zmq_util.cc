@@ -2,6 +2,7 @@
 
 #include <iomanip>
 #include <ios>
+#include <thread>
 
 namespace zmq_util {
 
@@ -35,6 +36,22 @@ void recv_msg(zmq::socket_t* socket, zmq::message_t& msg) {
   socket->recv(&msg);
 }
 
+namespace {
+
+// called by zmq once a message sent by `send_shared_string` is done with
+void release_shared_string(void* /*data*/, void* hint) {
+  delete static_cast<std::shared_ptr<std::string>*>(hint);
+}
+
+}  // namespace
+
+void send_shared_string(const std::shared_ptr<std::string>& s,
+                        zmq::socket_t* socket) {
+  zmq::message_t msg(&(*s)[0], s->size(), release_shared_string,
+                     new std::shared_ptr<std::string>(s));
+  socket->send(msg);
+}
+
 void send_msgs(std::vector<zmq::message_t> msgs, zmq::socket_t* socket) {
   for (std::size_t i = 0; i < msgs.size(); ++i) {
     socket->send(msgs[i], i == msgs.size() - 1 ? 0 : ZMQ_SNDMORE);
@@ -57,4 +74,43 @@ int poll(long timeout, std::vector<zmq::pollitem_t>* items) {
   return zmq::poll(items->data(), items->size(), timeout);
 }
 
+long IdleStrategy::next_timeout(long timeout) {
+  if (idle_polls_ < spin_count_) {
+    return 0;
+  }
+  if (idle_polls_ < spin_count_ + yield_count_) {
+    std::this_thread::yield();
+    return 0;
+  }
+  if (timeout < 0 || timeout > max_block_) {
+    return max_block_;
+  }
+  return timeout;
+}
+
+void IdleStrategy::update(int events) {
+  if (events > 0) {
+    idle_polls_ = 0;
+  } else if (idle_polls_ < spin_count_ + yield_count_) {
+    idle_polls_ += 1;
+  }
+}
+
+int adaptive_poll(long timeout, IdleStrategy* idle,
+                  std::vector<zmq::pollitem_t>* items) {
+  int events = poll(idle->next_timeout(timeout), items);
+  idle->update(events);
+  return events;
+}
+
+long time_until(const std::chrono::system_clock::time_point& deadline) {
+  auto remaining = std::chrono::duration_cast<std::chrono::microseconds>(
+                       deadline - std::chrono::system_clock::now())
+                       .count();
+  if (remaining <= 0) {
+    return 0;
+  }
+  return (remaining + 999) / 1000;
+}
+
 }  // namespace zmq_util
@@ -1,7 +1,9 @@
 #ifndef ZMQ_UTIL_H_
 #define ZMQ_UTIL_H_
 
+#include <chrono>
 #include <cstring>
+#include <memory>
 #include <ostream>
 #include <string>
 #include <utility>
@@ -29,6 +31,32 @@ void send_msg(void* payload, zmq::socket_t* socket);
 // `recv` a single message.
 void recv_msg(zmq::socket_t* socket, zmq::message_t& msg);
 
+// `send` a reference to an object shared with another thread of this process.
+// The socket must be an inproc socket, and the receiving thread must take the
+// reference with `recv_shared`; the object is freed when the last reference
+// goes away.
+template <typename T>
+void send_shared(const std::shared_ptr<T>& object, zmq::socket_t* socket) {
+  send_msg(new std::shared_ptr<T>(object), socket);
+}
+
+// `recv` a reference to an object sent with `send_shared`.
+template <typename T>
+std::shared_ptr<T> recv_shared(zmq::socket_t* socket) {
+  zmq::message_t msg;
+  recv_msg(socket, msg);
+  std::shared_ptr<T>* holder;
+  memcpy(&holder, msg.data(), sizeof(holder));
+  std::shared_ptr<T> object = *holder;
+  delete holder;
+  return object;
+}
+
+// `send` a string shared by several sends without copying it. The string is
+// freed once every message referencing it has been sent.
+void send_shared_string(const std::shared_ptr<std::string>& s,
+                        zmq::socket_t* socket);
+
 // `send` a multipart message.
 void send_msgs(std::vector<zmq::message_t> msgs, zmq::socket_t* socket);
 
@@ -39,6 +67,42 @@ bool recv_msgs(zmq::socket_t* socket, std::vector<zmq::message_t>& msgs);
 // pointer and a size.
 int poll(long timeout, std::vector<zmq::pollitem_t>* items);
 
+// An `IdleStrategy` counts how many consecutive polls of an event loop came
+// back empty. A loop that just handled an event busy-polls for `spin_count`
+// iterations, then yields its core for `yield_count` iterations, and after
+// that blocks in `poll` for at most `max_block` milliseconds at a time.
+class IdleStrategy {
+ public:
+  IdleStrategy(unsigned spin_count, unsigned yield_count, long max_block)
+      : spin_count_(spin_count),
+        yield_count_(yield_count),
+        max_block_(max_block),
+        idle_polls_(0) {}
+
+  // Returns the timeout to use for the next poll given that the loop's next
+  // deadline is `timeout` milliseconds away (-1 if it has no deadline).
+  long next_timeout(long timeout);
+
+  // Records the number of items returned by the last poll.
+  void update(int events);
+
+ private:
+  unsigned spin_count_;
+  unsigned yield_count_;
+  long max_block_;
+  unsigned idle_polls_;
+};
+
+// `adaptive_poll` is a wrapper around `poll` that consults `idle` to decide
+// between spinning, yielding, and blocking until the next deadline, which is
+// `timeout` milliseconds away.
+int adaptive_poll(long timeout, IdleStrategy* idle,
+                  std::vector<zmq::pollitem_t>* items);
+
+// Returns the number of milliseconds until `deadline`, rounded up so that a
+// poll that times out does not wake up before the deadline has passed.
+long time_until(const std::chrono::system_clock::time_point& deadline);
+
 }  // namespace zmq_util
 
 #endif  // ZMQ_UTIL_H_
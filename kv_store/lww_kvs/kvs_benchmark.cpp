@@ -12,6 +12,7 @@
 #include "socket_cache.h"
 #include "zmq_util.h"
 #include "common.h"
+#include "thread_affinity.h"
 
 using namespace std;
 
@@ -75,6 +76,7 @@ void handle_request(
     string& ip,
     unsigned& thread_id,
     unsigned& rid,
+    unsigned long long& ring_epoch,
     unsigned& trial) {
   if (trial > 5) {
     logger->info("trial is {} for request for key {}", trial, key);
@@ -92,7 +94,7 @@ void handle_request(
     // query the proxy and update the cache
     string target_proxy_address = get_random_proxy_thread(proxy_address, seed).get_key_address_connect_addr();
     bool succeed;
-    auto addresses = get_address_from_proxy(ut, key, pushers[target_proxy_address], key_address_puller, succeed, ip, thread_id, rid);
+    auto addresses = get_address_from_proxy(ut, key, pushers[target_proxy_address], key_address_puller, succeed, ip, thread_id, rid, ring_epoch);
     if (succeed) {
       for (auto it = addresses.begin(); it != addresses.end(); it++) {
         key_address_cache[key].insert(*it);
@@ -110,6 +112,7 @@ void handle_request(
   }
   communication::Request req;
   req.set_respond_address(ut.get_request_pulling_connect_addr());
+  req.set_ring_epoch(ring_epoch);
   string req_id = ip + ":" + to_string(thread_id) + "_" + to_string(rid);
   req.set_request_id(req_id);
   rid += 1;
@@ -145,7 +148,15 @@ void handle_request(
       // update cache and retry
       //logger->info("cache invalidation due to wrong address");
       key_address_cache.erase(key);
-      handle_request(key, value, pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, trial);
+      // the server's view of the ring is at least as new as ours, so its
+      // addresses can be used directly instead of asking a proxy again
+      if (res.has_ring_epoch() && res.ring_epoch() >= ring_epoch && res.tuple(0).addresses_size() > 0) {
+        ring_epoch = res.ring_epoch();
+        for (int i = 0; i < res.tuple(0).addresses_size(); i++) {
+          key_address_cache[key].insert(res.tuple(0).addresses(i));
+        }
+      }
+      handle_request(key, value, pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, ring_epoch, trial);
     } else {
       if (res.tuple(0).has_invalidate() && res.tuple(0).invalidate()) {
         //logger->info("cache invalidation of key {} due to address number mismatch", key);
@@ -174,11 +185,16 @@ void handle_request(
       key_address_cache.erase(*it);
     }
     trial += 1;
-    handle_request(key, value, pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, trial);
+    handle_request(key, value, pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, ring_epoch, trial);
   }
 }
 
-void run(unsigned thread_id) {
+void run(unsigned thread_id, zmq::context_t* context) {
+
+  // pin before allocating anything so that this thread's memory is first
+  // touched on its local NUMA node
+  auto assignment = assign_core(thread_id);
+  bind_to_core(assignment);
 
   string log_file = "log_" + to_string(thread_id) + ".txt";
   string logger_name = "basic_logger_" + to_string(thread_id);
@@ -219,20 +235,20 @@ void run(unsigned thread_id) {
 
   monitoring_thread_t mt = monitoring_thread_t(monitoring_address);
 
-  zmq::context_t context(1);
-  SocketCache pushers(&context, ZMQ_PUSH);
+  logger->info(describe_assignment(thread_id, assignment));
+  SocketCache pushers(context, ZMQ_PUSH);
 
   int timeout = 10000;
   // responsible for pulling response
-  zmq::socket_t response_puller(context, ZMQ_PULL);
+  zmq::socket_t response_puller(*context, ZMQ_PULL);
   response_puller.setsockopt(ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
   response_puller.bind(ut.get_request_pulling_bind_addr());
   // responsible for receiving depart done notice
-  zmq::socket_t key_address_puller(context, ZMQ_PULL);
+  zmq::socket_t key_address_puller(*context, ZMQ_PULL);
   key_address_puller.setsockopt(ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
   key_address_puller.bind(ut.get_key_address_bind_addr());
   // responsible for pulling benchmark command
-  zmq::socket_t command_puller(context, ZMQ_PULL);
+  zmq::socket_t command_puller(*context, ZMQ_PULL);
   command_puller.bind("tcp://*:" + to_string(thread_id + COMMAND_BASE_PORT));
 
   vector<zmq::pollitem_t> pollitems = {
@@ -240,6 +256,8 @@ void run(unsigned thread_id) {
   };
 
   unsigned rid = 0;
+  // the newest membership epoch seen in responses from proxies and servers
+  unsigned long long ring_epoch = 0;
 
   while (true) {
     zmq_util::poll(-1, &pollitems);
@@ -269,7 +287,7 @@ void run(unsigned thread_id) {
           }
           string target_proxy_address = get_random_proxy_thread(proxy_address, seed).get_key_address_connect_addr();
           bool succeed;
-          auto addresses = get_address_from_proxy(ut, key, pushers[target_proxy_address], key_address_puller, succeed, ip, thread_id, rid);
+          auto addresses = get_address_from_proxy(ut, key, pushers[target_proxy_address], key_address_puller, succeed, ip, thread_id, rid, ring_epoch);
           if (succeed) {
             for (auto it = addresses.begin(); it != addresses.end(); it++) {
               key_address_cache[key].insert(*it);
@@ -309,15 +327,15 @@ void run(unsigned thread_id) {
           }
           unsigned trial = 1;
           if (type == "G") {
-            handle_request(key, "", pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, trial);
+            handle_request(key, "", pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, ring_epoch, trial);
             count += 1;
           } else if (type == "P") {
-            handle_request(key, string(length, 'a'), pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, trial);
+            handle_request(key, string(length, 'a'), pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, ring_epoch, trial);
             count += 1;
           } else if (type == "M") {
-            handle_request(key, string(length, 'a'), pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, trial);
+            handle_request(key, string(length, 'a'), pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, ring_epoch, trial);
             trial = 1;
-            handle_request(key, "", pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, trial);
+            handle_request(key, "", pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, ring_epoch, trial);
             count += 2;
           } else {
             logger->info("invalid request type");
@@ -377,15 +395,15 @@ void run(unsigned thread_id) {
           string key = string(8 - key_aux.length(), '0') + key_aux;
           unsigned trial = 1;
           if (type == "G") {
-            handle_request(key, "", pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, trial);
+            handle_request(key, "", pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, ring_epoch, trial);
             count += 1;
           } else if (type == "P") {
-            handle_request(key, string(length, 'a'), pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, trial);
+            handle_request(key, string(length, 'a'), pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, ring_epoch, trial);
             count += 1;
           } else if (type == "M") {
-            handle_request(key, string(length, 'a'), pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, trial);
+            handle_request(key, string(length, 'a'), pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, ring_epoch, trial);
             trial = 1;
-            handle_request(key, "", pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, trial);
+            handle_request(key, "", pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, ring_epoch, trial);
             count += 2;
           } else {
             logger->info("invalid request type");
@@ -442,7 +460,7 @@ void run(unsigned thread_id) {
         for (unsigned i = start; i < end; i++) {
           unsigned trial = 1;
           key = string(8 - to_string(i).length(), '0') + to_string(i);
-          handle_request(key, string(length, 'a'), pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, trial);
+          handle_request(key, string(length, 'a'), pushers, proxy_address, key_address_cache, seed, logger, ut, response_puller, key_address_puller, ip, thread_id, rid, ring_epoch, trial);
           // reset rid
           if (rid > 10000000) {
             rid = 0;
@@ -480,11 +498,22 @@ int main(int argc, char* argv[]) {
     return 1;
   }
 
+  // the zmq context is shared by all benchmark threads, so its I/O threads are
+  // kept on the NUMA node of thread 0. zmq only starts them when the first
+  // socket is created, which would otherwise happen after the creating thread
+  // is bound to its core, so a throwaway socket starts them while this thread
+  // is bound to the whole node
+  bind_to_node(assign_core(0));
+  zmq::context_t context((BENCHMARK_THREAD_NUM + WORKERS_PER_IO_THREAD - 1) / WORKERS_PER_IO_THREAD);
+  {
+    zmq::socket_t io_thread_starter(context, ZMQ_PUSH);
+  }
+
   vector<thread> benchmark_threads;
 
   for (unsigned thread_id = 1; thread_id < BENCHMARK_THREAD_NUM; thread_id++) {
-    benchmark_threads.push_back(thread(run, thread_id));
+    benchmark_threads.push_back(thread(run, thread_id, &context));
   }
 
-  run(0);
+  run(0, &context);
 }
\ No newline at end of file
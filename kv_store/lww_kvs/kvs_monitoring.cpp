@@ -4,6 +4,7 @@
 #include <sstream>
 #include <fstream>
 #include <vector>
+#include <map>
 #include <iostream>
 #include <pthread.h>
 #include <unistd.h>
@@ -14,9 +15,10 @@
 #include "zmq_util.h"
 #include "consistent_hash_map.hpp"
 #include "common.h"
-
-// number of nodes to add concurrently
-#define NODE_ADD 2
+#include "stats_frame.h"
+#include "access_aggregator.h"
+#include "tiering_policy.h"
+#include "management_client.h"
 
 using namespace std;
 using address_t = string;
@@ -24,27 +26,6 @@ using address_t = string;
 // read-only per-tier metadata
 unordered_map<unsigned, tier_data> tier_data_map;
 
-void prepare_metadata_get_request(
-    string& key,
-    global_hash_t& global_memory_hash_ring,
-    local_hash_t& local_memory_hash_ring,
-    unordered_map<address_t, communication::Request>& addr_request_map,
-    monitoring_thread_t& mt,
-    unsigned& rid) {
-  auto threads = get_responsible_threads_metadata(key, global_memory_hash_ring, local_memory_hash_ring);
-  if (threads.size() != 0) {
-    string target_address = next(begin(threads), rand() % threads.size())->get_request_pulling_connect_addr();
-    if (addr_request_map.find(target_address) == addr_request_map.end()) {
-      addr_request_map[target_address].set_type("GET");
-      addr_request_map[target_address].set_respond_address(mt.get_request_pulling_connect_addr());
-      string req_id = mt.get_ip() + ":" + to_string(rid);
-      addr_request_map[target_address].set_request_id(req_id);
-      rid += 1;
-    }
-    prepare_get_tuple(addr_request_map[target_address], key);
-  }
-}
-
 void prepare_metadata_put_request(
     string& key,
     string& value,
@@ -71,16 +52,18 @@ void prepare_replication_factor_update(
     string& key,
     unordered_map<address_t, communication::Replication_Factor_Request>& replication_factor_map,
     string server_address,
-    unordered_map<string, key_info>& placement,
-    unordered_map<address_t, unsigned>& local_replication_map) {
+    const key_info& info,
+    const vector<pair<address_t, unsigned>>& local_replication) {
   communication::Replication_Factor_Request_Tuple* tp = replication_factor_map[server_address].add_tuple();
   tp->set_key(key);
-  for (auto iter = placement[key].global_replication_map_.begin(); iter != placement[key].global_replication_map_.end(); iter++) {
-    communication::Replication_Factor_Request_Global* g = tp->add_global();
-    g->set_tier_id(iter->first);
-    g->set_global_replication(iter->second);
+  for (unsigned tier = MIN_TIER; tier <= MAX_TIER; tier++) {
+    if (info.has_global_replication(tier)) {
+      communication::Replication_Factor_Request_Global* g = tp->add_global();
+      g->set_tier_id(tier);
+      g->set_global_replication(info.global_replication(tier));
+    }
   }
-  for (auto iter = local_replication_map.begin(); iter != local_replication_map.end(); iter++) {
+  for (auto iter = local_replication.begin(); iter != local_replication.end(); iter++) {
     communication::Replication_Factor_Request_Local* l = tp->add_local();
     l->set_ip(iter->first);
     l->set_local_replication(iter->second);
@@ -94,10 +77,11 @@ void change_replication_factor(
     unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
     unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
     vector<address_t>& proxy_address,
-    unordered_map<string, key_info>& placement,
+    placement_map& placement,
     SocketCache& pushers,
     monitoring_thread_t& mt,
     zmq::socket_t& response_puller,
+    access_aggregator& key_access,
     shared_ptr<spdlog::logger> logger,
     unsigned& rid) {
   // used to keep track of the original replication factors for the requested keys
@@ -109,22 +93,20 @@ void change_replication_factor(
 
   for (auto it = requests.begin(); it != requests.end(); it++) {
     string key = it->first;
-    orig_placement_info[key] = placement[key];
+    orig_placement_info[key] = placement.get(key);
     // update the placement map
-    for (auto iter = it->second.global_replication_map_.begin(); iter != it->second.global_replication_map_.end(); iter++) {
-      placement[key].global_replication_map_[iter->first] = iter->second;
-    }
-    for (auto iter = it->second.local_replication_map_.begin(); iter != it->second.local_replication_map_.end(); iter++) {
-      placement[key].local_replication_map_[iter->first] = iter->second;
-    }
+    placement.merge(key, it->second);
+    const key_info& info = placement.get(key);
     // prepare data to be stored in the storage tier
     communication::Replication_Factor rep_data;
-    for (auto iter = placement[key].global_replication_map_.begin(); iter != placement[key].global_replication_map_.end(); iter++) {
-      communication::Replication_Factor_Global* g = rep_data.add_global();
-      g->set_tier_id(iter->first);
-      g->set_global_replication(iter->second);
+    for (unsigned tier = MIN_TIER; tier <= MAX_TIER; tier++) {
+      if (info.has_global_replication(tier)) {
+        communication::Replication_Factor_Global* g = rep_data.add_global();
+        g->set_tier_id(tier);
+        g->set_global_replication(info.global_replication(tier));
+      }
     }
-    for (auto iter = placement[key].local_replication_map_.begin(); iter != placement[key].local_replication_map_.end(); iter++) {
+    for (auto iter = info.local_replications().begin(); iter != info.local_replications().end(); iter++) {
       communication::Replication_Factor_Local* l = rep_data.add_local();
       l->set_ip(iter->first);
       l->set_local_replication(iter->second);
@@ -134,19 +116,21 @@ void change_replication_factor(
     rep_data.SerializeToString(&serialized_rep_data);
     prepare_metadata_put_request(rep_key, serialized_rep_data, global_hash_ring_map[1], local_hash_ring_map[1], addr_request_map, mt, rid);
   }
-  // send updates to storage nodes
+  // send updates to storage nodes all at once so that a slow or departed node
+  // only costs one deadline
   unordered_set<string> failed_keys;
+  auto responses = send_requests<communication::Request, communication::Response>(addr_request_map, pushers, response_puller);
   for (auto it = addr_request_map.begin(); it != addr_request_map.end(); it++) {
-    bool succeed;
-    auto res = send_request<communication::Request, communication::Response>(it->second, pushers[it->first], response_puller, succeed);
-    if (!succeed) {
-      logger->info("rep factor put timed out!");
+    auto res_iter = responses.find(it->first);
+    if (res_iter == responses.end()) {
+      logger->info("rep factor put to {} timed out!", it->first);
       for (int i = 0; i < it->second.tuple_size(); i++) {
         vector<string> tokens;
         split(it->second.tuple(i).key(), '_', tokens);
         failed_keys.insert(tokens[0]);
       }
     } else {
+      auto& res = res_iter->second;
       for (int i = 0; i < res.tuple_size(); i++) {
         if (res.tuple(i).err_number() == 2) {
           logger->info("rep factor put for key {} rejected due to wrong address!", res.tuple(i).key());
@@ -163,11 +147,12 @@ void change_replication_factor(
     if (failed_keys.find(key) == failed_keys.end()) {
       // prepare data for notifying relevant nodes
       // form rep factor change requests for all tiers
+      const key_info& info = placement.get(key);
       for (unsigned tier = MIN_TIER; tier <= MAX_TIER; tier++) {
-        unsigned rep = max(placement[key].global_replication_map_[tier], orig_placement_info[key].global_replication_map_[tier]);
+        unsigned rep = max(info.global_replication(tier), orig_placement_info[key].global_replication(tier));
         auto threads = responsible_global(key, rep, global_hash_ring_map[tier]);
         for (auto server_iter = threads.begin(); server_iter != threads.end(); server_iter++) {
-          prepare_replication_factor_update(key, replication_factor_map, server_iter->get_replication_factor_change_connect_addr(), placement, it->second.local_replication_map_);
+          prepare_replication_factor_update(key, replication_factor_map, server_iter->get_replication_factor_change_connect_addr(), info, it->second.local_replications());
         }
       }
 
@@ -175,7 +160,7 @@ void change_replication_factor(
 
       // form placement requests for proxy nodes
       for (auto proxy_iter = proxy_address.begin(); proxy_iter != proxy_address.end(); proxy_iter++) {
-        prepare_replication_factor_update(key, replication_factor_map, proxy_thread_t(*proxy_iter, 0).get_replication_factor_change_connect_addr(), placement, it->second.local_replication_map_);
+        prepare_replication_factor_update(key, replication_factor_map, proxy_thread_t(*proxy_iter, 0).get_replication_factor_change_connect_addr(), info, it->second.local_replications());
       }
     }
   }
@@ -187,7 +172,133 @@ void change_replication_factor(
   }
   // restore rep factor for failed keys
   for (auto it = failed_keys.begin(); it != failed_keys.end(); it++) {
-    placement[*it] = orig_placement_info[*it];
+    placement.set(*it, orig_placement_info[*it]);
+  }
+  // move the keys to the index of their new replication
+  for (auto it = requests.begin(); it != requests.end(); it++) {
+    key_access.set_memory_replication(it->first, placement.get(it->first).global_replication(1));
+  }
+}
+
+// carries out the tiering policy's decisions on the cluster
+class monitoring_executor : public policy_executor {
+  unordered_map<unsigned, global_hash_t>& global_hash_ring_map_;
+  unordered_map<unsigned, local_hash_t>& local_hash_ring_map_;
+  vector<address_t>& proxy_address_;
+  placement_map& placement_;
+  SocketCache& pushers_;
+  monitoring_thread_t& mt_;
+  zmq::socket_t& response_puller_;
+  access_aggregator& key_access_;
+  unordered_map<address_t, unsigned>& departing_node_map_;
+  management_client& management_;
+  policy_state& state_;
+  shared_ptr<spdlog::logger> logger_;
+  unsigned& rid_;
+
+public:
+  monitoring_executor(
+      unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
+      unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
+      vector<address_t>& proxy_address,
+      placement_map& placement,
+      SocketCache& pushers,
+      monitoring_thread_t& mt,
+      zmq::socket_t& response_puller,
+      access_aggregator& key_access,
+      unordered_map<address_t, unsigned>& departing_node_map,
+      management_client& management,
+      policy_state& state,
+      shared_ptr<spdlog::logger> logger,
+      unsigned& rid) :
+    global_hash_ring_map_(global_hash_ring_map), local_hash_ring_map_(local_hash_ring_map),
+    proxy_address_(proxy_address), placement_(placement), pushers_(pushers), mt_(mt),
+    response_puller_(response_puller), key_access_(key_access), departing_node_map_(departing_node_map),
+    management_(management), state_(state), logger_(logger), rid_(rid) {}
+
+  void change_replication_factor(unordered_map<string, key_info>& requests) {
+    ::change_replication_factor(requests, global_hash_ring_map_, local_hash_ring_map_, proxy_address_, placement_, pushers_, mt_, response_puller_, key_access_, logger_, rid_);
+  }
+
+  void add_node(unsigned tier_id, unsigned number) {
+    string tier = tier_id == 1 ? "memory" : "ebs";
+    policy_state& state = state_;
+    shared_ptr<spdlog::logger> logger = logger_;
+    management_.post("/add/" + tier + "/" + to_string(number), [&state, logger, tier_id, tier, number](int status) {
+      if (status >= 200 && status < 300) {
+        logger->info("management server added {} {} nodes", number, tier);
+        return;
+      }
+      // the nodes will not join, so stop waiting for them
+      logger->info("adding {} {} nodes failed with status {}", number, tier, status);
+      if (tier_id == 1) {
+        state.adding_memory_node_ -= min(state.adding_memory_node_, number);
+      } else {
+        state.adding_ebs_node_ -= min(state.adding_ebs_node_, number);
+      }
+    });
+  }
+
+  void remove_node(unsigned tier_id, const string& ip) {
+    const auto& nodes = global_hash_ring_map_[tier_id].nodes();
+    if (nodes.size() == 0) {
+      return;
+    }
+    // pick a random node if the policy has no preference
+    server_thread_t node = ip == "" ? nodes[rand() % nodes.size()] : server_thread_t(ip, 0);
+    departing_node_map_[node.get_ip()] = tier_data_map[tier_id].thread_number_;
+    zmq_util::send_string(mt_.get_depart_done_connect_addr(), &pushers_[node.get_self_depart_connect_addr()]);
+  }
+};
+
+// bounded-load placement: every node of a tier serves at most
+// (1 + BOUNDED_LOAD_EPSILON) times the tier's average occupancy and sheds the
+// share of its keys above that to the next node on the ring. Sheds are
+// sequenced like membership changes so that every ring moves the same keys
+void update_load_bounds(
+    unsigned tier_id,
+    unordered_map<address_t, unordered_map<unsigned, pair<double, unsigned>>>& tier_occupancy,
+    global_hash_t& hash_ring,
+    membership_log& membership,
+    communication::Membership& update,
+    shared_ptr<spdlog::logger> logger) {
+  // the occupancy each node would have if it kept all of its keys, so that a
+  // node's own shedding does not make it stop shedding
+  unordered_map<address_t, pair<double, uint32_t>> natural_occupancy;
+  double sum_occupancy = 0.0;
+  const auto& nodes = hash_ring.nodes();
+  for (auto it1 = tier_occupancy.begin(); it1 != tier_occupancy.end(); it1++) {
+    auto node = find(nodes.begin(), nodes.end(), server_thread_t(it1->first, 0));
+    if (node == nodes.end() || it1->second.size() == 0) {
+      continue;
+    }
+    double sum_thread_occupancy = 0.0;
+    for (auto it2 = it1->second.begin(); it2 != it1->second.end(); it2++) {
+      sum_thread_occupancy += it2->second.first;
+    }
+    uint32_t shed = hash_ring.shed(node - nodes.begin());
+    double occupancy = sum_thread_occupancy / it1->second.size() / (1.0 - (double) shed / LOAD_SHED_SCALE);
+    natural_occupancy[it1->first] = pair<double, uint32_t>(occupancy, shed);
+    sum_occupancy += occupancy;
+  }
+  if (natural_occupancy.size() == 0) {
+    return;
+  }
+
+  double capacity = (1 + BOUNDED_LOAD_EPSILON) * sum_occupancy / natural_occupancy.size();
+  for (auto it = natural_occupancy.begin(); it != natural_occupancy.end(); it++) {
+    double occupancy = it->second.first;
+    unsigned steps = 0;
+    if (occupancy > capacity) {
+      // a node always keeps some of its keys
+      steps = min<unsigned>(ceil((1.0 - capacity / occupancy) * LOAD_SHED_STEPS), LOAD_SHED_STEPS - 1);
+    }
+    uint32_t shed = steps * (LOAD_SHED_SCALE / LOAD_SHED_STEPS);
+    if (shed != it->second.second) {
+      logger->info("node {} on tier {} has occupancy {} against capacity {}, shedding {}/{} of its keys", it->first, tier_id, occupancy, capacity, steps, LOAD_SHED_STEPS);
+      hash_ring.set_shed(server_thread_t(it->first, 0), shed);
+      *update.add_delta() = membership.append_shed(tier_id, it->first, shed);
+    }
   }
 }
 
@@ -212,20 +323,16 @@ int main(int argc, char* argv[]) {
 
   // form local hash rings
   for (auto it = tier_data_map.begin(); it != tier_data_map.end(); it++) {
-    for (unsigned tid = 0; tid < it->second.thread_number_; tid++) {
-      insert_to_hash_ring<local_hash_t>(local_hash_ring_map[it->first], ip, tid);
-    }
+    local_hash_ring_map[it->first] = local_hash_t(it->second.thread_number_);
   }
 
-  // keep track of the keys' replication info
-  unordered_map<string, key_info> placement;
-  // warm up for benchmark
-  warmup(placement);
+  // keep track of the keys' replication info; only the keys whose
+  // replication differs from the default are stored
+  placement_map placement;
+  placement.set_default(default_key_info());
 
-  // keep track of the keys' access by worker address
-  unordered_map<string, unordered_map<address_t, unsigned>> key_access_frequency;
-  // keep track of the keys' access summary
-  unordered_map<string, unsigned> key_access_summary;
+  // keep track of the keys' total access across worker threads
+  access_aggregator key_access;
   // keep track of memory tier storage consumption
   unordered_map<address_t, unordered_map<unsigned, unsigned long long>> memory_tier_storage;
   // keep track of ebs tier storage consumption
@@ -234,6 +341,12 @@ int main(int argc, char* argv[]) {
   unordered_map<address_t, unordered_map<unsigned, pair<double, unsigned>>> memory_tier_occupancy;
   // keep track of ebs tier thread occupancy
   unordered_map<address_t, unordered_map<unsigned, pair<double, unsigned>>> ebs_tier_occupancy;
+  // the latest stats pushed by each server thread, with the thread's tier
+  map<pair<address_t, unsigned>, pair<unsigned, stats_view>> thread_stats;
+  // the request latency servers measured since the last epoch, by tier
+  unordered_map<unsigned, latency_histogram> tier_queue_latency;
+  unordered_map<unsigned, latency_histogram> tier_service_latency;
+  unordered_map<unsigned, latency_histogram> tier_latency;
   // keep track of user latency info
   unordered_map<address_t, double> user_latency;
   // keep track of user throughput info
@@ -253,6 +366,9 @@ int main(int argc, char* argv[]) {
   management_address = ip_line;
   address.close();
 
+  // node additions and removals run in the background and report back here
+  management_client management(management_address);
+
   monitoring_thread_t mt = monitoring_thread_t(ip);
 
   zmq::context_t context(1);
@@ -267,7 +383,12 @@ int main(int argc, char* argv[]) {
 
   unordered_map<address_t, unsigned> departing_node_map;
 
-  // responsible for both node join and departure
+  // the monitoring node sequences every membership change; servers and
+  // proxies register joins and departures here and get the current server
+  // list and epoch back
+  zmq::socket_t membership_responder(context, ZMQ_REP);
+  membership_responder.bind(mt.get_membership_bind_addr());
+  // responsible for requests to resend the membership changes a node missed
   zmq::socket_t notify_puller(context, ZMQ_PULL);
   notify_puller.bind(mt.get_notify_bind_addr());
   // responsible for receiving depart done notice
@@ -276,97 +397,143 @@ int main(int argc, char* argv[]) {
   // responsible for receiving latency update from users
   zmq::socket_t latency_puller(context, ZMQ_PULL);
   latency_puller.bind(mt.get_latency_report_bind_addr());
+  // responsible for the stats frames servers push
+  zmq::socket_t stats_puller(context, ZMQ_PULL);
+  stats_puller.bind(mt.get_stats_bind_addr());
 
   vector<zmq::pollitem_t> pollitems = {
     { static_cast<void *>(notify_puller), 0, ZMQ_POLLIN, 0 },
     { static_cast<void *>(depart_done_puller), 0, ZMQ_POLLIN, 0 },
-    { static_cast<void *>(latency_puller), 0, ZMQ_POLLIN, 0 }
+    { static_cast<void *>(latency_puller), 0, ZMQ_POLLIN, 0 },
+    { static_cast<void *>(membership_responder), 0, ZMQ_POLLIN, 0 },
+    { static_cast<void *>(stats_puller), 0, ZMQ_POLLIN, 0 }
   };
 
+  // the ordered log of membership changes, numbered by epoch
+  membership_log membership;
+
+  // every server generates timestamps relative to this
+  auto start_time_ms = chrono::time_point_cast<std::chrono::milliseconds>(chrono::system_clock::now());
+  unsigned long long start_time = start_time_ms.time_since_epoch().count();
+
   auto report_start = chrono::system_clock::now();
   auto report_end = chrono::system_clock::now();
 
   auto grace_start = chrono::system_clock::now();
 
-  unsigned adding_memory_node = 0;
-  unsigned adding_ebs_node = 0;
-  bool removing_memory_node = false;
-  bool removing_ebs_node = false;
+  // the node additions and removals in progress and the access forecast
+  policy_state state;
+  key_access.track_changes(state.predictive_);
 
   unsigned server_monitoring_epoch = 0;
 
   unsigned rid = 0;
   bool policy_start = false;
 
+  zmq_util::IdleStrategy idle(IDLE_SPIN_COUNT, IDLE_YIELD_COUNT, IDLE_MAX_BLOCK_TIME);
+
   while (true) {
-    // listen for ZMQ events
-    zmq_util::poll(0, &pollitems);
+    // listen for ZMQ events, blocking once idle until the next monitoring epoch is due
+    zmq_util::adaptive_poll(zmq_util::time_until(report_start + chrono::seconds(MONITORING_THRESHOLD)), &idle, &pollitems);
 
-    // handle a join or depart event
+    // act on the management requests that finished
+    management.complete();
+
+    // resend the membership changes a node missed
     if (pollitems[0].revents & ZMQ_POLLIN) {
-      string message = zmq_util::recv_string(&notify_puller);
-
-      vector<string> v;
-      split(message, ':', v);
-      string type = v[0];
-      unsigned tier = stoi(v[1]);
-      string new_server_ip = v[2];
-      if (type == "join") {
-        logger->info("received join");
-        logger->info("new server ip is {}", new_server_ip);
-        logger->info("tier id is {}", to_string(tier));
-        if (tier == 1) {
-          insert_to_hash_ring<global_hash_t>(global_hash_ring_map[tier], new_server_ip, 0);
-          if (adding_memory_node > 0) {
-            adding_memory_node -= 1;
+      string serialized_request = zmq_util::recv_string(&notify_puller);
+      communication::Membership request;
+      request.ParseFromString(serialized_request);
+
+      communication::Membership deltas;
+      membership.get_deltas_since(request.epoch(), deltas);
+      if (deltas.delta_size() > 0) {
+        logger->info("resending {} membership changes after epoch {}", to_string(deltas.delta_size()), to_string(request.epoch()));
+        string serialized_deltas;
+        deltas.SerializeToString(&serialized_deltas);
+        zmq_util::send_string(serialized_deltas, &pushers[request.sync_address()]);
+      }
+    }
+
+    // handle a join or depart event
+    if (pollitems[3].revents & ZMQ_POLLIN) {
+      string serialized_registration = zmq_util::recv_string(&membership_responder);
+      communication::Membership registration;
+      registration.ParseFromString(serialized_registration);
+
+      for (int i = 0; i < registration.delta_size(); i++) {
+        bool join = registration.delta(i).join();
+        unsigned tier = registration.delta(i).tier_id();
+        string new_server_ip = registration.delta(i).ip();
+        if (tier == 0) {
+          // proxies are not on the hash ring, so they take no epoch
+          if (join) {
+            logger->info("received join");
+            logger->info("new proxy ip is {}", new_server_ip);
+            proxy_address.push_back(new_server_ip);
           }
-          // reset timer
-          grace_start = chrono::system_clock::now();
-        } else if (tier == 2) {
-          insert_to_hash_ring<global_hash_t>(global_hash_ring_map[tier], new_server_ip, 0);
-          if (adding_ebs_node > 0) {
-            adding_ebs_node -= 1;
+          continue;
+        }
+        if (tier != 1 && tier != 2) {
+          cerr << "Invalid Tier info\n";
+          continue;
+        }
+
+        // only a change to the ring takes an epoch, so a retried
+        // registration is not sequenced twice
+        if (join && insert_to_hash_ring<global_hash_t>(global_hash_ring_map[tier], new_server_ip, 0)) {
+          logger->info("received join");
+          logger->info("new server ip is {}", new_server_ip);
+          logger->info("tier id is {}", to_string(tier));
+          membership.append(true, tier, new_server_ip);
+          if (tier == 1 && state.adding_memory_node_ > 0) {
+            state.adding_memory_node_ -= 1;
+          } else if (tier == 2 && state.adding_ebs_node_ > 0) {
+            state.adding_ebs_node_ -= 1;
           }
           // reset timer
           grace_start = chrono::system_clock::now();
-        } else if (tier == 0) {
-          proxy_address.push_back(new_server_ip);
-        } else {
-          cerr << "Invalid Tier info\n";
-        }
-        for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
-          logger->info("hash ring for tier {} size is {}", to_string(it->first), to_string(it->second.size()));
-        }
-      } else if (type == "depart") {
-        logger->info("received depart");
-        logger->info("departing server ip is {}", new_server_ip);
-        //cerr << "received depart\n";
-        // update hash ring
-        if (tier == 1) {
+        } else if (!join && find(global_hash_ring_map[tier].nodes().begin(), global_hash_ring_map[tier].nodes().end(), server_thread_t(new_server_ip, 0)) != global_hash_ring_map[tier].nodes().end()) {
+          logger->info("received depart");
+          logger->info("departing server ip is {}", new_server_ip);
           remove_from_hash_ring<global_hash_t>(global_hash_ring_map[tier], new_server_ip, 0);
-          memory_tier_storage.erase(new_server_ip);
-          memory_tier_occupancy.erase(new_server_ip);
-          for (auto it = key_access_frequency.begin(); it != key_access_frequency.end(); it++) {
-            for (unsigned i = 0; i < MEMORY_THREAD_NUM; i++) {
-              it->second.erase(new_server_ip + ":" + to_string(i));
-            }
+          membership.append(false, tier, new_server_ip);
+          for (unsigned i = 0; i < tier_data_map[tier].thread_number_; i++) {
+            thread_stats.erase(make_pair(new_server_ip, i));
+            key_access.remove_thread(new_server_ip + ":" + to_string(i));
           }
-        } else if (tier == 2) {
-          remove_from_hash_ring<global_hash_t>(global_hash_ring_map[tier], new_server_ip, 0);
-          ebs_tier_storage.erase(new_server_ip);
-          ebs_tier_occupancy.erase(new_server_ip);
-          for (auto it = key_access_frequency.begin(); it != key_access_frequency.end(); it++) {
-            for (unsigned i = 0; i < EBS_THREAD_NUM; i++) {
-              it->second.erase(new_server_ip + ":" + to_string(i));
-            }
+          if (tier == 1) {
+            memory_tier_storage.erase(new_server_ip);
+            memory_tier_occupancy.erase(new_server_ip);
+          } else {
+            ebs_tier_storage.erase(new_server_ip);
+            ebs_tier_occupancy.erase(new_server_ip);
           }
-        } else {
-          cerr << "Invalid Tier info\n";
         }
-        for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
-          logger->info("hash ring for tier {} size is {}", to_string(it->first), to_string(it->second.size()));
+      }
+      for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
+        logger->info("hash ring for tier {} size is {}", to_string(it->first), to_string(it->second.size()));
+      }
+
+      // reply with the server list as of the current epoch
+      communication::Address addresses;
+      addresses.set_start_time(start_time);
+      addresses.set_ring_epoch(membership.epoch());
+      for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
+        const auto& nodes = it->second.nodes();
+        for (auto iter = nodes.begin(); iter != nodes.end(); iter++) {
+          communication::Address_Tuple* tp = addresses.add_tuple();
+          tp->set_tier_id(it->first);
+          tp->set_ip(iter->get_ip());
+          uint32_t shed = it->second.shed(iter - nodes.begin());
+          if (shed != 0) {
+            tp->set_shed(shed);
+          }
         }
       }
+      string serialized_addresses;
+      addresses.SerializeToString(&serialized_addresses);
+      zmq_util::send_string(serialized_addresses, &membership_responder);
     }
 
     if (pollitems[1].revents & ZMQ_POLLIN) {
@@ -378,19 +545,23 @@ int main(int argc, char* argv[]) {
       if (departing_node_map.find(departed_ip) != departing_node_map.end()) {
         departing_node_map[departed_ip] -= 1;
         if (departing_node_map[departed_ip] == 0) {
-          if (tier_id == 1) {
-            logger->info("removing memory node {}", departed_ip);
-            string shell_command = "curl -X POST http://" + management_address + "/remove/memory/" + departed_ip;
-            system(shell_command.c_str());
-            removing_memory_node = false;
-          } else {
-            logger->info("removing ebs node {}", departed_ip);
-            string shell_command = "curl -X POST http://" + management_address + "/remove/ebs/" + departed_ip;
-            system(shell_command.c_str());
-            removing_ebs_node = false;
-          }
-          // reset timer
-          grace_start = chrono::system_clock::now();
+          string tier = tier_id == 1 ? "memory" : "ebs";
+          logger->info("removing {} node {}", tier, departed_ip);
+          // the removal is in progress until the management server answers
+          management.post("/remove/" + tier + "/" + departed_ip, [&state, &grace_start, logger, tier_id, tier, departed_ip](int status) {
+            if (status >= 200 && status < 300) {
+              logger->info("management server removed {} node {}", tier, departed_ip);
+            } else {
+              logger->info("removing {} node {} failed with status {}", tier, departed_ip, status);
+            }
+            if (tier_id == 1) {
+              state.removing_memory_node_ = false;
+            } else {
+              state.removing_ebs_node_ = false;
+            }
+            // reset timer
+            grace_start = chrono::system_clock::now();
+          });
           departing_node_map.erase(departed_ip);
         }
       } else {
@@ -413,99 +584,77 @@ int main(int argc, char* argv[]) {
       }
     }
 
+    if (pollitems[4].revents & ZMQ_POLLIN) {
+      communication::Stats_Frame frame;
+      frame.ParseFromString(zmq_util::recv_string(&stats_puller));
+      auto& entry = thread_stats[make_pair(frame.ip(), frame.tid())];
+      entry.first = frame.tier_id();
+      entry.second.apply(frame);
+      // every frame carries the latency since the thread's previous one
+      tier_queue_latency[frame.tier_id()].merge(frame.stat().queue_latency());
+      tier_service_latency[frame.tier_id()].merge(frame.stat().service_latency());
+      tier_latency[frame.tier_id()].merge(frame.stat().latency());
+
+      // fold the thread's changes into the key access totals; only the hottest
+      // keys and a sample of cold ones are reported, and cold keys count as
+      // unaccessed on the thread
+      string thread = frame.ip() + ":" + to_string(frame.tid());
+      if (!entry.second.synced()) {
+        key_access.remove_thread(thread);
+      } else if (frame.full() || !key_access.has_thread(thread)) {
+        key_access.remove_thread(thread);
+        for (auto it = entry.second.access().begin(); it != entry.second.access().end(); it++) {
+          if (!is_metadata(it->first)) {
+            key_access.update(thread, it->first, it->second, placement.get(it->first).global_replication(1));
+          }
+        }
+      } else {
+        for (int i = 0; i < frame.access().tuple_size(); i++) {
+          const string& key = frame.access().tuple(i).key();
+          if (!is_metadata(key)) {
+            key_access.update(thread, key, frame.access().tuple(i).access(), placement.get(key).global_replication(1));
+          }
+        }
+        for (int i = 0; i < frame.removed_size(); i++) {
+          key_access.erase(thread, frame.removed(i));
+        }
+      }
+    }
+
     report_end = std::chrono::system_clock::now();
 
     if (chrono::duration_cast<std::chrono::seconds>(report_end-report_start).count() >= MONITORING_THRESHOLD) {
       server_monitoring_epoch += 1;
-      // clear stats
-      key_access_frequency.clear();
-      key_access_summary.clear();
+      // clear stats; the key access totals are kept up to date as stats arrive
       memory_tier_storage.clear();
       ebs_tier_storage.clear();
       memory_tier_occupancy.clear();
       ebs_tier_occupancy.clear();
 
-      unordered_map<address_t, communication::Request> addr_request_map;
-
-      for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
-        unsigned tier_id = it->first;
-        auto hash_ring = &(it->second);
-        unordered_set<string> observed_ip;
-        for (auto iter = hash_ring->begin(); iter != hash_ring->end(); iter++) {
-          if (observed_ip.find(iter->second.get_ip()) == observed_ip.end()) {
-            for (unsigned i = 0; i < tier_data_map[tier_id].thread_number_; i++) {
-              string key = iter->second.get_ip() + "_" + to_string(i) + "_" + to_string(tier_id) + "_stat";
-              prepare_metadata_get_request(key, global_hash_ring_map[1], local_hash_ring_map[1], addr_request_map, mt, rid);
-              key = iter->second.get_ip() + "_" + to_string(i) + "_" + to_string(tier_id) + "_access";
-              prepare_metadata_get_request(key, global_hash_ring_map[1], local_hash_ring_map[1], addr_request_map, mt, rid);
-            }
-            observed_ip.insert(iter->second.get_ip());
-          }
-        }
-      }
-
-      for (auto it = addr_request_map.begin(); it != addr_request_map.end(); it++) {
-        bool succeed;
-        auto res = send_request<communication::Request, communication::Response>(it->second, pushers[it->first], response_puller, succeed);
-        if (succeed) {
-          for (int i = 0; i < res.tuple_size(); i++) {
-            if (res.tuple(i).err_number() == 0) {
-              vector<string> tokens;
-              split(res.tuple(i).key(), '_', tokens);
-              string ip = tokens[0];
-              unsigned tid = stoi(tokens[1]);
-              unsigned tier_id = stoi(tokens[2]);
-              string metadata_type = tokens[3];
-
-              if (metadata_type == "stat") {
-                // deserialized the value
-                communication::Server_Stat stat;
-                stat.ParseFromString(res.tuple(i).value());
-                if (tier_id == 1) {
-                  memory_tier_storage[ip][tid] = stat.storage_consumption();
-                  memory_tier_occupancy[ip][tid] = pair<double, unsigned>(stat.occupancy(), stat.epoch());
-                } else {
-                  ebs_tier_storage[ip][tid] = stat.storage_consumption();
-                  ebs_tier_occupancy[ip][tid] = pair<double, unsigned>(stat.occupancy(), stat.epoch());
-                }
-              } else if (metadata_type == "access") {
-                // deserialized the value
-                communication::Key_Access access;
-                access.ParseFromString(res.tuple(i).value());
-                if (tier_id == 1) {
-                  for (int j = 0; j < access.tuple_size(); j++) {
-                    string key = access.tuple(j).key();
-                    key_access_frequency[key][ip + ":" + to_string(tid)] = access.tuple(j).access();
-                  }
-                } else {
-                  for (int j = 0; j < access.tuple_size(); j++) {
-                    string key = access.tuple(j).key();
-                    key_access_frequency[key][ip + ":" + to_string(tid)] = access.tuple(j).access();
-                  }
-                }
-              }
-            } else if (res.tuple(i).err_number() == 1) {
-              cerr << "key " + res.tuple(i).key() + " doesn't exist\n";
-            } else {
-              cerr << "hash ring is inconsistent for key " + res.tuple(i).key() + "\n";
-              //TODO: reach here when the hash ring is inconsistent
-            }
-          }
-        } else {
-          cerr << "request timed out\n";
+      // rebuild the stats from what the servers pushed; a thread that has not
+      // reported for a while is left out rather than counted with stale data
+      auto current_time = chrono::system_clock::now();
+      for (auto it = thread_stats.begin(); it != thread_stats.end(); it++) {
+        const string& ip = it->first.first;
+        unsigned tid = it->first.second;
+        const stats_view& view = it->second.second;
+        if (chrono::duration_cast<std::chrono::seconds>(current_time-view.updated()).count() > STATS_EXPIRY_THRESHOLD) {
+          key_access.remove_thread(ip + ":" + to_string(tid));
           continue;
         }
-      }
-
-      // compute key access summary
-      for (auto it = key_access_frequency.begin(); it != key_access_frequency.end(); it++) {
-        string key = it->first;
-        unsigned total_access = 0;
-        for (auto iter = it->second.begin(); iter != it->second.end(); iter++) {
-          total_access += iter->second;
+        const communication::Server_Stat& stat = view.stat();
+        if (stat.transfer_keys_remaining() > 0) {
+          logger->info("thread {}:{} in tier {} has {} keys left to transfer, sent {} bytes since its last report", ip, to_string(tid), to_string(it->second.first), to_string(stat.transfer_keys_remaining()), to_string(stat.transfer_bytes_sent()));
+        }
+        if (it->second.first == 1) {
+          memory_tier_storage[ip][tid] = stat.storage_consumption();
+          memory_tier_occupancy[ip][tid] = pair<double, unsigned>(stat.occupancy(), stat.epoch());
+        } else {
+          ebs_tier_storage[ip][tid] = stat.storage_consumption();
+          ebs_tier_occupancy[ip][tid] = pair<double, unsigned>(stat.occupancy(), stat.epoch());
         }
-        key_access_summary[key] = total_access;
       }
+      logger->info("{} keys have reported accesses", key_access.size());
 
       unsigned long long total_memory_consumption = 0;
       unsigned long long total_ebs_consumption = 0;
@@ -611,6 +760,26 @@ int main(int argc, char* argv[]) {
       logger->info("min ebs node occupancy is {}", to_string(min_ebs_occupancy));
       logger->info("avg ebs node occupancy is {}", to_string(avg_ebs_occupancy));
 
+      if (ENABLE_BOUNDED_LOAD) {
+        communication::Membership update;
+        update_load_bounds(1, memory_tier_occupancy, global_hash_ring_map[1], membership, update, logger);
+        update_load_bounds(2, ebs_tier_occupancy, global_hash_ring_map[2], membership, update, logger);
+        if (update.delta_size() > 0) {
+          // servers and proxies apply the sheds like any membership change
+          string serialized_update;
+          update.SerializeToString(&serialized_update);
+          for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
+            const auto& nodes = it->second.nodes();
+            for (auto iter = nodes.begin(); iter != nodes.end(); iter++) {
+              zmq_util::send_string(serialized_update, &pushers[iter->get_node_join_connect_addr()]);
+            }
+          }
+          for (auto it = proxy_address.begin(); it != proxy_address.end(); it++) {
+            zmq_util::send_string(serialized_update, &pushers[proxy_thread_t(*it, 0).get_notify_connect_addr()]);
+          }
+        }
+      }
+
       // gather latency info
       double avg_latency = 0;
       if (user_latency.size() > 0) {
@@ -625,6 +794,12 @@ int main(int argc, char* argv[]) {
         avg_latency = sum_latency / count;
       }
       logger->info("avg latency is {}", avg_latency);
+      for (auto it = tier_latency.begin(); it != tier_latency.end(); it++) {
+        unsigned tier = it->first;
+        logger->info("tier {} request latency p50 {} p99 {} p999 {} over {} requests", tier, it->second.percentile(0.5), it->second.percentile(0.99), it->second.percentile(0.999), it->second.count());
+        logger->info("tier {} queueing latency p50 {} p99 {} p999 {}", tier, tier_queue_latency[tier].percentile(0.5), tier_queue_latency[tier].percentile(0.99), tier_queue_latency[tier].percentile(0.999));
+        logger->info("tier {} service latency p50 {} p99 {} p999 {}", tier, tier_service_latency[tier].percentile(0.5), tier_service_latency[tier].percentile(0.99), tier_service_latency[tier].percentile(0.999));
+      }
       // gather throughput info
       double total_throughput = 0;
       if (user_throughput.size() > 0) {
@@ -636,305 +811,34 @@ int main(int argc, char* argv[]) {
       }
       logger->info("total throughput is {}", total_throughput);      
 
-      unsigned required_memory_node = ceil(total_memory_consumption / (MEM_CAPACITY_MAX * tier_data_map[1].node_capacity_));
-      unsigned required_ebs_node = ceil(total_ebs_consumption / (EBS_CAPACITY_MAX * tier_data_map[2].node_capacity_));
-      logger->info("required memory node is {}", required_memory_node);
-      logger->info("required ebs node is {}", required_ebs_node);
-
-      unsigned memory_node_number = global_hash_ring_map[1].size() / VIRTUAL_THREAD_NUM;
-      unsigned ebs_node_number = global_hash_ring_map[2].size() / VIRTUAL_THREAD_NUM;
-
       // Policy Start Here:
-      /*if (true) {
-        // 1. first check storage consumption and trigger elasticity if necessary
-        if (memory_node_number != 0 && adding_memory_node == 0 && required_memory_node > memory_node_number) {
-          logger->info("memory consumption exceeds threshold!");
-          auto time_elapsed = chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now()-grace_start).count();
-          if (time_elapsed > GRACE_PERIOD) {
-            logger->info("trigger add {} memory node", to_string(NODE_ADD));
-            string shell_command = "curl -X POST http://" + management_address + "/add/memory/" + to_string(NODE_ADD) + " &";
-            system(shell_command.c_str());
-            adding_memory_node = NODE_ADD;
-          } else {
-            logger->info("in grace period, not adding memory nodes");
-          }
-        }
-
-        if (ebs_node_number != 0 && adding_ebs_node == 0 && required_ebs_node > ebs_node_number) {
-          logger->info("ebs consumption exceeds threshold!");
-          auto time_elapsed = chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now()-grace_start).count();
-          if (time_elapsed > GRACE_PERIOD) {
-            logger->info("trigger add {} ebs node", to_string(NODE_ADD));
-            string shell_command = "curl -X POST http://" + management_address + "/add/ebs/" + to_string(NODE_ADD) + " &";
-            system(shell_command.c_str());
-            adding_ebs_node = NODE_ADD;
-          } else {
-            logger->info("in grace period, not adding ebs nodes");
-          }
-        }
-
-        if (ebs_node_number != 0 && average_ebs_consumption_percentage < EBS_CAPACITY_MIN && !removing_ebs_node && ebs_node_number > max(required_ebs_node, (unsigned)MINIMUM_EBS_NODE)) {
-          logger->info("removing ebs node to save cost");
-          auto time_elapsed = chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now()-grace_start).count();
-          if (time_elapsed > GRACE_PERIOD) {
-            // pick a random ebs node and send remove node command
-            auto node = next(begin(global_hash_ring_map[2]), rand() % global_hash_ring_map[2].size())->second;
-            auto ip = node.get_ip();
-            auto connection_addr = node.get_self_depart_connect_addr();
-            departing_node_map[ip] = tier_data_map[2].thread_number_;
-            auto ack_addr = mt.get_depart_done_connect_addr();
-            logger->info("sending remove ebs node msg");
-            zmq_util::send_string(ack_addr, &pushers[connection_addr]);
-            removing_ebs_node = true;
-          } else {
-            logger->info("in grace period, not removing node");
-          }
-        }
-
-        unordered_map<string, key_info> requests;
-        unsigned total_rep_to_change = 0;
-        // 2. check key access summary to promote hot keys to memory tier
-        unsigned slot = (MEM_CAPACITY_MAX * tier_data_map[1].node_capacity_ * memory_node_number - total_memory_consumption) / VALUE_SIZE;
-        bool overflow = false;
-        for (auto it = key_access_summary.begin(); it != key_access_summary.end(); it++) {
-          string key = it->first;
-          unsigned total_access = it->second;
-          if (!is_metadata(key) && total_access > PROMOTE_THRESHOLD && placement[key].global_replication_map_[1] == 0) {
-            total_rep_to_change += 1;
-            if (total_rep_to_change > slot) {
-              overflow = true;
-            } else {
-              key_info new_rep_factor;
-              new_rep_factor.global_replication_map_[1] = placement[key].global_replication_map_[1] + 1;
-              new_rep_factor.global_replication_map_[2] = placement[key].global_replication_map_[2] - 1;
-              requests[key] = new_rep_factor;
-            }
-          }
-        }
-        change_replication_factor(requests, global_hash_ring_map, local_hash_ring_map, proxy_address, placement, pushers, mt, response_puller, logger, rid);
-        logger->info("number of keys to be promoted is {}", total_rep_to_change);
-        logger->info("available memory slot is {}", slot);
-        auto time_elapsed = chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now()-grace_start).count();
-        if (overflow && adding_memory_node == 0 && time_elapsed > GRACE_PERIOD) {
-          unsigned long long promote_data_size = total_rep_to_change * VALUE_SIZE;
-          unsigned total_memory_node_needed = ceil((total_memory_consumption + promote_data_size) / (MEM_CAPACITY_MAX * tier_data_map[1].node_capacity_));
-          if (total_memory_node_needed > memory_node_number) {
-            logger->info("memory node insufficient to promote keys!");
-            unsigned node_to_add = ceil(1.5 * (total_memory_node_needed - memory_node_number));
-            logger->info("trigger add {} memory node", to_string(node_to_add));
-            string shell_command = "curl -X POST http://" + management_address + "/add/memory/" + to_string(node_to_add) + " &";
-            system(shell_command.c_str());
-            adding_memory_node = node_to_add;
-          }
-        } else if (overflow) {
-          logger->info("in grace period or adding nodes");
-        }
-
-        requests.clear();
-        total_rep_to_change = 0;
-
-        // 3. check key access summary to demote cold keys to ebs tier
-        time_elapsed = chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now()-grace_start).count();
-        if (time_elapsed > GRACE_PERIOD) {
-          unsigned slot = (EBS_CAPACITY_MAX * tier_data_map[2].node_capacity_ * ebs_node_number - total_ebs_consumption) / VALUE_SIZE;
-          bool overflow = false;
-          for (auto it = key_access_summary.begin(); it != key_access_summary.end(); it++) {
-            string key = it->first;
-            unsigned total_access = it->second;
-            if (!is_metadata(key) && total_access < DEMOTE_THRESHOLD && placement[key].global_replication_map_[1] > 0) {
-              total_rep_to_change += 1;
-              if (total_rep_to_change > slot) {
-                overflow = true;
-              } else {
-                key_info new_rep_factor;
-                new_rep_factor.global_replication_map_[1] = 0;
-                new_rep_factor.global_replication_map_[2] = MINIMUM_REPLICA_NUMBER;
-                requests[key] = new_rep_factor;
-              }
-            }
-          }
-          change_replication_factor(requests, global_hash_ring_map, local_hash_ring_map, proxy_address, placement, pushers, mt, response_puller, logger, rid);
-          logger->info("number of keys to be demoted is {}", total_rep_to_change);
-          logger->info("available ebs slot is {}", slot);
-          if (overflow && adding_ebs_node == 0) {
-            unsigned long long demote_data_size = total_rep_to_change * VALUE_SIZE;
-            unsigned total_ebs_node_needed = ceil((total_ebs_consumption + demote_data_size) / (EBS_CAPACITY_MAX * tier_data_map[2].node_capacity_));
-            if (total_ebs_node_needed > ebs_node_number) {
-              logger->info("ebs node insufficient to demote keys!");
-              unsigned node_to_add = ceil(1.5 * (total_ebs_node_needed - ebs_node_number));
-              logger->info("trigger add {} ebs node", to_string(node_to_add));
-              string shell_command = "curl -X POST http://" + management_address + "/add/ebs/" + to_string(node_to_add) + " &";
-              system(shell_command.c_str());
-              adding_ebs_node = node_to_add;
-            }
-          } else if (overflow) {
-            logger->info("already adding ebs nodes");
-          }
-        } else {
-          logger->info("in grace period, not demoting keys");
-        }
-
-        requests.clear();
-        total_rep_to_change = 0;
-
-        // 4. check latency to see if the SLO has been violated
-        // 4.1 if latency is too high
-        if (avg_latency > SLO_WORST && adding_memory_node == 0) {
-          logger->info("latency is too high!");
-          // figure out if we should do hot key replication or add nodes
-          if (min_memory_occupancy > 0.08) {
-            // add nodes
-            logger->info("all nodes are busy, adding new nodes");
-            // trigger elasticity
-            auto time_elapsed = chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now()-grace_start).count();
-            if (time_elapsed > GRACE_PERIOD) {
-              logger->info("trigger add {} memory node", to_string(NODE_ADD));
-              string shell_command = "curl -X POST http://" + management_address + "/add/memory/" + to_string(NODE_ADD) + " &";
-              system(shell_command.c_str());
-              adding_memory_node = NODE_ADD;
-            } else {
-              logger->info("in grace period, not adding nodes");
-            }
-          } else {
-            // hot key replication
-            // find hot keys
-            logger->info("not all nodes are busy, finding hot keys...");
-            for (auto it = key_access_summary.begin(); it != key_access_summary.end(); it++) {
-              string key = it->first;
-              unsigned total_access = it->second;
-              if (!is_metadata(key) && total_access > HOT_KEY_THRESHOLD) {
-                logger->info("key {} accessed more than {} times. Accessed {} times", key, HOT_KEY_THRESHOLD, total_access);
-                if (memory_node_number - placement[key].global_replication_map_[1] > 0 && placement[key].global_replication_map_[2] > 0) {
-                  key_info new_rep_factor;
-                  new_rep_factor.global_replication_map_[1] = placement[key].global_replication_map_[1] + 1;
-                  new_rep_factor.global_replication_map_[2] = placement[key].global_replication_map_[2] - 1;
-                  requests[key] = new_rep_factor;
-                  logger->info("global hot key replication for key {}. M: {}->{}. E: {}->{}", key, placement[key].global_replication_map_[1], placement[key].global_replication_map_[1] + 1, placement[key].global_replication_map_[2], placement[key].global_replication_map_[2] - 1);
-                } else if (memory_node_number - placement[key].global_replication_map_[1] > 0 && placement[key].global_replication_map_[2] == 0) {
-                  key_info new_rep_factor;
-                  new_rep_factor.global_replication_map_[1] = placement[key].global_replication_map_[1] + 1;
-                  new_rep_factor.global_replication_map_[2] = placement[key].global_replication_map_[2];
-                  requests[key] = new_rep_factor;
-                  logger->info("global hot key replication for key {}. M: {}->{}. E: {}->{}", key, placement[key].global_replication_map_[1], placement[key].global_replication_map_[1] + 1, placement[key].global_replication_map_[2], placement[key].global_replication_map_[2]);
-                } else {
-                  logger->info("cannot perform hot key replication to key {} due to node limit", key);
-                }
-              }
-            }
-            change_replication_factor(requests, global_hash_ring_map, local_hash_ring_map, proxy_address, placement, pushers, mt, response_puller, logger, rid);
-          }
-        }
-        requests.clear();
-        logger->info("adding {} memory nodes in progress", adding_memory_node);
-        logger->info("adding {} ebs nodes in progress", adding_ebs_node);
-
-        // 4.2 if latency is too low, consider removing a memory node
-        if (avg_latency < SLO_BEST && !removing_memory_node && memory_node_number > max(required_memory_node, (unsigned)MINIMUM_MEMORY_NODE)) {
-          logger->info("latency is too low!");
-          auto time_elapsed = chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now()-grace_start).count();
-          if (time_elapsed > GRACE_PERIOD) {
-            // before sending remove command, first adjust relevant key's replication factor
-            for (auto it = key_access_summary.begin(); it != key_access_summary.end(); it++) {
-              string key = it->first;
-              if (!is_metadata(key) && placement[key].global_replication_map_[1] == (global_hash_ring_map[1].size() / VIRTUAL_THREAD_NUM)) {
-                key_info new_rep_factor;
-                new_rep_factor.global_replication_map_[1] = placement[key].global_replication_map_[1] - 1;
-                if (new_rep_factor.global_replication_map_[1] + placement[key].global_replication_map_[2] < MINIMUM_REPLICA_NUMBER) {
-                  new_rep_factor.global_replication_map_[2] = MINIMUM_REPLICA_NUMBER - new_rep_factor.global_replication_map_[1];
-                  if (new_rep_factor.global_replication_map_[2] > (global_hash_ring_map[2].size() / VIRTUAL_THREAD_NUM)) {
-                    logger->info("Error: number of ebs replica exceed number of ebs nodes");
-                  }
-                } else {
-                  new_rep_factor.global_replication_map_[2] = placement[key].global_replication_map_[2];
-                }
-                requests[key] = new_rep_factor;
-                logger->info("reduce replication for key {}. M: {}->{}. E: {}->{}", key, placement[key].global_replication_map_[1], new_rep_factor.global_replication_map_[1], placement[key].global_replication_map_[2], new_rep_factor.global_replication_map_[2]);
-              }
-            }
-            change_replication_factor(requests, global_hash_ring_map, local_hash_ring_map, proxy_address, placement, pushers, mt, response_puller, logger, rid);
-            // pick a random memory node and send remove node command
-            auto node = next(begin(global_hash_ring_map[1]), rand() % global_hash_ring_map[1].size())->second;
-            auto ip = node.get_ip();
-            auto connection_addr = node.get_self_depart_connect_addr();
-            departing_node_map[ip] = tier_data_map[1].thread_number_;
-            auto ack_addr = mt.get_depart_done_connect_addr();
-            logger->info("sending remove memory node msg");
-            zmq_util::send_string(ack_addr, &pushers[connection_addr]);
-            removing_memory_node = true;
-          } else {
-            logger->info("in grace period, not removing node");
-          }
-        }
-        requests.clear();
-
-        // 4.3 if latency is fine, check if there is underutilized memory node
-        if (avg_latency >= SLO_BEST && avg_latency <= SLO_WORST && !removing_memory_node && memory_node_number > max(required_memory_node, (unsigned)MINIMUM_MEMORY_NODE)) {
-          if (min_memory_occupancy < 0.02) {
-            logger->info("node {} is severely underutilized, consider removing", min_node_ip);
-            auto time_elapsed = chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now()-grace_start).count();
-            if (time_elapsed > GRACE_PERIOD) {
-              // before sending remove command, first adjust relevant key's replication factor
-              for (auto it = key_access_summary.begin(); it != key_access_summary.end(); it++) {
-                string key = it->first;
-                if (!is_metadata(key) && placement[key].global_replication_map_[1] == (global_hash_ring_map[1].size() / VIRTUAL_THREAD_NUM)) {
-                  key_info new_rep_factor;
-                  new_rep_factor.global_replication_map_[1] = placement[key].global_replication_map_[1] - 1;
-                  if (new_rep_factor.global_replication_map_[1] + placement[key].global_replication_map_[2] < MINIMUM_REPLICA_NUMBER) {
-                    new_rep_factor.global_replication_map_[2] = MINIMUM_REPLICA_NUMBER - new_rep_factor.global_replication_map_[1];
-                    if (new_rep_factor.global_replication_map_[2] > (global_hash_ring_map[2].size() / VIRTUAL_THREAD_NUM)) {
-                      logger->info("Error: number of ebs replica exceed number of ebs nodes");
-                    }
-                  } else {
-                    new_rep_factor.global_replication_map_[2] = placement[key].global_replication_map_[2];
-                  }
-                  requests[key] = new_rep_factor;
-                  logger->info("reduce replication for key {}. M: {}->{}. E: {}->{}", key, placement[key].global_replication_map_[1], new_rep_factor.global_replication_map_[1], placement[key].global_replication_map_[2], new_rep_factor.global_replication_map_[2]);
-                }
-              }
-              change_replication_factor(requests, global_hash_ring_map, local_hash_ring_map, proxy_address, placement, pushers, mt, response_puller, logger, rid);
-              // pick a random memory node and send remove node command
-              server_thread_t node = server_thread_t(min_node_ip, 0);
-              auto connection_addr = node.get_self_depart_connect_addr();
-              departing_node_map[min_node_ip] = tier_data_map[1].thread_number_;
-              auto ack_addr = mt.get_depart_done_connect_addr();
-              logger->info("sending remove memory node msg");
-              zmq_util::send_string(ack_addr, &pushers[connection_addr]);
-              removing_memory_node = true;
-            } else {
-              logger->info("in grace period");
-            }
-          }
-        }
-        requests.clear();
-
-        // finally, consider reducing the replication factor of some keys that are not so hot anymore
-        for (auto it = key_access_summary.begin(); it != key_access_summary.end(); it++) {
-          string key = it->first;
-          unsigned total_access = it->second;
-          if (!is_metadata(key) && total_access <= HOT_KEY_THRESHOLD && placement[key].global_replication_map_[1] > 1) {
-            logger->info("key {} accessed less than {} times. Accessed {} times", key, HOT_KEY_THRESHOLD, total_access);
-            key_info new_rep_factor;
-            new_rep_factor.global_replication_map_[1] = placement[key].global_replication_map_[1] - 1;
-            if (new_rep_factor.global_replication_map_[1] + placement[key].global_replication_map_[2] < MINIMUM_REPLICA_NUMBER) {
-              new_rep_factor.global_replication_map_[2] = MINIMUM_REPLICA_NUMBER - new_rep_factor.global_replication_map_[1];
-              if (new_rep_factor.global_replication_map_[2] > (global_hash_ring_map[2].size() / VIRTUAL_THREAD_NUM)) {
-                logger->info("Error: number of ebs replica exceed number of ebs nodes");
-              }
-            } else {
-              new_rep_factor.global_replication_map_[2] = placement[key].global_replication_map_[2];
-            }
-            requests[key] = new_rep_factor;
-            logger->info("reducing replication factor for key {}. M: {}->{}. E: {}->{}", key, placement[key].global_replication_map_[1], placement[key].global_replication_map_[1] - 1, placement[key].global_replication_map_[2], placement[key].global_replication_map_[2] + 1);
-          }
-        }
-        change_replication_factor(requests, global_hash_ring_map, local_hash_ring_map, proxy_address, placement, pushers, mt, response_puller, logger, rid);
-        requests.clear();
+      if (ENABLE_TIERING_POLICY && policy_start) {
+        policy_input input;
+        input.memory_node_number_ = global_hash_ring_map[1].size() / VIRTUAL_THREAD_NUM;
+        input.ebs_node_number_ = global_hash_ring_map[2].size() / VIRTUAL_THREAD_NUM;
+        input.memory_node_capacity_ = tier_data_map[1].node_capacity_;
+        input.ebs_node_capacity_ = tier_data_map[2].node_capacity_;
+        input.total_memory_consumption_ = total_memory_consumption;
+        input.total_ebs_consumption_ = total_ebs_consumption;
+        input.average_ebs_consumption_percentage_ = average_ebs_consumption_percentage;
+        input.min_memory_occupancy_ = min_memory_occupancy;
+        input.min_memory_node_ = min_node_ip;
+        input.avg_latency_ = avg_latency;
+        input.memory_latency_ = tier_latency[1];
+        input.ebs_latency_ = tier_latency[2];
+        input.grace_elapsed_ = chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now()-grace_start).count();
+
+        monitoring_executor executor(global_hash_ring_map, local_hash_ring_map, proxy_address, placement, pushers, mt, response_puller, key_access, departing_node_map, management, state, logger, rid);
+        run_tiering_policy(input, state, placement, key_access, executor, logger);
       } else {
         logger->info("policy not started");
-      }*/
+      }
 
       user_latency.clear();
       user_throughput.clear();
+      tier_queue_latency.clear();
+      tier_service_latency.clear();
+      tier_latency.clear();
       
       report_start = std::chrono::system_clock::now();
     }
@@ -0,0 +1,384 @@
+#include <zmq.hpp>
+#include <string>
+#include <stdlib.h>
+#include <sstream>
+#include <fstream>
+#include <vector>
+#include <map>
+#include <deque>
+#include <unordered_set>
+#include <iostream>
+#include <memory>
+#include <algorithm>
+#include "message.pb.h"
+#include "common.h"
+#include "access_counter.h"
+#include "access_aggregator.h"
+#include "tiering_policy.h"
+
+// Define the latency of a request served by an idle memory node (in microsecond)
+#define SIM_MEMORY_LATENCY 1000
+// Define the latency of a request served by an idle ebs node (in microsecond)
+#define SIM_EBS_LATENCY 4000
+// Define the number of requests per second a memory node serves
+#define SIM_MEMORY_NODE_THROUGHPUT 40000
+// Define the number of requests per second an ebs node serves
+#define SIM_EBS_NODE_THROUGHPUT 4000
+// Define the utilization at which a node's queue stops growing in the model
+#define SIM_MAX_UTILIZATION 0.95
+// Define the cost of running a node for an hour
+#define SIM_MEMORY_NODE_COST 1.0
+#define SIM_EBS_NODE_COST 0.25
+// Define the number of monitoring epochs a new node takes to join
+#define SIM_NODE_JOIN_DELAY 4
+
+using namespace std;
+
+// Replays an access trace against a model of the memory and ebs tiers and runs
+// the tiering policy on it once per monitoring epoch, as the monitoring node
+// would. Each epoch it prints the node count, latency, cost and data moved.
+// The SLO controller sees the model's p99 memory tier latency as if servers
+// had measured it.
+//
+// A trace has one line per key and epoch, "<epoch> <key> <access count>". With
+// no trace a synthetic zipfian workload is generated whose hot keys shift
+// halfway through. A trailing "predictive" runs the policy in predictive mode.
+
+// the simulated cluster
+struct sim_cluster {
+  sim_cluster() : memory_node_number_(0), ebs_node_number_(0), memory_consumption_(0), ebs_consumption_(0), time_(0) {}
+  unsigned memory_node_number_;
+  unsigned ebs_node_number_;
+  unsigned long long memory_consumption_;
+  unsigned long long ebs_consumption_;
+  // node joins due at an epoch: epoch -> (tier, number)
+  multimap<unsigned, pair<unsigned, unsigned>> joins_;
+  // node removals that complete next epoch, by tier
+  vector<unsigned> removals_;
+  // the simulated time (in second) and the time of the last node change
+  long long time_;
+  long long grace_start_;
+  unsigned long long moved_bytes_;
+  unsigned changed_keys_;
+};
+
+class sim_executor : public policy_executor {
+  sim_cluster& cluster_;
+  placement_map& placement_;
+  access_aggregator& key_access_;
+  unsigned epoch_;
+
+public:
+  sim_executor(sim_cluster& cluster, placement_map& placement, access_aggregator& key_access, unsigned epoch) :
+    cluster_(cluster), placement_(placement), key_access_(key_access), epoch_(epoch) {}
+
+  void change_replication_factor(unordered_map<string, key_info>& requests) {
+    for (auto it = requests.begin(); it != requests.end(); it++) {
+      key_info info = placement_.get(it->first);
+      for (unsigned tier = MIN_TIER; tier <= MAX_TIER; tier++) {
+        if (!it->second.has_global_replication(tier)) {
+          continue;
+        }
+        unsigned old_rep = info.global_replication(tier);
+        unsigned new_rep = it->second.global_replication(tier);
+        // every new replica is copied from an existing one
+        if (new_rep > old_rep) {
+          cluster_.moved_bytes_ += (unsigned long long) (new_rep - old_rep) * VALUE_SIZE;
+        }
+        unsigned long long& consumption = tier == 1 ? cluster_.memory_consumption_ : cluster_.ebs_consumption_;
+        consumption = consumption + (unsigned long long) new_rep * VALUE_SIZE - (unsigned long long) old_rep * VALUE_SIZE;
+        info.set_global_replication(tier, new_rep);
+      }
+      placement_.set(it->first, info);
+      key_access_.set_memory_replication(it->first, info.global_replication(1));
+      cluster_.changed_keys_ += 1;
+    }
+  }
+
+  void add_node(unsigned tier_id, unsigned number) {
+    cluster_.joins_.insert(make_pair(epoch_ + SIM_NODE_JOIN_DELAY, make_pair(tier_id, number)));
+  }
+
+  void remove_node(unsigned tier_id, const string& /*ip*/) {
+    cluster_.removals_.push_back(tier_id);
+  }
+};
+
+string sim_key(unsigned i) {
+  return string(8 - to_string(i).length(), '0') + to_string(i);
+}
+
+// generate the access counts of a zipfian workload over key_number keys
+void generate_trace(unsigned key_number, double zipf, unsigned epoch_number, unsigned requests_per_epoch, map<unsigned, unordered_map<string, unsigned>>& trace) {
+  vector<double> sum_probs(key_number + 1, 0);
+  double base = 0;
+  for (unsigned i = 1; i <= key_number; i++) {
+    base += pow((double) i, -zipf);
+  }
+  for (unsigned i = 1; i <= key_number; i++) {
+    sum_probs[i] = sum_probs[i - 1] + pow((double) i, -zipf) / base;
+  }
+  unsigned seed = 0;
+  for (unsigned epoch = 0; epoch < epoch_number; epoch++) {
+    // the popular keys move halfway through the trace
+    unsigned offset = epoch < epoch_number / 2 ? 0 : key_number / 2;
+    for (unsigned r = 0; r < requests_per_epoch; r++) {
+      double z = rand_r(&seed) / (static_cast<double>(RAND_MAX) + 1);
+      unsigned rank = lower_bound(sum_probs.begin() + 1, sum_probs.end(), z) - sum_probs.begin();
+      rank = min(rank, key_number);
+      trace[epoch][sim_key((rank - 1 + offset) % key_number + 1)] += 1;
+    }
+  }
+}
+
+// report the window's access counts the way a server thread does: its top
+// ACCESS_REPORT_TOP_K keys and a rotating sample of ACCESS_REPORT_COLD_NUMBER
+// cold keys. A key in neither list drops out of the aggregator, as when the
+// monitoring node applies a server's report
+void report_access(
+    const vector<string>& keys,
+    const unordered_map<string, unsigned>& window_total,
+    size_t& cold_cursor,
+    unordered_set<string>& reported,
+    access_aggregator& key_access,
+    const placement_map& placement) {
+  vector<pair<unsigned, const string*>> counts;
+  vector<const string*> cold;
+  for (auto it = keys.begin(); it != keys.end(); it++) {
+    auto total = window_total.find(*it);
+    unsigned count = total == window_total.end() ? 0 : total->second;
+    if (count < DEMOTE_THRESHOLD) {
+      cold.push_back(&*it);
+    } else {
+      counts.push_back(make_pair(count, &*it));
+    }
+  }
+  if (counts.size() > ACCESS_REPORT_TOP_K) {
+    nth_element(counts.begin(), counts.begin() + ACCESS_REPORT_TOP_K, counts.end(), greater<pair<unsigned, const string*>>());
+    counts.resize(ACCESS_REPORT_TOP_K);
+  }
+  if (cold.size() > 0) {
+    size_t cold_number = min(cold.size(), (size_t) ACCESS_REPORT_COLD_NUMBER);
+    size_t start = cold_cursor % cold.size();
+    for (size_t i = 0; i < cold_number; i++) {
+      counts.push_back(make_pair(0, cold[(start + i) % cold.size()]));
+    }
+    cold_cursor = start + cold_number;
+  }
+
+  unordered_set<string> current;
+  for (auto it = counts.begin(); it != counts.end(); it++) {
+    key_access.update("trace", *it->second, it->first, placement.get(*it->second).global_replication(1));
+    current.insert(*it->second);
+  }
+  for (auto it = reported.begin(); it != reported.end(); it++) {
+    if (current.find(*it) == current.end()) {
+      key_access.erase("trace", *it);
+    }
+  }
+  reported.swap(current);
+}
+
+bool read_trace(const string& path, map<unsigned, unordered_map<string, unsigned>>& trace) {
+  ifstream input(path);
+  if (!input.is_open()) {
+    return false;
+  }
+  string line;
+  while (getline(input, line)) {
+    istringstream fields(line);
+    unsigned epoch;
+    string key;
+    unsigned count;
+    if (fields >> epoch >> key >> count) {
+      trace[epoch][key] += count;
+    }
+  }
+  return true;
+}
+
+int main(int argc, char* argv[]) {
+  bool predictive = argc > 1 && string(argv[argc - 1]) == "predictive";
+  int arg_number = predictive ? argc - 1 : argc;
+  if (arg_number != 2 && arg_number != 5) {
+    cerr << "usage:" << argv[0] << " <trace file> [predictive]" << endl;
+    cerr << "usage:" << argv[0] << " <key number> <zipf> <epoch number> <requests per second> [predictive]" << endl;
+    return 1;
+  }
+
+  // the policy's reasoning goes to the log, the timeline to stdout
+  auto logger = spdlog::basic_logger_mt("simulator_logger", "simulator_log.txt", true);
+
+  map<unsigned, unordered_map<string, unsigned>> trace;
+  // every key of the trace, and the placement of the ones the policy changed
+  unordered_set<string> keys;
+  placement_map placement;
+  placement.set_default(default_key_info());
+  if (arg_number == 2) {
+    if (!read_trace(argv[1], trace)) {
+      cerr << "cannot read trace " << argv[1] << endl;
+      return 1;
+    }
+  } else {
+    unsigned key_number = stoi(argv[1]);
+    generate_trace(key_number, stod(argv[2]), stoi(argv[3]), stoi(argv[4]) * MONITORING_THRESHOLD, trace);
+    for (unsigned i = 1; i <= key_number; i++) {
+      keys.insert(sim_key(i));
+    }
+  }
+  if (trace.size() == 0) {
+    cerr << "empty trace" << endl;
+    return 1;
+  }
+  for (auto it = trace.begin(); it != trace.end(); it++) {
+    for (auto iter = it->second.begin(); iter != it->second.end(); iter++) {
+      keys.insert(iter->first);
+    }
+  }
+
+  sim_cluster cluster;
+  cluster.memory_node_number_ = MINIMUM_MEMORY_NODE;
+  cluster.ebs_node_number_ = max(MINIMUM_EBS_NODE, 1);
+  cluster.grace_start_ = 0;
+
+  // every key starts out with the default replication; the whole trace is
+  // reported as if by one server thread
+  policy_state state;
+  if (predictive) {
+    state.predictive_ = true;
+  }
+  access_aggregator key_access;
+  key_access.track_changes(state.predictive_);
+  for (auto it = keys.begin(); it != keys.end(); it++) {
+    cluster.memory_consumption_ += DEFAULT_GLOBAL_MEMORY_REPLICATION * VALUE_SIZE;
+    cluster.ebs_consumption_ += DEFAULT_GLOBAL_EBS_REPLICATION * VALUE_SIZE;
+  }
+  vector<string> key_list(keys.begin(), keys.end());
+  sort(key_list.begin(), key_list.end());
+  size_t cold_cursor = 0;
+  unordered_set<string> reported;
+
+  // the access counts of the epochs in the key monitoring window
+  unsigned window = max(KEY_MONITORING_THRESHOLD / MONITORING_THRESHOLD, 1);
+  deque<const unordered_map<string, unsigned>*> window_counts;
+  unordered_map<string, unsigned> window_total;
+  const unordered_map<string, unsigned> no_access;
+
+  double total_cost = 0;
+  unsigned long long total_moved_bytes = 0;
+  unsigned last_epoch = trace.rbegin()->first;
+
+  cout << "epoch\ttime\tmemory_nodes\tebs_nodes\tlatency\tmemory_p99\tcost\tmoved_bytes\tchanged_keys" << endl;
+  for (unsigned epoch = 0; epoch <= last_epoch; epoch++) {
+    cluster.time_ = (long long) epoch * MONITORING_THRESHOLD;
+    cluster.moved_bytes_ = 0;
+    cluster.changed_keys_ = 0;
+
+    // nodes requested earlier join, and removed nodes leave
+    for (auto it = cluster.joins_.begin(); it != cluster.joins_.end() && it->first <= epoch;) {
+      unsigned tier_id = it->second.first;
+      unsigned number = it->second.second;
+      if (tier_id == 1) {
+        cluster.memory_node_number_ += number;
+        state.adding_memory_node_ -= min(state.adding_memory_node_, number);
+      } else {
+        cluster.ebs_node_number_ += number;
+        state.adding_ebs_node_ -= min(state.adding_ebs_node_, number);
+      }
+      cluster.grace_start_ = cluster.time_;
+      it = cluster.joins_.erase(it);
+    }
+    for (auto it = cluster.removals_.begin(); it != cluster.removals_.end(); it++) {
+      if (*it == 1) {
+        cluster.memory_node_number_ -= 1;
+        state.removing_memory_node_ = false;
+      } else {
+        cluster.ebs_node_number_ -= 1;
+        state.removing_ebs_node_ = false;
+      }
+      cluster.grace_start_ = cluster.time_;
+    }
+    cluster.removals_.clear();
+
+    // slide the key monitoring window
+    auto trace_iter = trace.find(epoch);
+    const unordered_map<string, unsigned>& counts = trace_iter == trace.end() ? no_access : trace_iter->second;
+    for (auto it = counts.begin(); it != counts.end(); it++) {
+      window_total[it->first] += it->second;
+    }
+    window_counts.push_back(&counts);
+    if (window_counts.size() > window) {
+      const unordered_map<string, unsigned>* expired = window_counts.front();
+      window_counts.pop_front();
+      for (auto it = expired->begin(); it != expired->end(); it++) {
+        window_total[it->first] -= it->second;
+      }
+    }
+    report_access(key_list, window_total, cold_cursor, reported, key_access, placement);
+
+    // model each node as a queue: requests to a key are split over its
+    // replicas, and a replica's node is picked by hashing the key
+    vector<double> memory_load(cluster.memory_node_number_, 0);
+    vector<double> ebs_load(cluster.ebs_node_number_, 0);
+    for (auto it = counts.begin(); it != counts.end(); it++) {
+      const key_info& info = placement.get(it->first);
+      unsigned memory_rep = min(info.global_replication(1), cluster.memory_node_number_);
+      unsigned ebs_rep = min(info.global_replication(2), cluster.ebs_node_number_);
+      size_t h = hash<string>()(it->first);
+      if (memory_rep > 0) {
+        for (unsigned i = 0; i < memory_rep; i++) {
+          memory_load[(h + i) % memory_load.size()] += (double) it->second / memory_rep / MONITORING_THRESHOLD;
+        }
+      } else if (ebs_rep > 0) {
+        for (unsigned i = 0; i < ebs_rep; i++) {
+          ebs_load[(h + i) % ebs_load.size()] += (double) it->second / ebs_rep / MONITORING_THRESHOLD;
+        }
+      }
+    }
+    double total_latency = 0;
+    double total_requests = 0;
+    policy_input input;
+    for (unsigned i = 0; i < memory_load.size(); i++) {
+      double utilization = memory_load[i] / SIM_MEMORY_NODE_THROUGHPUT;
+      double latency = SIM_MEMORY_LATENCY / (1 - min(utilization, SIM_MAX_UTILIZATION));
+      total_latency += memory_load[i] * latency;
+      total_requests += memory_load[i];
+      input.memory_latency_.record(latency, memory_load[i] * MONITORING_THRESHOLD);
+      if (min(utilization, 1.0) < input.min_memory_occupancy_) {
+        input.min_memory_occupancy_ = min(utilization, 1.0);
+        input.min_memory_node_ = "memory-" + to_string(i);
+      }
+    }
+    for (unsigned i = 0; i < ebs_load.size(); i++) {
+      double utilization = ebs_load[i] / SIM_EBS_NODE_THROUGHPUT;
+      double latency = SIM_EBS_LATENCY / (1 - min(utilization, SIM_MAX_UTILIZATION));
+      total_latency += ebs_load[i] * latency;
+      total_requests += ebs_load[i];
+      input.ebs_latency_.record(latency, ebs_load[i] * MONITORING_THRESHOLD);
+    }
+    double avg_latency = total_requests > 0 ? total_latency / total_requests : 0;
+
+    input.memory_node_number_ = cluster.memory_node_number_;
+    input.ebs_node_number_ = cluster.ebs_node_number_;
+    input.memory_node_capacity_ = MEM_NODE_CAPACITY;
+    input.ebs_node_capacity_ = EBS_NODE_CAPACITY;
+    input.total_memory_consumption_ = cluster.memory_consumption_;
+    input.total_ebs_consumption_ = cluster.ebs_consumption_;
+    if (cluster.ebs_node_number_ > 0) {
+      input.average_ebs_consumption_percentage_ = (double) cluster.ebs_consumption_ / ((double) cluster.ebs_node_number_ * EBS_NODE_CAPACITY);
+    }
+    input.avg_latency_ = avg_latency;
+    input.grace_elapsed_ = cluster.time_ - cluster.grace_start_;
+
+    logger->info("simulating epoch {}", epoch);
+    sim_executor executor(cluster, placement, key_access, epoch);
+    run_tiering_policy(input, state, placement, key_access, executor, logger);
+
+    double cost = (cluster.memory_node_number_ * SIM_MEMORY_NODE_COST + cluster.ebs_node_number_ * SIM_EBS_NODE_COST) * MONITORING_THRESHOLD / 3600;
+    total_cost += cost;
+    total_moved_bytes += cluster.moved_bytes_;
+    cout << epoch << "\t" << cluster.time_ << "\t" << cluster.memory_node_number_ << "\t" << cluster.ebs_node_number_ << "\t" << avg_latency << "\t" << input.memory_latency_.percentile(0.99) << "\t" << cost << "\t" << cluster.moved_bytes_ << "\t" << cluster.changed_keys_ << endl;
+  }
+  cout << "total cost " << total_cost << ", total data moved " << total_moved_bytes << endl;
+  return 0;
+}
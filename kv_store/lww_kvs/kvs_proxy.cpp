@@ -15,6 +15,7 @@
 #include "zmq_util.h"
 #include "consistent_hash_map.hpp"
 #include "common.h"
+#include "thread_affinity.h"
 #include <boost/thread/locks.hpp>
 #include <boost/thread/shared_mutex.hpp>
 
@@ -23,7 +24,12 @@ using namespace std;
 // read-only per-tier metadata
 unordered_map<unsigned, tier_data> tier_data_map;
 
-void run(unsigned thread_id) {
+void run(unsigned thread_id, zmq::context_t* context, placement_table* placement) {
+
+  // pin before allocating anything so that this thread's memory is first
+  // touched on its local NUMA node
+  auto assignment = assign_core(thread_id);
+  bind_to_core(assignment);
 
   string log_file = "log_" + to_string(thread_id) + ".txt";
   string logger_name = "basic_logger_" + to_string(thread_id);
@@ -37,169 +43,128 @@ void run(unsigned thread_id) {
   unsigned seed = time(NULL);
   seed += thread_id;
 
-  // prepare the zmq context
-  zmq::context_t context(1);
-
-  SocketCache pushers(&context, ZMQ_PUSH);
+  logger->info(describe_assignment(thread_id, assignment));
 
-  unordered_map<string, key_info> placement;
-  // warm up for benchmark
-  warmup(placement);
+  SocketCache pushers(context, ZMQ_PUSH);
 
-  if (thread_id == 0) {
-    string ip_line;
-    ifstream address;
-    vector<string> monitoring_address;
+  string ip_line;
+  ifstream address;
+  vector<string> monitoring_address;
 
-    // read existing monitoring nodes
-    address.open("conf/proxy/monitoring_address.txt");
+  // read existing monitoring nodes
+  address.open("conf/proxy/monitoring_address.txt");
 
-    while (getline(address, ip_line)) {
-      logger->info("monitoring address is {}", ip_line);
-      monitoring_address.push_back(ip_line);
-    }
-    address.close();
-
-    // notify monitoring nodes
-    for (auto it = monitoring_address.begin(); it != monitoring_address.end(); it++) {
-      zmq_util::send_string("join:0:" + ip, &pushers[monitoring_thread_t(*it).get_notify_connect_addr()]);
-    }
+  while (getline(address, ip_line)) {
+    logger->info("monitoring address is {}", ip_line);
+    monitoring_address.push_back(ip_line);
   }
+  address.close();
+
+  monitoring_thread_t mt = monitoring_thread_t(monitoring_address[0]);
 
   // initialize hash ring maps
   unordered_map<unsigned, global_hash_t> global_hash_ring_map;
   unordered_map<unsigned, local_hash_t> local_hash_ring_map;
 
+  // other nodes only send join and depart messages to thread 0, which fans
+  // them out to the other threads over inproc
+  // responsible for both node join and departure
+  zmq::socket_t notify_puller(*context, ZMQ_PULL);
+  notify_puller.bind(thread_id == 0 ? pt.get_notify_bind_addr() : pt.get_notify_inproc_addr());
+
+  // thread 0 registers this proxy with the monitoring node, and every thread
+  // fetches the server list along with its membership epoch. The other
+  // threads only see the changes thread 0 forwards, so they wait until thread
+  // 0 has registered: their server list then already has this proxy's join,
+  // and every later change is forwarded to them
+  if (thread_id != 0) {
+    zmq_util::recv_string(&notify_puller);
+  }
+  zmq::socket_t membership_requester(*context, ZMQ_REQ);
+  membership_requester.connect(mt.get_membership_connect_addr());
+  communication::Membership registration;
+  if (thread_id == 0) {
+    communication::Membership_Delta* delta = registration.add_delta();
+    delta->set_epoch(0);
+    delta->set_join(true);
+    delta->set_tier_id(0);
+    delta->set_ip(ip);
+  }
+  communication::Address addresses = register_membership(registration, membership_requester);
+  if (thread_id == 0) {
+    // an empty membership message lets the other threads register
+    string serialized_registered = serialize_membership(vector<communication::Membership_Delta>());
+    for (unsigned tid = 1; tid < PROXY_THREAD_NUM; tid++) {
+      zmq_util::send_string(serialized_registered, &pushers[proxy_thread_t(ip, tid).get_notify_inproc_addr()]);
+    }
+  }
+  populate_hash_rings(addresses, global_hash_ring_map);
+  membership_log membership(addresses.ring_epoch());
+  logger->info("joined at membership epoch {}", membership.epoch());
+
   // pending events for asynchrony
   unordered_map<string, pair<chrono::system_clock::time_point, vector<pair<string, string>>>> pending_key_request_map;
 
   // form local hash rings
   for (auto it = tier_data_map.begin(); it != tier_data_map.end(); it++) {
-    for (unsigned tid = 0; tid < it->second.thread_number_; tid++) {
-      insert_to_hash_ring<local_hash_t>(local_hash_ring_map[it->first], ip, tid);
-    }
+    local_hash_ring_map[it->first] = local_hash_t(it->second.thread_number_);
   }
 
-  // responsible for sending existing server addresses to a new node (relevant to seed node)
-  zmq::socket_t addr_responder(context, ZMQ_REP);
-  addr_responder.bind(pt.get_seed_bind_addr());
-  // responsible for both node join and departure
-  zmq::socket_t notify_puller(context, ZMQ_PULL);
-  notify_puller.bind(pt.get_notify_bind_addr());
   // responsible for listening for key replication factor response
-  zmq::socket_t replication_factor_puller(context, ZMQ_PULL);
+  zmq::socket_t replication_factor_puller(*context, ZMQ_PULL);
   replication_factor_puller.bind(pt.get_replication_factor_bind_addr());
-  // responsible for handling key replication factor change requests from server nodes
-  zmq::socket_t replication_factor_change_puller(context, ZMQ_PULL);
-  replication_factor_change_puller.bind(pt.get_replication_factor_change_bind_addr());
   // responsible for handling key address request from users
-  zmq::socket_t key_address_puller(context, ZMQ_PULL);
+  zmq::socket_t key_address_puller(*context, ZMQ_PULL);
   key_address_puller.bind(pt.get_key_address_bind_addr());  
 
   vector<zmq::pollitem_t> pollitems = {
-    { static_cast<void *>(addr_responder), 0, ZMQ_POLLIN, 0 },
     { static_cast<void *>(notify_puller), 0, ZMQ_POLLIN, 0 },
     { static_cast<void *>(replication_factor_puller), 0, ZMQ_POLLIN, 0 },
-    { static_cast<void *>(replication_factor_change_puller), 0, ZMQ_POLLIN, 0 },
     { static_cast<void *>(key_address_puller), 0, ZMQ_POLLIN, 0 }
   };
 
-  auto start_time = chrono::system_clock::now();
-  auto start_time_ms = chrono::time_point_cast<std::chrono::milliseconds>(start_time);
-
-  auto value = start_time_ms.time_since_epoch();
-  unsigned long long duration = value.count();
+  // responsible for handling key replication factor change requests from
+  // server nodes; only thread 0 receives them, since the placement is shared
+  unique_ptr<zmq::socket_t> replication_factor_change_puller;
+  if (thread_id == 0) {
+    replication_factor_change_puller.reset(new zmq::socket_t(*context, ZMQ_PULL));
+    replication_factor_change_puller->bind(pt.get_replication_factor_change_bind_addr());
+    pollitems.push_back({ static_cast<void *>(*replication_factor_change_puller), 0, ZMQ_POLLIN, 0 });
+  }
 
   while (true) {
     zmq_util::poll(-1, &pollitems);
 
-    // only relavant for the seed node
+    // handle membership changes sequenced by the monitoring node
     if (pollitems[0].revents & ZMQ_POLLIN) {
-      logger->info("Received an address request");
-      zmq_util::recv_string(&addr_responder);
-
-      communication::Address address;
-      address.set_start_time(duration);
-      for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
-        unsigned tier_id = it->first;
-        auto hash_ring = &(it->second);
-        unordered_set<string> observed_ip;
-        for (auto iter = hash_ring->begin(); iter != hash_ring->end(); iter++) {
-          if (observed_ip.find(iter->second.get_ip()) == observed_ip.end()) {
-            communication::Address_Tuple* tp = address.add_tuple();
-            tp->set_tier_id(tier_id);
-            tp->set_ip(iter->second.get_ip());
-            observed_ip.insert(iter->second.get_ip());
-          }
-        }
-      }
-
-      string serialized_address;
-      address.SerializeToString(&serialized_address);
-      zmq_util::send_string(serialized_address, &addr_responder);
-    }
-
-    // handle a join or depart event coming from the server side
-    if (pollitems[1].revents & ZMQ_POLLIN) {
       string message = zmq_util::recv_string(&notify_puller);
+      communication::Membership update;
+      update.ParseFromString(message);
+      // apply the deltas in epoch order; duplicates and stale deltas are dropped
+      auto applied = apply_membership(update, membership, global_hash_ring_map);
+      for (auto it = applied.begin(); it != applied.end(); it++) {
+        log_membership_delta(logger, *it);
+      }
 
-      vector<string> v;
-      split(message, ':', v);
-      string type = v[0];
-      unsigned tier = stoi(v[1]);
-      string new_server_ip = v[2];
-      if (type == "join") {
-        logger->info("received join");
-        logger->info("new server ip is {}", new_server_ip);
-        logger->info("tier id is {}", to_string(tier));
-        // update hash ring
-        bool inserted = insert_to_hash_ring<global_hash_t>(global_hash_ring_map[tier], new_server_ip, 0);
-        // 
-        if (inserted) {
-          if (thread_id == 0) {
-            // gossip the new node address between server nodes to ensure consistency
-            for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
-              unsigned tier_id = it->first;
-              auto hash_ring = &(it->second);
-              unordered_set<string> observed_ip;
-              for (auto iter = hash_ring->begin(); iter != hash_ring->end(); iter++) {
-                if (iter->second.get_ip().compare(new_server_ip) != 0 && observed_ip.find(iter->second.get_ip()) == observed_ip.end()) {
-                  // if the node is not the newly joined node, send the ip of the newly joined node
-                  zmq_util::send_string(to_string(tier) + ":" + new_server_ip, &pushers[(iter->second).get_node_join_connect_addr()]);
-                  observed_ip.insert(iter->second.get_ip());
-                }
-              }
-            }
-            // tell all worker threads about the message
-            for (unsigned tid = 1; tid < PROXY_THREAD_NUM; tid++) {
-              zmq_util::send_string(message, &pushers[proxy_thread_t(ip, tid).get_notify_connect_addr()]);
-            }
-          }
-        }
-
-        for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
-          logger->info("hash ring for tier {} size is {}", to_string(it->first), to_string(it->second.size()));
-        }
-      } else if (type == "depart") {
-        logger->info("received depart");
-        logger->info("departing server ip is {}", new_server_ip);
-        // update hash ring
-        remove_from_hash_ring<global_hash_t>(global_hash_ring_map[tier], new_server_ip, 0);
-
-        if (thread_id == 0) {
-          // tell all worker threads about the message
+      if (thread_id == 0) {
+        if (applied.size() > 0) {
+          // tell all worker threads about the changes
+          string serialized_applied = serialize_membership(applied);
           for (unsigned tid = 1; tid < PROXY_THREAD_NUM; tid++) {
-            zmq_util::send_string(message, &pushers[proxy_thread_t(ip, tid).get_notify_connect_addr()]);
+            zmq_util::send_string(serialized_applied, &pushers[proxy_thread_t(ip, tid).get_notify_inproc_addr()]);
+          }
+          for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
+            logger->info("hash ring for tier {} size is {}", to_string(it->first), to_string(it->second.size()));
           }
         }
-
-        for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
-          logger->info("hash ring for tier {} size is {}", to_string(it->first), to_string(it->second.size()));
+        // a delta arrived ahead of one that was lost, so fetch the missing ones
+        if (membership.has_gap()) {
+          sync_membership(membership.newest_epoch(), membership, pt.get_notify_connect_addr(), mt, pushers);
         }
       }
     }
 
-    if (pollitems[2].revents & ZMQ_POLLIN) {
+    if (pollitems[1].revents & ZMQ_POLLIN) {
       // received replication factor response
       string serialized_response = zmq_util::recv_string(&replication_factor_puller);
       communication::Response response;
@@ -207,14 +172,15 @@ void run(unsigned thread_id) {
       vector<string> tokens;
       split(response.tuple(0).key(), '_', tokens);
       string key = tokens[0];
+      unordered_map<string, key_info> changes;
       if (response.tuple(0).err_number() == 0) {
         communication::Replication_Factor rep_data;
         rep_data.ParseFromString(response.tuple(0).value());
         for (int i = 0; i < rep_data.global_size(); i++) {
-          placement[key].global_replication_map_[rep_data.global(i).tier_id()] = rep_data.global(i).global_replication();
+          changes[key].set_global_replication(rep_data.global(i).tier_id(), rep_data.global(i).global_replication());
         }
         for (int i = 0; i < rep_data.local_size(); i++) {
-          placement[key].local_replication_map_[rep_data.local(i).ip()] = rep_data.local(i).local_replication();
+          changes[key].set_local_replication(rep_data.local(i).ip(), rep_data.local(i).local_replication());
         }
       } else if (response.tuple(0).err_number() == 2) {
         logger->info("Retrying rep factor query for key {}", key);
@@ -222,28 +188,32 @@ void run(unsigned thread_id) {
         issue_replication_factor_request(respond_address, key, global_hash_ring_map[1], local_hash_ring_map[1], pushers, seed);
       } else {
         for (unsigned i = MIN_TIER; i <= MAX_TIER; i++) {
-          placement[key].global_replication_map_[i] = tier_data_map[i].default_replication_;
+          changes[key].set_global_replication(i, tier_data_map[i].default_replication_);
         }
       }
+      placement->merge(changes);
 
       if (response.tuple(0).err_number() != 2) {
         // process pending key address requests
         if (pending_key_request_map.find(key) != pending_key_request_map.end()) {
+          placement_table::read_guard guard(*placement, thread_id);
           bool succeed;
           vector<unsigned> tier_ids;
+          key_hash_t key_hash = get_key_hash(key);
           // first check memory tier
           tier_ids.push_back(1);
-          auto threads = get_responsible_threads(pt.get_replication_factor_connect_addr(), key, false, global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+          auto threads = get_responsible_threads(pt.get_replication_factor_connect_addr(), key, key_hash, global_hash_ring_map, local_hash_ring_map, *placement, pushers, tier_ids, succeed, seed);
           if (succeed) {
             if (threads.size() == 0) {
               tier_ids.clear();
               // check ebs tier
               tier_ids.push_back(2);
-              threads = get_responsible_threads(pt.get_replication_factor_connect_addr(), key, false, global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+              threads = get_responsible_threads(pt.get_replication_factor_connect_addr(), key, key_hash, global_hash_ring_map, local_hash_ring_map, *placement, pushers, tier_ids, succeed, seed);
             }
             for (auto it = pending_key_request_map[key].second.begin(); it != pending_key_request_map[key].second.end(); it++) {
               communication::Key_Response key_res;
               key_res.set_response_id(it->second);
+              key_res.set_ring_epoch(membership.epoch());
               communication::Key_Response_Tuple* tp = key_res.add_tuple();
               tp->set_key(key);
               for (auto iter = threads.begin(); iter != threads.end(); iter++) {
@@ -262,54 +232,56 @@ void run(unsigned thread_id) {
       }
     }
 
-    if (pollitems[3].revents & ZMQ_POLLIN) {
+    if (thread_id == 0 && pollitems[3].revents & ZMQ_POLLIN) {
       logger->info("received replication factor change");
-      string serialized_req = zmq_util::recv_string(&replication_factor_change_puller);
-
-      if (thread_id == 0) {
-        // tell all worker threads about the replication factor change
-        for (unsigned tid = 1; tid < PROXY_THREAD_NUM; tid++) {
-          zmq_util::send_string(serialized_req, &pushers[proxy_thread_t(ip, tid).get_replication_factor_change_connect_addr()]);
-        }
-      }
-
       communication::Replication_Factor_Request req;
-      req.ParseFromString(serialized_req);
+      req.ParseFromString(zmq_util::recv_string(replication_factor_change_puller.get()));
 
+      unordered_map<string, key_info> changes;
       for (int i = 0; i < req.tuple_size(); i++) {
         string key = req.tuple(i).key();
         // update the replication factor
         for (int j = 0; j < req.tuple(i).global_size(); j++) {
-          placement[key].global_replication_map_[req.tuple(i).global(j).tier_id()] = req.tuple(i).global(j).global_replication();
+          changes[key].set_global_replication(req.tuple(i).global(j).tier_id(), req.tuple(i).global(j).global_replication());
         }
         for (int j = 0; j < req.tuple(i).local_size(); j++) {
-          placement[key].local_replication_map_[req.tuple(i).local(j).ip()] = req.tuple(i).local(j).local_replication();
+          changes[key].set_local_replication(req.tuple(i).local(j).ip(), req.tuple(i).local(j).local_replication());
         }
       }
+      // applied once for all worker threads
+      placement->merge(changes);
     }
 
-    if (pollitems[4].revents & ZMQ_POLLIN) {
+    if (pollitems[2].revents & ZMQ_POLLIN) {
       //cerr << "received key address request\n";
       string serialized_key_req = zmq_util::recv_string(&key_address_puller);
       communication::Key_Request key_req;
       key_req.ParseFromString(serialized_key_req);
 
+      // the client has seen membership changes this proxy has not
+      if (key_req.has_ring_epoch()) {
+        sync_membership(key_req.ring_epoch(), membership, proxy_thread_t(ip, 0).get_notify_connect_addr(), mt, pushers);
+      }
+
       communication::Key_Response key_res;
       key_res.set_response_id(key_req.request_id());
+      key_res.set_ring_epoch(membership.epoch());
       bool succeed;
 
+      placement_table::read_guard guard(*placement, thread_id);
       for (int i = 0; i < key_req.keys_size(); i++) {
         vector<unsigned> tier_ids;
         // first check memory tier
         tier_ids.push_back(1);
         string key = key_req.keys(i);
-        auto threads = get_responsible_threads(pt.get_replication_factor_connect_addr(), key, false, global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+        key_hash_t key_hash = get_key_hash(key);
+        auto threads = get_responsible_threads(pt.get_replication_factor_connect_addr(), key, key_hash, global_hash_ring_map, local_hash_ring_map, *placement, pushers, tier_ids, succeed, seed);
         if (succeed) {
           if (threads.size() == 0) {
             tier_ids.clear();
             // check ebs tier
             tier_ids.push_back(2);
-            threads = get_responsible_threads(pt.get_replication_factor_connect_addr(), key, false, global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+            threads = get_responsible_threads(pt.get_replication_factor_connect_addr(), key, key_hash, global_hash_ring_map, local_hash_ring_map, *placement, pushers, tier_ids, succeed, seed);
           }
           communication::Key_Response_Tuple* tp = key_res.add_tuple();
           tp->set_key(key);
@@ -354,11 +326,27 @@ int main(int argc, char* argv[]) {
   tier_data_map[1] = tier_data(MEMORY_THREAD_NUM, DEFAULT_GLOBAL_MEMORY_REPLICATION, MEM_NODE_CAPACITY);
   tier_data_map[2] = tier_data(EBS_THREAD_NUM, DEFAULT_GLOBAL_EBS_REPLICATION, EBS_NODE_CAPACITY);
 
+  // the zmq context is shared by all worker threads, so its I/O threads are
+  // kept on the NUMA node of thread 0. zmq only starts them when the first
+  // socket is created, which would otherwise happen after the creating thread
+  // is bound to its core, so a throwaway socket starts them while this thread
+  // is bound to the whole node
+  bind_to_node(assign_core(0));
+  zmq::context_t context((PROXY_THREAD_NUM + WORKERS_PER_IO_THREAD - 1) / WORKERS_PER_IO_THREAD);
+  {
+    zmq::socket_t io_thread_starter(context, ZMQ_PUSH);
+  }
+
+  // one placement table read by all worker threads; it only holds the keys
+  // whose replication differs from the default
+  placement_table placement(PROXY_THREAD_NUM);
+  placement.set_default(default_key_info());
+
   vector<thread> proxy_worker_threads;
 
   for (unsigned thread_id = 1; thread_id < PROXY_THREAD_NUM; thread_id++) {
-    proxy_worker_threads.push_back(thread(run, thread_id));
+    proxy_worker_threads.push_back(thread(run, thread_id, &context, &placement));
   }
 
-  run(0);
+  run(0, &context, &placement);
 }
\ No newline at end of file
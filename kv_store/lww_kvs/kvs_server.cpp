@@ -18,6 +18,7 @@
 #include "zmq_util.h"
 #include "consistent_hash_map.hpp"
 #include "common.h"
+#include "thread_affinity.h"
 #include "server_utility.h"
 
 // TODO: Everything that's currently writing to cout and cerr should be replaced with a logfile.
@@ -42,31 +43,62 @@ pair<RC_KVS_PairLattice<string>, unsigned> process_get(const string& key, Serial
 }
 
 void process_put(const string& key,
+    key_hash_t key_hash,
     const unsigned long long& timestamp,
     const string& value,
     Serializer* serializer,
-    unordered_map<string, key_stat>& key_stat_map) {
+    unordered_map<string, key_stat>& key_stat_map,
+    const unordered_set<server_thread_t, thread_hash>& threads,
+    const server_thread_t& wt,
+    replica_tree_map& replica_trees) {
+  auto existing = key_stat_map.find(key);
+  bool existed = existing != key_stat_map.end();
+  unsigned long long old_timestamp = existed ? existing->second.timestamp_ : 0;
   if (serializer->put(key, value, timestamp)) {
     // update value size if the value is replaced
-    key_stat_map[key].size_ = value.size();
+    key_stat& stat = key_stat_map[key];
+    stat.size_ = value.size();
+    stat.hash_ = key_hash;
+    // the serializers keep the timestamp as an unsigned int
+    stat.timestamp_ = (unsigned) timestamp;
+    // fold the new version into the trees shared with the other replicas
+    for (auto it = threads.begin(); it != threads.end(); it++) {
+      if (it->get_id() == wt.get_id()) {
+        continue;
+      }
+      auto tree = replica_trees.find(it->get_gossip_connect_addr());
+      if (tree != replica_trees.end()) {
+        if (existed) {
+          tree->second.update(key_hash, old_timestamp, stat.timestamp_);
+        } else {
+          tree->second.toggle(key_hash, stat.timestamp_);
+        }
+      }
+    }
   }
 }
 
 communication::Response process_request(
     communication::Request& req,
-    unordered_set<string>& local_changeset,
+    change_set& local_changeset,
     Serializer* serializer,
     server_thread_t& wt,
     unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
     unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
-    unordered_map<string, key_info>& placement,
+    placement_map& placement,
     SocketCache& pushers,
     unordered_map<string, key_stat>& key_stat_map,
-    unordered_map<string, multiset<std::chrono::time_point<std::chrono::system_clock>>>& key_access_timestamp,
+    unordered_map<string, access_counter>& key_access_map,
     chrono::system_clock::time_point& start_time,
     unordered_map<string, pair<chrono::system_clock::time_point, vector<pending_request>>>& pending_request_map,
-    unsigned& seed) {
+    replica_tree_map& replica_trees,
+    unsigned& seed,
+    unsigned long long ring_epoch,
+    const chrono::system_clock::time_point& arrival) {
   communication::Response response;
+  // lets the sender tell whether the addresses in an error response are newer
+  // than the ones it used
+  response.set_ring_epoch(ring_epoch);
   string respond_id = "";
   if (req.has_request_id()) {
     respond_id = req.request_id();
@@ -79,9 +111,10 @@ communication::Response process_request(
     //cout << "received get by thread " << thread_id << "\n";
     for (int i = 0; i < req.tuple_size(); i++) {
       string key = req.tuple(i).key();
+      key_hash_t key_hash = get_key_hash(req.tuple(i));
       //cerr << "received get by thread " + to_string(wt.get_tid()) + " on key " + req.tuple(i).key() + "\n";
       // first check if the thread is responsible for the key
-      auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+      auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, key_hash, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
       if (succeed) {
         if (threads.find(wt) == threads.end()) {
           //cerr << "wrong address by thread " + to_string(wt.get_tid()) + " on key " + req.tuple(i).key() + "\n";
@@ -96,7 +129,7 @@ communication::Response process_request(
             if (pending_request_map.find(key) == pending_request_map.end()) {
               pending_request_map[key].first = chrono::system_clock::now();
             }
-            pending_request_map[key].second.push_back(pending_request("G", val, req.respond_address(), respond_id));
+            pending_request_map[key].second.push_back(pending_request("G", val, req.respond_address(), respond_id, arrival));
           }
         } else {
           communication::Response_Tuple* tp = response.add_tuple();
@@ -109,23 +142,24 @@ communication::Response process_request(
             tp->set_invalidate(true);
           }
           //cerr << "error number is " + to_string(res.second) + "\n";
-          key_access_timestamp[key].insert(std::chrono::system_clock::now());
+          key_access_map[key].record();
         }
       } else {
         string val = "";
         if (pending_request_map.find(key) == pending_request_map.end()) {
           pending_request_map[key].first = chrono::system_clock::now();
         }
-        pending_request_map[key].second.push_back(pending_request("G", val, req.respond_address(), respond_id));
+        pending_request_map[key].second.push_back(pending_request("G", val, req.respond_address(), respond_id, arrival));
       }
     }
   } else if (req.type() == "PUT") {
     //cout << "received put by thread " << thread_id << "\n";
     for (int i = 0; i < req.tuple_size(); i++) {
       string key = req.tuple(i).key();
+      key_hash_t key_hash = get_key_hash(req.tuple(i));
       //cerr << "received put by thread " + to_string(wt.get_tid()) + " on key " + req.tuple(i).key() + "\n";
       // first check if the thread is responsible for the key
-      auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+      auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, key_hash, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
       if (succeed) {
         if (threads.find(wt) == threads.end()) {
           //cerr << "wrong address by thread " + to_string(wt.get_tid()) + " on key " + req.tuple(i).key() + "\n";
@@ -140,9 +174,9 @@ communication::Response process_request(
               pending_request_map[key].first = chrono::system_clock::now();
             }
             if (req.has_respond_address()) {
-              pending_request_map[key].second.push_back(pending_request("P", req.tuple(i).value(), req.respond_address(), respond_id));
+              pending_request_map[key].second.push_back(pending_request("P", req.tuple(i).value(), req.respond_address(), respond_id, arrival));
             } else {
-              pending_request_map[key].second.push_back(pending_request("P", req.tuple(i).value(), "", respond_id));
+              pending_request_map[key].second.push_back(pending_request("P", req.tuple(i).value(), "", respond_id, arrival));
             }
           }
         } else {
@@ -151,22 +185,22 @@ communication::Response process_request(
           tp->set_key(key);
           auto current_time = chrono::system_clock::now();
           auto ts = generate_timestamp(chrono::duration_cast<chrono::milliseconds>(current_time-start_time).count(), wt.get_tid());
-          process_put(key, ts, req.tuple(i).value(), serializer, key_stat_map);
+          process_put(key, key_hash, ts, req.tuple(i).value(), serializer, key_stat_map, threads, wt, replica_trees);
           tp->set_err_number(0);
           if (req.tuple(i).has_num_address() && req.tuple(i).num_address() != threads.size()) {
             tp->set_invalidate(true);
           }
-          key_access_timestamp[key].insert(std::chrono::system_clock::now());
-          local_changeset.insert(key);
+          key_access_map[key].record();
+          local_changeset.insert(key, req.tuple(i).value().size());
         }
       } else {
         if (pending_request_map.find(key) == pending_request_map.end()) {
           pending_request_map[key].first = chrono::system_clock::now();
         }
         if (req.has_respond_address()) {
-          pending_request_map[key].second.push_back(pending_request("P", req.tuple(i).value(), req.respond_address(), respond_id));
+          pending_request_map[key].second.push_back(pending_request("P", req.tuple(i).value(), req.respond_address(), respond_id, arrival));
         } else {
-          pending_request_map[key].second.push_back(pending_request("P", req.tuple(i).value(), "", respond_id));
+          pending_request_map[key].second.push_back(pending_request("P", req.tuple(i).value(), "", respond_id, arrival));
         }
       }
     }
@@ -179,12 +213,15 @@ void process_gossip(
     server_thread_t& wt,
     unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
     unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
-    unordered_map<string, key_info>& placement,
+    placement_map& placement,
     SocketCache& pushers,
     Serializer* serializer,
     unordered_map<string, key_stat>& key_stat_map,
     unordered_map<string, pair<chrono::system_clock::time_point, vector<pending_gossip>>>& pending_gossip_map,
-    unsigned& seed) {
+    replica_tree_map& replica_trees,
+    transfer_receiver& receiver,
+    unsigned& seed,
+    unsigned long long ring_epoch) {
   vector<unsigned> tier_ids;
   tier_ids.push_back(SELF_TIER_ID);
   bool succeed;
@@ -193,18 +230,20 @@ void process_gossip(
   for (int i = 0; i < gossip.tuple_size(); i++) {
     // first check if the thread is responsible for the key
     string key = gossip.tuple(i).key();
-    auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+    key_hash_t key_hash = get_key_hash(gossip.tuple(i));
+    auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, key_hash, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
     if (succeed) {
       if (threads.find(wt) != threads.end()) {
-        process_put(gossip.tuple(i).key(), gossip.tuple(i).timestamp(), gossip.tuple(i).value(), serializer, key_stat_map);
+        process_put(key, key_hash, gossip.tuple(i).timestamp(), gossip.tuple(i).value(), serializer, key_stat_map, threads, wt, replica_trees);
       } else {
         if (is_metadata(key)) {
         // forward the gossip
           for (auto it = threads.begin(); it != threads.end(); it++) {
             if (gossip_map.find(it->get_gossip_connect_addr()) == gossip_map.end()) {
               gossip_map[it->get_gossip_connect_addr()].set_type("PUT");
+              gossip_map[it->get_gossip_connect_addr()].set_ring_epoch(ring_epoch);
             }
-            prepare_put_tuple(gossip_map[it->get_gossip_connect_addr()], key, gossip.tuple(i).value(), gossip.tuple(i).timestamp());
+            prepare_put_tuple(gossip_map[it->get_gossip_connect_addr()], key, key_hash, gossip.tuple(i).value(), gossip.tuple(i).timestamp());
           }
         } else {
           issue_replication_factor_request(wt.get_replication_factor_connect_addr(), key, global_hash_ring_map[1], local_hash_ring_map[1], pushers, seed);
@@ -225,29 +264,404 @@ void process_gossip(
   for (auto it = gossip_map.begin(); it != gossip_map.end(); it++) {
     push_request(it->second, pushers[it->first]);
   }
+  // a chunk of a rebalancing transfer; the ack lets the sender send another.
+  // Acks are cumulative, so a chunk after a lost one is not acknowledged
+  unsigned received;
+  if (gossip.has_transfer_id() && receiver.receive(gossip.transfer_id(), gossip.transfer_acked(), gossip.transfer_begin(), gossip.transfer_end(), received)) {
+    communication::Transfer_Ack ack;
+    ack.set_transfer_id(gossip.transfer_id());
+    ack.set_seq(gossip.transfer_seq());
+    ack.set_credit(1);
+    ack.set_received(received);
+    string serialized_ack;
+    ack.SerializeToString(&serialized_ack);
+    zmq_util::send_string(serialized_ack, &pushers[gossip.transfer_ack_address()]);
+  }
 }
 
-void send_gossip(address_keyset_map& addr_keyset_map, SocketCache& pushers, Serializer* serializer) {
-  unordered_map<string, communication::Request> gossip_map;
+void send_gossip(key_address_list& key_addresses, SocketCache& pushers, Serializer* serializer, unordered_map<string, key_stat>& key_stat_map, unsigned long long ring_epoch) {
+  // group the keys by the set of addresses they go to, so that every key is
+  // read and serialized once however many replicas it has
+  sort(key_addresses.begin(), key_addresses.end());
+  key_addresses.erase(unique(key_addresses.begin(), key_addresses.end()), key_addresses.end());
+  map<vector<string>, communication::Request> gossip_map;
+  vector<string> addresses;
+
+  for (auto it = key_addresses.begin(); it != key_addresses.end();) {
+    const string& key = it->first;
+    addresses.clear();
+    for (; it != key_addresses.end() && it->first == key; it++) {
+      addresses.push_back(it->second);
+    }
+    auto res = process_get(key, serializer);
+    if (res.second == 0) {
+      //cerr << "gossiping key " + key + "\n";
+      auto stat = key_stat_map.find(key);
+      key_hash_t key_hash = stat != key_stat_map.end() ? stat->second.hash_ : get_key_hash(key);
+      communication::Request& gossip = gossip_map[addresses];
+      if (gossip.tuple_size() == 0) {
+        gossip.set_type("PUT");
+        gossip.set_ring_epoch(ring_epoch);
+      }
+      prepare_put_tuple(gossip, key, key_hash, res.first.reveal().value, res.first.reveal().timestamp);
+    }
+  }
+  // send gossip; all destinations of a group share one encoded message
+  for (auto it = gossip_map.begin(); it != gossip_map.end(); it++) {
+    auto serialized_gossip = make_shared<string>();
+    it->second.SerializeToString(serialized_gossip.get());
+    for (auto iter = it->first.begin(); iter != it->first.end(); iter++) {
+      zmq_util::send_shared_string(serialized_gossip, &pushers[*iter]);
+    }
+  }
+}
 
-  for (auto map_it = addr_keyset_map.begin(); map_it != addr_keyset_map.end(); map_it++) {
-    gossip_map[map_it->first].set_type("PUT");
-    for (auto set_it = map_it->second.begin(); set_it != map_it->second.end(); set_it++) {
-      auto res = process_get(*set_it, serializer);
+// queue a key to be streamed to destination; if drop is set, the key is removed
+// from this thread once every destination it was queued for has acknowledged it
+void queue_transfer(
+    const string& key,
+    const server_thread_t& destination,
+    bool drop,
+    transfer_map& transfers,
+    unordered_map<string, unsigned>& removal_refs,
+    server_thread_t& wt,
+    unsigned long long& transfer_count) {
+  string address = destination.get_gossip_connect_addr();
+  auto transfer = transfers.find(address);
+  if (transfer == transfers.end()) {
+    transfer = transfers.emplace(address, key_transfer(destination, wt.get_id() + "_" + to_string(transfer_count))).first;
+    transfer_count += 1;
+  }
+  transfer->second.keys_.push_back(make_pair(key, drop));
+  if (drop) {
+    removal_refs[key] += 1;
+  }
+}
+
+// send the next chunk of every transfer that has credit left, as far as the
+// bandwidth cap allows; a transfer whose
+// receiver has not acknowledged anything for TRANSFER_TIMEOUT resumes from the
+// last acknowledged chunk
+void send_transfer_chunks(
+    transfer_map& transfers,
+    transfer_rate_limiter& limiter,
+    SocketCache& pushers,
+    Serializer* serializer,
+    unordered_map<string, key_stat>& key_stat_map,
+    server_thread_t& wt,
+    unsigned long long ring_epoch,
+    shared_ptr<spdlog::logger> logger) {
+  auto now = chrono::system_clock::now();
+  for (auto it = transfers.begin(); it != transfers.end(); it++) {
+    key_transfer& transfer = it->second;
+    if (transfer.in_flight_.size() > 0 && now - transfer.last_progress_ >= chrono::seconds(TRANSFER_TIMEOUT)) {
+      logger->info("Resuming transfer {} from key {} of {}", transfer.id_, to_string(transfer.acked_), to_string(transfer.keys_.size()));
+      transfer.sent_ = transfer.acked_;
+      transfer.in_flight_.clear();
+      transfer.credit_ = TRANSFER_WINDOW;
+    }
+    if (transfer.credit_ == 0 || transfer.sent_ == transfer.keys_.size()) {
+      continue;
+    }
+    if (!limiter.ready(now)) {
+      break;
+    }
+    if (transfer.in_flight_.size() == 0) {
+      transfer.last_progress_ = now;
+    }
+
+    communication::Request chunk;
+    chunk.set_type("PUT");
+    chunk.set_ring_epoch(ring_epoch);
+    chunk.set_transfer_id(transfer.id_);
+    chunk.set_transfer_seq(transfer.next_seq_);
+    chunk.set_transfer_ack_address(wt.get_transfer_ack_connect_addr());
+    unsigned begin = transfer.sent_;
+    unsigned long long bytes = 0;
+    while (transfer.sent_ < transfer.keys_.size() && transfer.sent_ - begin < TRANSFER_CHUNK_KEYS && bytes < TRANSFER_CHUNK_BYTES) {
+      const string& key = transfer.keys_[transfer.sent_].first;
+      transfer.sent_ += 1;
+      auto res = process_get(key, serializer);
       if (res.second == 0) {
-        //cerr << "gossiping key " + *set_it + " to address " + map_it->first + "\n";
-        prepare_put_tuple(gossip_map[map_it->first], *set_it, res.first.reveal().value, res.first.reveal().timestamp);
+        auto stat = key_stat_map.find(key);
+        key_hash_t key_hash = stat != key_stat_map.end() ? stat->second.hash_ : get_key_hash(key);
+        prepare_put_tuple(chunk, key, key_hash, res.first.reveal().value, res.first.reveal().timestamp);
+        bytes += res.first.reveal().value.size();
       }
     }
+    chunk.set_transfer_begin(begin);
+    chunk.set_transfer_end(transfer.sent_);
+    chunk.set_transfer_acked(transfer.acked_);
+    push_request(chunk, pushers[it->first]);
+    transfer.in_flight_.push_back(transfer_chunk(transfer.next_seq_, begin, transfer.sent_));
+    transfer.next_seq_ += 1;
+    transfer.credit_ -= 1;
+    transfer.bytes_sent_ += bytes;
+    limiter.consume(bytes);
   }
-  // send gossip
-  for (auto it = gossip_map.begin(); it != gossip_map.end(); it++) {
-    push_request(it->second, pushers[it->first]);
+}
+
+// the earliest time a transfer needs attention: once the bandwidth cap allows
+// if it can send, otherwise when its oldest unacknowledged chunk times out
+chrono::system_clock::time_point get_transfer_deadline(transfer_map& transfers, const transfer_rate_limiter& limiter) {
+  auto deadline = chrono::system_clock::time_point::max();
+  for (auto it = transfers.begin(); it != transfers.end(); it++) {
+    if (it->second.credit_ > 0 && it->second.sent_ < it->second.keys_.size()) {
+      deadline = min(deadline, limiter.next_ready());
+    }
+    if (it->second.in_flight_.size() > 0) {
+      deadline = min(deadline, it->second.last_progress_ + chrono::seconds(TRANSFER_TIMEOUT));
+    }
+  }
+  return deadline;
+}
+
+// apply an ack from a receiver; acks are cumulative and cover the keys the
+// receiver got without a gap. Returns the keys that every destination now has
+// and that this thread may drop
+vector<string> process_transfer_ack(
+    const communication::Transfer_Ack& ack,
+    transfer_map& transfers,
+    unordered_map<string, unsigned>& removal_refs,
+    shared_ptr<spdlog::logger> logger) {
+  vector<string> dropped;
+  for (auto it = transfers.begin(); it != transfers.end(); it++) {
+    key_transfer& transfer = it->second;
+    if (transfer.id_ != ack.transfer_id()) {
+      continue;
+    }
+    // acks count keys rather than chunks, so an ack for a chunk sent before a
+    // resume still only covers keys the receiver has
+    while (transfer.in_flight_.size() > 0 && transfer.in_flight_.front().end_ <= ack.received()) {
+      const transfer_chunk& chunk = transfer.in_flight_.front();
+      for (unsigned i = chunk.begin_; i < chunk.end_; i++) {
+        if (transfer.keys_[i].second) {
+          auto ref = removal_refs.find(transfer.keys_[i].first);
+          if (ref != removal_refs.end() && --ref->second == 0) {
+            dropped.push_back(ref->first);
+            removal_refs.erase(ref);
+          }
+        }
+      }
+      transfer.acked_ = chunk.end_;
+      transfer.in_flight_.pop_front();
+      transfer.credit_ += ack.credit();
+      transfer.last_progress_ = chrono::system_clock::now();
+    }
+    if (transfer.acked_ == transfer.keys_.size()) {
+      logger->info("Transfer {} of {} keys is done", transfer.id_, to_string(transfer.keys_.size()));
+      transfers.erase(it);
+    }
+    break;
+  }
+  return dropped;
+}
+
+// stop the transfers to a node that left; the keys they still held are queued
+// again for their new owners by the caller
+bool cancel_transfers(const string& ip, transfer_map& transfers, unordered_map<string, unsigned>& removal_refs) {
+  bool cancelled = false;
+  for (auto it = transfers.begin(); it != transfers.end();) {
+    if (it->second.destination_.get_ip() == ip) {
+      for (unsigned i = it->second.acked_; i < it->second.keys_.size(); i++) {
+        if (it->second.keys_[i].second) {
+          auto ref = removal_refs.find(it->second.keys_[i].first);
+          if (ref != removal_refs.end() && --ref->second == 0) {
+            removal_refs.erase(ref);
+          }
+        }
+      }
+      it = transfers.erase(it);
+      cancelled = true;
+    } else {
+      it++;
+    }
+  }
+  return cancelled;
+}
+
+// the threads other than this one that replicate a key in this tier
+vector<server_thread_t> get_replica_peers(
+    const string& key,
+    key_hash_t key_hash,
+    server_thread_t& wt,
+    unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
+    unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
+    placement_map& placement,
+    SocketCache& pushers,
+    unsigned& seed) {
+  vector<server_thread_t> peers;
+  vector<unsigned> tier_ids;
+  tier_ids.push_back(SELF_TIER_ID);
+  bool succeed;
+  auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, key_hash, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+  if (succeed && threads.find(wt) != threads.end()) {
+    for (auto it = threads.begin(); it != threads.end(); it++) {
+      if (it->get_id() != wt.get_id()) {
+        peers.push_back(*it);
+      }
+    }
+  }
+  return peers;
+}
+
+// whether peer replicates the key along with this thread
+bool shares_key(
+    const string& key,
+    key_hash_t key_hash,
+    const server_thread_t& peer,
+    server_thread_t& wt,
+    unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
+    unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
+    placement_map& placement,
+    SocketCache& pushers,
+    unsigned& seed) {
+  auto peers = get_replica_peers(key, key_hash, wt, global_hash_ring_map, local_hash_ring_map, placement, pushers, seed);
+  for (auto it = peers.begin(); it != peers.end(); it++) {
+    if (it->get_id() == peer.get_id()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// the tree over the keys this thread shares with peer; built from key_stat_map
+// on first use and kept up to date by process_put afterwards
+merkle_tree& get_replica_tree(
+    const server_thread_t& peer,
+    server_thread_t& wt,
+    replica_tree_map& replica_trees,
+    unordered_map<string, key_stat>& key_stat_map,
+    unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
+    unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
+    placement_map& placement,
+    SocketCache& pushers,
+    unsigned& seed) {
+  auto tree = replica_trees.find(peer.get_gossip_connect_addr());
+  if (tree != replica_trees.end()) {
+    return tree->second;
+  }
+  merkle_tree& new_tree = replica_trees[peer.get_gossip_connect_addr()];
+  for (auto it = key_stat_map.begin(); it != key_stat_map.end(); it++) {
+    if (shares_key(it->first, it->second.hash_, peer, wt, global_hash_ring_map, local_hash_ring_map, placement, pushers, seed)) {
+      new_tree.toggle(it->second.hash_, it->second.timestamp_);
+    }
+  }
+  return new_tree;
+}
+
+// add the versions of the keys shared with peer that fall in the given leaves
+void add_key_versions(
+    communication::Anti_Entropy& message,
+    const unordered_set<unsigned>& leaves,
+    const merkle_tree& tree,
+    const server_thread_t& peer,
+    server_thread_t& wt,
+    unordered_map<string, key_stat>& key_stat_map,
+    unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
+    unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
+    placement_map& placement,
+    SocketCache& pushers,
+    unsigned& seed) {
+  for (auto it = leaves.begin(); it != leaves.end(); it++) {
+    message.add_leaf(*it);
+  }
+  for (auto it = key_stat_map.begin(); it != key_stat_map.end(); it++) {
+    if (leaves.find(tree.leaf(it->second.hash_)) != leaves.end() &&
+        shares_key(it->first, it->second.hash_, peer, wt, global_hash_ring_map, local_hash_ring_map, placement, pushers, seed)) {
+      communication::Anti_Entropy_Key_Version* version = message.add_key();
+      version->set_key(it->first);
+      version->set_timestamp(it->second.timestamp_);
+    }
+  }
+}
+
+// one step of an anti-entropy exchange. Replicas walk their trees down from the
+// root together, only descending into nodes whose digests differ, and once they
+// reach leaves they swap the versions of the keys in them; each side then
+// gossips the keys it has newer versions of, so a divergent key costs a few
+// small messages instead of a scan of every key both replicas hold.
+void process_anti_entropy(
+    communication::Anti_Entropy& message,
+    server_thread_t& wt,
+    replica_tree_map& replica_trees,
+    unordered_map<string, key_stat>& key_stat_map,
+    unordered_map<unsigned, global_hash_t>& global_hash_ring_map,
+    unordered_map<unsigned, local_hash_t>& local_hash_ring_map,
+    placement_map& placement,
+    SocketCache& pushers,
+    Serializer* serializer,
+    unsigned& seed,
+    unsigned long long ring_epoch) {
+  server_thread_t peer = server_thread_t(message.ip(), message.tid());
+  merkle_tree& tree = get_replica_tree(peer, wt, replica_trees, key_stat_map, global_hash_ring_map, local_hash_ring_map, placement, pushers, seed);
+  communication::Anti_Entropy response;
+  response.set_ip(wt.get_ip());
+  response.set_tid(wt.get_tid());
+
+  if (message.leaf_size() > 0) {
+    // the peer's versions of the keys in leaves that differ
+    unordered_map<string, unsigned long long> peer_versions;
+    for (int i = 0; i < message.key_size(); i++) {
+      peer_versions[message.key(i).key()] = message.key(i).timestamp();
+    }
+    unordered_set<unsigned> leaves;
+    for (int i = 0; i < message.leaf_size(); i++) {
+      leaves.insert(message.leaf(i));
+    }
+    key_address_list key_addresses;
+    for (auto it = key_stat_map.begin(); it != key_stat_map.end(); it++) {
+      if (leaves.find(tree.leaf(it->second.hash_)) != leaves.end()) {
+        auto version = peer_versions.find(it->first);
+        if ((version == peer_versions.end() || version->second < it->second.timestamp_) &&
+            shares_key(it->first, it->second.hash_, peer, wt, global_hash_ring_map, local_hash_ring_map, placement, pushers, seed)) {
+          key_addresses.push_back(make_pair(it->first, peer.get_gossip_connect_addr()));
+        }
+      }
+    }
+    send_gossip(key_addresses, pushers, serializer, key_stat_map, ring_epoch);
+    // send back this thread's versions so that the peer can push the keys
+    // it has newer versions of
+    if (!message.reply()) {
+      add_key_versions(response, leaves, tree, peer, wt, key_stat_map, global_hash_ring_map, local_hash_ring_map, placement, pushers, seed);
+      response.set_reply(true);
+    }
+  } else {
+    unordered_set<unsigned> leaves;
+    for (int i = 0; i < message.node_size(); i++) {
+      unsigned index = message.node(i).index();
+      if (index == 0 || index >= tree.leaf_end() || tree.digest(index) == message.node(i).digest()) {
+        continue;
+      }
+      if (tree.is_leaf(index)) {
+        leaves.insert(index);
+      } else {
+        for (unsigned child = 2 * index; child <= 2 * index + 1; child++) {
+          communication::Anti_Entropy_Node* node = response.add_node();
+          node->set_index(child);
+          node->set_digest(tree.digest(child));
+        }
+      }
+    }
+    if (leaves.size() > 0) {
+      add_key_versions(response, leaves, tree, peer, wt, key_stat_map, global_hash_ring_map, local_hash_ring_map, placement, pushers, seed);
+    }
+  }
+
+  if (response.node_size() > 0 || response.leaf_size() > 0) {
+    string serialized_response;
+    response.SerializeToString(&serialized_response);
+    zmq_util::send_string(serialized_response, &pushers[peer.get_anti_entropy_connect_addr()]);
   }
 }
 
 // thread entry point
-void run(unsigned thread_id) {
+void run(unsigned thread_id, zmq::context_t* context) {
+
+  // pin before allocating anything so that this thread's memory is first
+  // touched on its local NUMA node
+  auto assignment = assign_core(thread_id);
+  bind_to_core(assignment);
 
   string log_file = "log_" + to_string(thread_id) + ".txt";
   string logger_name = "basic_logger_" + to_string(thread_id);
@@ -262,10 +676,9 @@ void run(unsigned thread_id) {
   unsigned seed = time(NULL);
   seed += thread_id;
 
-  // prepare the zmq context
-  zmq::context_t context(1);
+  logger->info(describe_assignment(thread_id, assignment));
 
-  SocketCache pushers(&context, ZMQ_PUSH);
+  SocketCache pushers(context, ZMQ_PUSH);
 
   // initialize hash ring maps
   unordered_map<unsigned, global_hash_t> global_hash_ring_map;
@@ -275,7 +688,9 @@ void run(unsigned thread_id) {
   unordered_map<string, pair<chrono::system_clock::time_point, vector<pending_request>>> pending_request_map;
   unordered_map<string, pair<chrono::system_clock::time_point, vector<pending_gossip>>> pending_gossip_map;
 
-  unordered_map<string, key_info> placement;
+  // the replication of the keys this thread has looked up; a key is only
+  // known once its replication factor was fetched or pushed here
+  placement_map placement;
 
   vector<string> proxy_address;
 
@@ -297,63 +712,80 @@ void run(unsigned thread_id) {
   }
   address.close();
 
-  address.open("conf/server/seed_server.txt");
-  getline(address, ip_line);
-  address.close();
-
-  logger->info("seed address is {}", ip_line);
-
-  // request server addresses from the seed node
-  zmq::socket_t addr_requester(context, ZMQ_REQ);
-  addr_requester.connect(proxy_thread_t(ip_line, 0).get_seed_connect_addr());
-  zmq_util::send_string("join", &addr_requester);
-
-  // receive and add all the addresses that seed node sent
-  string serialized_addresses = zmq_util::recv_string(&addr_requester);
-  communication::Address addresses;
-  addresses.ParseFromString(serialized_addresses);
+  // other nodes only send control messages (join, depart, self depart and
+  // replication factor change) to thread 0, which fans them out to the other
+  // threads of this node over inproc
+  // listens for a new node joining
+  zmq::socket_t join_puller(*context, ZMQ_PULL);
+  join_puller.bind(thread_id == 0 ? wt.get_node_join_bind_addr() : wt.get_node_join_inproc_addr());
+
+  // the monitoring node numbers every membership change with an epoch; thread
+  // 0 registers this node's join, and every thread fetches the server list.
+  // The other threads only see the changes thread 0 forwards, so they wait
+  // until thread 0 has registered: their server list then already has this
+  // node's join, and every later change is forwarded to them
+  if (thread_id != 0) {
+    zmq_util::recv_string(&join_puller);
+  }
+  monitoring_thread_t mt = monitoring_thread_t(monitoring_address[0]);
+  zmq::socket_t membership_requester(*context, ZMQ_REQ);
+  membership_requester.connect(mt.get_membership_connect_addr());
+  communication::Membership registration;
+  if (thread_id == 0) {
+    communication::Membership_Delta* delta = registration.add_delta();
+    delta->set_epoch(0);
+    delta->set_join(true);
+    delta->set_tier_id(SELF_TIER_ID);
+    delta->set_ip(ip);
+  }
+  communication::Address addresses = register_membership(registration, membership_requester);
+  if (thread_id == 0) {
+    // an empty membership message lets the other threads register
+    string serialized_registered = serialize_membership(vector<communication::Membership_Delta>());
+    for (unsigned tid = 1; tid < THREAD_NUM; tid++) {
+      zmq_util::send_string(serialized_registered, &pushers[server_thread_t(ip, tid).get_node_join_inproc_addr()]);
+    }
+  }
   // populate start time
   unsigned long long duration = addresses.start_time();
   chrono::milliseconds dur(duration);
   chrono::system_clock::time_point start_time(dur);
   // populate addresses
-  for (int i = 0; i < addresses.tuple_size(); i++) {
-    insert_to_hash_ring<global_hash_t>(global_hash_ring_map[addresses.tuple(i).tier_id()], addresses.tuple(i).ip(), 0);
-  }
+  populate_hash_rings(addresses, global_hash_ring_map);
+  membership_log membership(addresses.ring_epoch());
+  logger->info("joined at membership epoch {}", membership.epoch());
 
   // add itself to global hash ring
   insert_to_hash_ring<global_hash_t>(global_hash_ring_map[SELF_TIER_ID], ip, 0);
 
   // form local hash rings
   for (auto it = tier_data_map.begin(); it != tier_data_map.end(); it++) {
-    for (unsigned tid = 0; tid < it->second.thread_number_; tid++) {
-      insert_to_hash_ring<local_hash_t>(local_hash_ring_map[it->first], ip, tid);
-    }
+    local_hash_ring_map[it->first] = local_hash_t(it->second.thread_number_);
   }
 
-  // thread 0 notifies other servers that it has joined
+  // thread 0 notifies other servers and the proxies that it has joined; the
+  // monitoring node already knows from the registration
   if (thread_id == 0) {
+    communication::Membership join;
+    communication::Membership_Delta* delta = join.add_delta();
+    delta->set_epoch(addresses.ring_epoch());
+    delta->set_join(true);
+    delta->set_tier_id(SELF_TIER_ID);
+    delta->set_ip(ip);
+    string serialized_join;
+    join.SerializeToString(&serialized_join);
+
     for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
-      unsigned tier_id = it->first;
-      auto hash_ring = &(it->second);
-      unordered_set<string> observed_ip;
-      for (auto iter = hash_ring->begin(); iter != hash_ring->end(); iter++) {
-        if (iter->second.get_ip().compare(ip) != 0 && observed_ip.find(iter->second.get_ip()) == observed_ip.end()) {
-          zmq_util::send_string(to_string(SELF_TIER_ID) + ":" + ip, &pushers[(iter->second).get_node_join_connect_addr()]);
-          observed_ip.insert(iter->second.get_ip());
+      const auto& nodes = it->second.nodes();
+      for (auto iter = nodes.begin(); iter != nodes.end(); iter++) {
+        if (iter->get_ip().compare(ip) != 0) {
+          zmq_util::send_string(serialized_join, &pushers[iter->get_node_join_connect_addr()]);
         }
       }
     }
 
-    string msg = "join:" + to_string(SELF_TIER_ID) + ":" + ip;
-    // notify proxies that this node has joined
     for (auto it = proxy_address.begin(); it != proxy_address.end(); it++) {
-      zmq_util::send_string(msg, &pushers[proxy_thread_t(*it, 0).get_notify_connect_addr()]);
-    }
-
-    // notify monitoring nodes that this node has joined
-    for (auto it = monitoring_address.begin(); it != monitoring_address.end(); it++) {
-      zmq_util::send_string(msg, &pushers[monitoring_thread_t(*it).get_notify_connect_addr()]);
+      zmq_util::send_string(serialized_join, &pushers[proxy_thread_t(*it, 0).get_notify_connect_addr()]);
     }
   }
 
@@ -369,35 +801,57 @@ void run(unsigned thread_id) {
   }
 
   // the set of changes made on this thread since the last round of gossip
-  unordered_set<string> local_changeset;
+  change_set local_changeset;
+  // keys whose gossip is due, sent a chunk at a time
+  vector<string> gossip_queue;
 
   // keep track of the key stat
   unordered_map<string, key_stat> key_stat_map;
-  // keep track of key access timestamp
-  unordered_map<string, multiset<std::chrono::time_point<std::chrono::system_clock>>> key_access_timestamp;
-
+  // keep track of key access counts
+  unordered_map<string, access_counter> key_access_map;
+  // where the next access report's cold key sample starts
+  size_t cold_cursor = 0;
+  // the Merkle trees over the keys shared with each other replica
+  replica_tree_map replica_trees;
+  // rebalancing transfers out of this thread
+  transfer_map transfers;
+  // the number of transfers each key given up still waits on
+  unordered_map<string, unsigned> removal_refs;
+  // rebalancing transfers into this thread
+  transfer_receiver receiver;
+  unsigned long long transfer_count = 0;
+  // encodes the stats pushed to the monitoring node
+  stats_encoder stats;
+  // finds the keys to move after a membership change
+  migration_scan scan;
+  transfer_rate_limiter limiter;
+  // set while this node departs, until its keys have been handed off
+  string depart_ack_addr = "";
 
-  // listens for a new node joining
-  zmq::socket_t join_puller(context, ZMQ_PULL);
-  join_puller.bind(wt.get_node_join_bind_addr());
   // listens for a node departing
-  zmq::socket_t depart_puller(context, ZMQ_PULL);
-  depart_puller.bind(wt.get_node_depart_bind_addr());
+  zmq::socket_t depart_puller(*context, ZMQ_PULL);
+  depart_puller.bind(thread_id == 0 ? wt.get_node_depart_bind_addr() : wt.get_node_depart_inproc_addr());
   // responsible for listening for a command that this node should leave
-  zmq::socket_t self_depart_puller(context, ZMQ_PULL);
-  self_depart_puller.bind(wt.get_self_depart_bind_addr());
+  zmq::socket_t self_depart_puller(*context, ZMQ_PULL);
+  self_depart_puller.bind(thread_id == 0 ? wt.get_self_depart_bind_addr() : wt.get_self_depart_inproc_addr());
   // responsible for handling requests
-  zmq::socket_t request_puller(context, ZMQ_PULL);
+  zmq::socket_t request_puller(*context, ZMQ_PULL);
   request_puller.bind(wt.get_request_pulling_bind_addr());
   // responsible for processing gossips
-  zmq::socket_t gossip_puller(context, ZMQ_PULL);
+  zmq::socket_t gossip_puller(*context, ZMQ_PULL);
   gossip_puller.bind(wt.get_gossip_bind_addr());
   // responsible for listening for key replication factor response
-  zmq::socket_t replication_factor_puller(context, ZMQ_PULL);
+  zmq::socket_t replication_factor_puller(*context, ZMQ_PULL);
   replication_factor_puller.bind(wt.get_replication_factor_bind_addr());
   // responsible for listening for key replication factor change
-  zmq::socket_t replication_factor_change_puller(context, ZMQ_PULL);
-  replication_factor_change_puller.bind(wt.get_replication_factor_change_bind_addr());
+  zmq::socket_t replication_factor_change_puller(*context, ZMQ_PULL);
+  replication_factor_change_puller.bind(thread_id == 0 ? wt.get_replication_factor_change_bind_addr() : wt.get_replication_factor_change_inproc_addr());
+  // responsible for anti-entropy exchanges with the other replicas
+  zmq::socket_t anti_entropy_puller(*context, ZMQ_PULL);
+  anti_entropy_puller.bind(wt.get_anti_entropy_bind_addr());
+  // responsible for acks of rebalancing transfer chunks
+  zmq::socket_t transfer_ack_puller(*context, ZMQ_PULL);
+  transfer_ack_puller.bind(wt.get_transfer_ack_bind_addr());
 
   //  Initialize poll set
   vector<zmq::pollitem_t> pollitems = {
@@ -407,97 +861,94 @@ void run(unsigned thread_id) {
     { static_cast<void *>(request_puller), 0, ZMQ_POLLIN, 0 },
     { static_cast<void *>(gossip_puller), 0, ZMQ_POLLIN, 0 },
     { static_cast<void *>(replication_factor_puller), 0, ZMQ_POLLIN, 0 },
-    { static_cast<void *>(replication_factor_change_puller), 0, ZMQ_POLLIN, 0 }
+    { static_cast<void *>(replication_factor_change_puller), 0, ZMQ_POLLIN, 0 },
+    { static_cast<void *>(anti_entropy_puller), 0, ZMQ_POLLIN, 0 },
+    { static_cast<void *>(transfer_ack_puller), 0, ZMQ_POLLIN, 0 }
   };
 
-  auto gossip_start = chrono::system_clock::now();
-  auto gossip_end = chrono::system_clock::now();
   auto report_start = chrono::system_clock::now();
   auto report_end = chrono::system_clock::now();
+  auto anti_entropy_start = chrono::system_clock::now();
 
   unsigned long long working_time = 0;
   unordered_map<unsigned, unsigned long long> working_time_map;
-  for (unsigned i = 0; i < 8; i++) {
+  for (unsigned i = 0; i < 10; i++) {
     working_time_map[i] = 0;
   }
   unsigned epoch = 0;
+  // the latency of the requests since the last report
+  latency_histogram queue_latency;
+  latency_histogram service_latency;
+  latency_histogram request_latency;
+
+  // spin while busy, then back off to blocking until the next timer deadline;
+  // blocked time is never added to working_time, so occupancy excludes it
+  zmq_util::IdleStrategy idle(IDLE_SPIN_COUNT, IDLE_YIELD_COUNT, IDLE_MAX_BLOCK_TIME);
+  // the earliest time at which a pending gossip needs its rep factor query retried
+  auto retry_deadline = chrono::system_clock::time_point::max();
   // enter event loop
   while (true) {
-    zmq_util::poll(0, &pollitems);
+    auto deadline = min(local_changeset.deadline(), report_start + chrono::seconds(SERVER_REPORT_THRESHOLD));
+    // a partly sent flush continues as soon as pending messages are handled
+    if (gossip_queue.size() > 0) {
+      deadline = chrono::system_clock::now();
+    }
+    deadline = min(deadline, anti_entropy_start + chrono::seconds(ANTI_ENTROPY_PERIOD));
+    deadline = min(deadline, get_transfer_deadline(transfers, limiter));
+    if (scan.active_) {
+      deadline = chrono::system_clock::now();
+    }
+    deadline = min(deadline, retry_deadline);
+    zmq_util::adaptive_poll(zmq_util::time_until(deadline), &idle, &pollitems);
+    // a request that arrived during the poll waits from here until the events
+    // ahead of it are handled
+    auto wake_time = chrono::system_clock::now();
+    // set when a membership change adds a node to this tier or moves keys
+    // between its nodes
+    bool self_tier_change = false;
 
     // receives a node join
     if (pollitems[0].revents & ZMQ_POLLIN) {
       //cerr << "thread " + to_string(thread_id) + " entering event 1\n";
       auto work_start = chrono::system_clock::now();
       string message = zmq_util::recv_string(&join_puller);
+      communication::Membership update;
+      update.ParseFromString(message);
+      // apply the deltas in epoch order; duplicates and stale deltas are dropped
+      auto applied = apply_membership(update, membership, global_hash_ring_map);
+      for (auto it = applied.begin(); it != applied.end(); it++) {
+        log_membership_delta(logger, *it);
+        if ((it->join() || it->has_shed()) && it->tier_id() == SELF_TIER_ID) {
+          self_tier_change = true;
+        }
+        // a join can release a departure that was held back behind it, and
+        // syncs resend departures here too
+        if (!it->join() && cancel_transfers(it->ip(), transfers, removal_refs)) {
+          self_tier_change = true;
+        }
+        // the keys shared with each replica change with the tier's membership
+        if (it->tier_id() == SELF_TIER_ID) {
+          replica_trees.clear();
+        }
+      }
 
-      vector<string> v;
-      split(message, ':', v);
-      unsigned tier = stoi(v[0]);
-      string new_server_ip = v[1];
-      // update global hash ring
-      bool inserted = insert_to_hash_ring<global_hash_t>(global_hash_ring_map[tier], new_server_ip, 0);
-
-      if (inserted) {
-        logger->info("Received a node join for tier {}. New node is {}", tier, new_server_ip);
-        // only relevant to thread 0
-        if (thread_id == 0) {
-          // gossip the new node address between server nodes to ensure consistency
-          for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
-            unsigned tier_id = it->first;
-            auto hash_ring = &(it->second);
-            unordered_set<string> observed_ip;
-            for (auto iter = hash_ring->begin(); iter != hash_ring->end(); iter++) {
-              if (iter->second.get_ip().compare(ip) != 0 && iter->second.get_ip().compare(new_server_ip) != 0 && observed_ip.find(iter->second.get_ip()) == observed_ip.end()) {
-                // if the node is not myself and not the newly joined node, send the ip of the newly joined node
-                zmq_util::send_string(message, &pushers[(iter->second).get_node_join_connect_addr()]);
-                observed_ip.insert(iter->second.get_ip());
-              } else if (iter->second.get_ip().compare(new_server_ip) == 0 && observed_ip.find(iter->second.get_ip()) == observed_ip.end()) {
-                // if the node is the newly joined node, send my ip
-                zmq_util::send_string(to_string(SELF_TIER_ID) + ":" + ip, &pushers[(iter->second).get_node_join_connect_addr()]);
-                observed_ip.insert(iter->second.get_ip());
-              }
-            }
-          }
-          // tell all worker threads about the new node join
+      if (thread_id == 0) {
+        if (applied.size() > 0) {
+          // tell all worker threads about the membership change
+          string serialized_applied = serialize_membership(applied);
           for (unsigned tid = 1; tid < THREAD_NUM; tid++) {
-            zmq_util::send_string(message, &pushers[server_thread_t(ip, tid).get_node_join_connect_addr()]);
+            zmq_util::send_string(serialized_applied, &pushers[server_thread_t(ip, tid).get_node_join_inproc_addr()]);
           }
           for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
             logger->info("hash ring for tier {} size is {}", to_string(it->first), to_string(it->second.size()));
           }
         }
-        if (tier == SELF_TIER_ID) {
-          vector<unsigned> tier_ids;
-          tier_ids.push_back(SELF_TIER_ID);
-          // map from worker address to a set of keys
-          address_keyset_map addr_keyset_map;
-          // keep track of which key should be removed
-          unordered_set<string> remove_set;
-          bool succeed;
-          for (auto it = key_stat_map.begin(); it != key_stat_map.end(); it++) {
-            string key = it->first;
-            auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
-            if (succeed) {
-              if (threads.find(wt) == threads.end()) {
-                remove_set.insert(key);
-                for (auto iter = threads.begin(); iter != threads.end(); iter++) {
-                  addr_keyset_map[iter->get_gossip_connect_addr()].insert(key);
-                }
-              }
-            } else {
-              logger->info("Error: key missing replication factor in node join routine");
-            }
-          }
-
-          send_gossip(addr_keyset_map, pushers, serializer);
-          // remove keys
-          for (auto it = remove_set.begin(); it != remove_set.end(); it++) {
-            key_stat_map.erase(*it);
-            serializer->remove(*it);
-          }
+        // a delta arrived ahead of one that was lost, so fetch the missing ones
+        if (membership.has_gap()) {
+          sync_membership(membership.newest_epoch(), membership, wt.get_node_join_connect_addr(), mt, pushers);
         }
       }
+
       auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
       working_time += time_elapsed;
       working_time_map[0] += time_elapsed;
@@ -509,21 +960,37 @@ void run(unsigned thread_id) {
       //cerr << "thread " + to_string(thread_id) + " entering event 2\n";
       auto work_start = chrono::system_clock::now();
       string message = zmq_util::recv_string(&depart_puller);
-
-      vector<string> v;
-      split(message, ':', v);
-      unsigned tier = stoi(v[0]);
-      string departing_server_ip = v[1];
-      logger->info("Received departure for node {} on tier {}", departing_server_ip, tier);
-      // update hash ring
-      remove_from_hash_ring<global_hash_t>(global_hash_ring_map[tier], departing_server_ip, 0);
+      communication::Membership update;
+      update.ParseFromString(message);
+      // a departure can release joins that were held back behind it
+      auto applied = apply_membership(update, membership, global_hash_ring_map);
+      for (auto it = applied.begin(); it != applied.end(); it++) {
+        log_membership_delta(logger, *it);
+        if ((it->join() || it->has_shed()) && it->tier_id() == SELF_TIER_ID) {
+          self_tier_change = true;
+        }
+        // keys still on their way to the departed node go to its successors
+        if (!it->join() && cancel_transfers(it->ip(), transfers, removal_refs)) {
+          self_tier_change = true;
+        }
+        // the keys shared with each replica change with the tier's membership
+        if (it->tier_id() == SELF_TIER_ID) {
+          replica_trees.clear();
+        }
+      }
       if (thread_id == 0) {
-        // tell all worker threads about the node departure
-        for (unsigned tid = 1; tid < THREAD_NUM; tid++) {
-          zmq_util::send_string(message, &pushers[server_thread_t(ip, tid).get_node_depart_connect_addr()]);
+        if (applied.size() > 0) {
+          // tell all worker threads about the node departure
+          string serialized_applied = serialize_membership(applied);
+          for (unsigned tid = 1; tid < THREAD_NUM; tid++) {
+            zmq_util::send_string(serialized_applied, &pushers[server_thread_t(ip, tid).get_node_depart_inproc_addr()]);
+          }
+          for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
+            logger->info("hash ring for tier {} size is {}", to_string(it->first), to_string(it->second.size()));
+          }
         }
-        for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
-          logger->info("hash ring for tier {} size is {}", to_string(it->first), to_string(it->second.size()));
+        if (membership.has_gap()) {
+          sync_membership(membership.newest_epoch(), membership, wt.get_node_join_connect_addr(), mt, pushers);
         }
       }
       auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
@@ -532,6 +999,16 @@ void run(unsigned thread_id) {
       //cerr << "thread " + to_string(thread_id) + " leaving event 2\n";
     }
 
+    // keys this node no longer owns move to the nodes that joined its tier or
+    // that take the keys a node sheds; the departing node hands its keys off
+    // itself, so departures need nothing. The keys are found by a background
+    // scan, streamed in chunks and only dropped once their new owners have them
+    if (self_tier_change) {
+      vector<unsigned> tier_ids;
+      tier_ids.push_back(SELF_TIER_ID);
+      scan.start(key_stat_map.bucket_count(), tier_ids);
+    }
+
     // receives a node departure request
     if (pollitems[2].revents & ZMQ_POLLIN) {
       //cerr << "thread " + to_string(thread_id) + " entering event 3\n";
@@ -540,52 +1017,44 @@ void run(unsigned thread_id) {
       logger->info("Node is departing");
       remove_from_hash_ring<global_hash_t>(global_hash_ring_map[SELF_TIER_ID], ip, 0);
       if (thread_id == 0) {
+        // have the monitoring node sequence the departure, then tell the
+        // remaining servers and the proxies
+        communication::Membership registration;
+        communication::Membership_Delta* delta = registration.add_delta();
+        delta->set_epoch(0);
+        delta->set_join(false);
+        delta->set_tier_id(SELF_TIER_ID);
+        delta->set_ip(ip);
+        communication::Address sequenced = register_membership(registration, membership_requester);
+        delta->set_epoch(sequenced.ring_epoch());
+        string serialized_depart;
+        registration.SerializeToString(&serialized_depart);
+
         for (auto it = global_hash_ring_map.begin(); it != global_hash_ring_map.end(); it++) {
-          auto hash_ring = &(it->second);
-          unordered_set<string> observed_ip;
-          for (auto iter = hash_ring->begin(); iter != hash_ring->end(); iter++) {
-            if (observed_ip.find(iter->second.get_ip()) == observed_ip.end()) {
-              zmq_util::send_string(to_string(SELF_TIER_ID) + ":" + ip, &pushers[(iter->second).get_node_depart_connect_addr()]);
-              observed_ip.insert(iter->second.get_ip());
-            }
+          const auto& nodes = it->second.nodes();
+          for (auto iter = nodes.begin(); iter != nodes.end(); iter++) {
+            zmq_util::send_string(serialized_depart, &pushers[iter->get_node_depart_connect_addr()]);
           }
         }
-        string msg = "depart:" + to_string(SELF_TIER_ID) + ":" + ip;
-        // notify proxies
         for (auto it = proxy_address.begin(); it != proxy_address.end(); it++) {
-          zmq_util::send_string(msg, &pushers[proxy_thread_t(*it, 0).get_notify_connect_addr()]);
-        }
-        // notify monitoring nodes
-        for (auto it = monitoring_address.begin(); it != monitoring_address.end(); it++) {
-          zmq_util::send_string(msg, &pushers[monitoring_thread_t(*it).get_notify_connect_addr()]);
+          zmq_util::send_string(serialized_depart, &pushers[proxy_thread_t(*it, 0).get_notify_connect_addr()]);
         }
         // tell all worker threads about the self departure
         for (unsigned tid = 1; tid < THREAD_NUM; tid++) {
-          zmq_util::send_string(ack_addr, &pushers[server_thread_t(ip, tid).get_self_depart_connect_addr()]);
+          zmq_util::send_string(ack_addr, &pushers[server_thread_t(ip, tid).get_self_depart_inproc_addr()]);
         }
       }
 
-      address_keyset_map addr_keyset_map;
+      // since this node is already off the hash ring, the scan hands every
+      // key to its replicas in all tiers
       vector<unsigned> tier_ids;
       for (unsigned i = MIN_TIER; i <= MAX_TIER; i++) {
         tier_ids.push_back(i);
       }
-      bool succeed;
-      for (auto it = key_stat_map.begin(); it != key_stat_map.end(); it++) {
-        string key = it->first;
-        auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
-        if (succeed) {
-          // since we already removed itself from the hash ring, no need to exclude itself from threads
-          for (auto iter = threads.begin(); iter != threads.end(); iter++) {
-            addr_keyset_map[iter->get_gossip_connect_addr()].insert(key);
-          }
-        } else {
-          logger->info("Error: key missing replication factor in node depart routine");
-        }
-      }
+      scan.start(key_stat_map.bucket_count(), tier_ids);
 
-      send_gossip(addr_keyset_map, pushers, serializer);
-      zmq_util::send_string(ip + "_" + to_string(SELF_TIER_ID), &pushers[ack_addr]);
+      // the departure is acknowledged once the keys have been handed off
+      depart_ack_addr = ack_addr;
       auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
       working_time += time_elapsed;
       working_time_map[2] += time_elapsed;
@@ -600,7 +1069,11 @@ void run(unsigned thread_id) {
       communication::Request req;
       req.ParseFromString(serialized_req);
       //  process request
-      auto response = process_request(req, local_changeset, serializer, wt, global_hash_ring_map, local_hash_ring_map, placement, pushers, key_stat_map, key_access_timestamp, start_time, pending_request_map, seed);
+      // the sender has seen membership changes this thread has not
+      if (req.has_ring_epoch()) {
+        sync_membership(req.ring_epoch(), membership, server_thread_t(ip, 0).get_node_join_connect_addr(), mt, pushers);
+      }
+      auto response = process_request(req, local_changeset, serializer, wt, global_hash_ring_map, local_hash_ring_map, placement, pushers, key_stat_map, key_access_map, start_time, pending_request_map, replica_trees, seed, membership.epoch(), wake_time);
       if (response.tuple_size() > 0 && req.has_respond_address()) {
         string serialized_response;
         response.SerializeToString(&serialized_response);
@@ -610,6 +1083,12 @@ void run(unsigned thread_id) {
       auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
       working_time += time_elapsed;
       working_time_map[3] += time_elapsed;
+      // every tuple answered now counts once; the parked ones are recorded
+      // when they are answered
+      auto time_queued = chrono::duration_cast<chrono::microseconds>(work_start-wake_time).count();
+      queue_latency.record(time_queued, response.tuple_size());
+      service_latency.record(time_elapsed, response.tuple_size());
+      request_latency.record(time_queued + time_elapsed, response.tuple_size());
       //cerr << "thread " + to_string(thread_id) + " leaving event 4\n";
     }
 
@@ -621,7 +1100,10 @@ void run(unsigned thread_id) {
       communication::Request gossip;
       gossip.ParseFromString(serialized_gossip);
       //  Process distributed gossip
-      process_gossip(gossip, wt, global_hash_ring_map, local_hash_ring_map, placement, pushers, serializer, key_stat_map, pending_gossip_map, seed);
+      if (gossip.has_ring_epoch()) {
+        sync_membership(gossip.ring_epoch(), membership, server_thread_t(ip, 0).get_node_join_connect_addr(), mt, pushers);
+      }
+      process_gossip(gossip, wt, global_hash_ring_map, local_hash_ring_map, placement, pushers, serializer, key_stat_map, pending_gossip_map, replica_trees, receiver, seed, membership.epoch());
       auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
       working_time += time_elapsed;
       working_time_map[4] += time_elapsed;
@@ -638,23 +1120,32 @@ void run(unsigned thread_id) {
       vector<string> tokens;
       split(response.tuple(0).key(), '_', tokens);
       string key = tokens[0];
+      key_hash_t key_hash = get_key_hash(key);
       if (response.tuple(0).err_number() == 0) {
         communication::Replication_Factor rep_data;
         rep_data.ParseFromString(response.tuple(0).value());
+        key_info changes;
         for (int i = 0; i < rep_data.global_size(); i++) {
-          placement[key].global_replication_map_[rep_data.global(i).tier_id()] = rep_data.global(i).global_replication();
+          changes.set_global_replication(rep_data.global(i).tier_id(), rep_data.global(i).global_replication());
         }
         for (int i = 0; i < rep_data.local_size(); i++) {
-          placement[key].local_replication_map_[rep_data.local(i).ip()] = rep_data.local(i).local_replication();
+          changes.set_local_replication(rep_data.local(i).ip(), rep_data.local(i).local_replication());
+        }
+        placement.merge(key, changes);
+        // a key this thread holds may now be shared with different replicas
+        if (key_stat_map.find(key) != key_stat_map.end()) {
+          replica_trees.clear();
         }
       } else if (response.tuple(0).err_number() == 2) {
         //logger->info("Retrying rep factor query for key {} due to invalidated address", key);
         auto respond_address = wt.get_replication_factor_connect_addr();
         issue_replication_factor_request(respond_address, key, global_hash_ring_map[1], local_hash_ring_map[1], pushers, seed);
       } else {
+        key_info changes;
         for (unsigned i = MIN_TIER; i <= MAX_TIER; i++) {
-          placement[key].global_replication_map_[i] = tier_data_map[i].default_replication_;
+          changes.set_global_replication(i, tier_data_map[i].default_replication_);
         }
+        placement.merge(key, changes);
       }
 
       if (response.tuple(0).err_number() != 2) {
@@ -664,7 +1155,7 @@ void run(unsigned thread_id) {
         bool succeed;
         // pending requests
         if (pending_request_map.find(key) != pending_request_map.end()) {
-          auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+          auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, key_hash, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
           if (succeed) {
             bool responsible;
             if (threads.find(wt) != threads.end()) {
@@ -678,6 +1169,7 @@ void run(unsigned thread_id) {
                 if (it->respond_id_ != "") {
                   response.set_response_id(it->respond_id_);
                 }
+                response.set_ring_epoch(membership.epoch());
                 communication::Response_Tuple* tp = response.add_tuple();
                 tp->set_key(key);
                 tp->set_err_number(2);
@@ -693,9 +1185,9 @@ void run(unsigned thread_id) {
                 if (it->type_ == "P") {
                   auto current_time = chrono::system_clock::now();
                   auto ts = generate_timestamp(chrono::duration_cast<chrono::milliseconds>(current_time-start_time).count(), wt.get_tid());
-                  process_put(key, ts, it->value_, serializer, key_stat_map);
-                  key_access_timestamp[key].insert(std::chrono::system_clock::now());
-                  local_changeset.insert(key);
+                  process_put(key, key_hash, ts, it->value_, serializer, key_stat_map, threads, wt, replica_trees);
+                  key_access_map[key].record();
+                  local_changeset.insert(key, it->value_.size());
                 } else {
                   logger->info("Error: GET request with no respond address");
                 }
@@ -710,20 +1202,22 @@ void run(unsigned thread_id) {
                   auto res = process_get(key, serializer);
                   tp->set_value(res.first.reveal().value);
                   tp->set_err_number(res.second);
-                  key_access_timestamp[key].insert(std::chrono::system_clock::now());
+                  key_access_map[key].record();
                 } else {
                   auto current_time = chrono::system_clock::now();
                   auto ts = generate_timestamp(chrono::duration_cast<chrono::milliseconds>(current_time-start_time).count(), wt.get_tid());
-                  process_put(key, ts, it->value_, serializer, key_stat_map);
+                  process_put(key, key_hash, ts, it->value_, serializer, key_stat_map, threads, wt, replica_trees);
                   tp->set_err_number(0);
-                  key_access_timestamp[key].insert(std::chrono::system_clock::now());
-                  local_changeset.insert(key);
+                  key_access_map[key].record();
+                  local_changeset.insert(key, it->value_.size());
                 }
                 string serialized_response;
                 response.SerializeToString(&serialized_response);
                 //  send response
                 zmq_util::send_string(serialized_response, &pushers[it->addr_]);
               }
+              // a parked request only has an end to end latency
+              request_latency.record(chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-it->arrival_).count());
             }
           } else {
             logger->info("Error: key missing replication factor in process pending request routine");
@@ -732,19 +1226,20 @@ void run(unsigned thread_id) {
         }
         // pending gossip
         if (pending_gossip_map.find(key) != pending_gossip_map.end()) {
-          auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+          auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, key_hash, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
           if (succeed) {
             if (threads.find(wt) != threads.end()) {
               for (auto it = pending_gossip_map[key].second.begin(); it != pending_gossip_map[key].second.end(); it++) {
-                process_put(key, it->ts_, it->value_, serializer, key_stat_map);
+                process_put(key, key_hash, it->ts_, it->value_, serializer, key_stat_map, threads, wt, replica_trees);
               }
             } else {
               unordered_map<string, communication::Request> gossip_map;
               // forward the gossip
               for (auto it = threads.begin(); it != threads.end(); it++) {
                 gossip_map[it->get_gossip_connect_addr()].set_type("PUT");
+                gossip_map[it->get_gossip_connect_addr()].set_ring_epoch(membership.epoch());
                 for (auto iter = pending_gossip_map[key].second.begin(); iter != pending_gossip_map[key].second.end(); iter++) {
-                  prepare_put_tuple(gossip_map[it->get_gossip_connect_addr()], key, iter->value_, iter->ts_);
+                  prepare_put_tuple(gossip_map[it->get_gossip_connect_addr()], key, key_hash, iter->value_, iter->ts_);
                 }
               }
               // redirect gossip
@@ -769,20 +1264,20 @@ void run(unsigned thread_id) {
       //cerr << "thread " + to_string(thread_id) + " entering event 7\n";
       auto work_start = chrono::system_clock::now();
       logger->info("Received replication factor change");
-      string serialized_req = zmq_util::recv_string(&replication_factor_change_puller);
+      shared_ptr<communication::Replication_Factor_Request> req_ptr;
 
       if (thread_id == 0) {
-        // tell all worker threads about the replication factor change
+        req_ptr = make_shared<communication::Replication_Factor_Request>();
+        req_ptr->ParseFromString(zmq_util::recv_string(&replication_factor_change_puller));
+        // share the parsed request with all worker threads instead of
+        // sending each of them a serialized copy
         for (unsigned tid = 1; tid < THREAD_NUM; tid++) {
-          zmq_util::send_string(serialized_req, &pushers[server_thread_t(ip, tid).get_replication_factor_change_connect_addr()]);
+          zmq_util::send_shared(req_ptr, &pushers[server_thread_t(ip, tid).get_replication_factor_change_inproc_addr()]);
         }
+      } else {
+        req_ptr = zmq_util::recv_shared<communication::Replication_Factor_Request>(&replication_factor_change_puller);
       }
-      communication::Replication_Factor_Request req;
-      req.ParseFromString(serialized_req);
-
-      address_keyset_map addr_keyset_map;
-      // keep track of which key should be removed
-      unordered_set<string> remove_set;
+      const communication::Replication_Factor_Request& req = *req_ptr;
 
       // for every key, update the replication factor and 
       // check if the node is still responsible for the key
@@ -793,29 +1288,37 @@ void run(unsigned thread_id) {
       bool succeed;
       for (int i = 0; i < req.tuple_size(); i++) {
         string key = req.tuple(i).key();
-        if (key_stat_map.find(key) != key_stat_map.end()) {
-          auto orig_threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+        key_info changes;
+        for (int j = 0; j < req.tuple(i).global_size(); j++) {
+          changes.set_global_replication(req.tuple(i).global(j).tier_id(), req.tuple(i).global(j).global_replication());
+        }
+        for (int j = 0; j < req.tuple(i).local_size(); j++) {
+          changes.set_local_replication(req.tuple(i).local(j).ip(), req.tuple(i).local(j).local_replication());
+        }
+        auto stat = key_stat_map.find(key);
+        if (stat != key_stat_map.end()) {
+          key_hash_t key_hash = stat->second.hash_;
+          auto orig_threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, key_hash, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
           if (succeed) {
             bool decrement = false;
-            // update the replication factor
+            const key_info& orig = placement.get(key);
             for (int j = 0; j < req.tuple(i).global_size(); j++) {
-              if (req.tuple(i).global(j).global_replication() < placement[key].global_replication_map_[req.tuple(i).global(j).tier_id()]) {
+              if (req.tuple(i).global(j).global_replication() < orig.global_replication(req.tuple(i).global(j).tier_id())) {
                 decrement = true;
               }
-              placement[key].global_replication_map_[req.tuple(i).global(j).tier_id()] = req.tuple(i).global(j).global_replication();
             }
             for (int j = 0; j < req.tuple(i).local_size(); j++) {
-              if (req.tuple(i).local(j).local_replication() < placement[key].local_replication_map_[req.tuple(i).local(j).ip()]) {
+              if (req.tuple(i).local(j).local_replication() < orig.local_replication(req.tuple(i).local(j).ip())) {
                 decrement = true;
               }
-              placement[key].local_replication_map_[req.tuple(i).local(j).ip()] = req.tuple(i).local(j).local_replication();
             }
-            auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+            // update the replication factor
+            placement.merge(key, changes);
+            auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, key_hash, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
             if (succeed) {
               if (threads.find(wt) == threads.end()) {
-                remove_set.insert(key);
                 for (auto it = threads.begin(); it != threads.end(); it++) {
-                  addr_keyset_map[it->get_gossip_connect_addr()].insert(key);
+                  queue_transfer(key, *it, true, transfers, removal_refs, wt, transfer_count);
                 }
               }
               if (!decrement && orig_threads.begin()->get_id() == wt.get_id()) {
@@ -826,7 +1329,7 @@ void run(unsigned thread_id) {
                   }
                 }
                 for (auto it = new_threads.begin(); it != new_threads.end(); it++) {
-                  addr_keyset_map[it->get_gossip_connect_addr()].insert(key);
+                  queue_transfer(key, *it, false, transfers, removal_refs, wt, transfer_count);
                 }
               }
             } else {
@@ -835,82 +1338,193 @@ void run(unsigned thread_id) {
           } else {
             logger->info("Error: key missing replication factor in rep factor change routine");
             // just update the replication factor
-            for (int j = 0; j < req.tuple(i).global_size(); j++) {
-              placement[key].global_replication_map_[req.tuple(i).global(j).tier_id()] = req.tuple(i).global(j).global_replication();
-            }
-            for (int j = 0; j < req.tuple(i).local_size(); j++) {
-              placement[key].local_replication_map_[req.tuple(i).local(j).ip()] = req.tuple(i).local(j).local_replication();
-            }
+            placement.merge(key, changes);
           }
         } else {
           // just update the replication factor
-          for (int j = 0; j < req.tuple(i).global_size(); j++) {
-            placement[key].global_replication_map_[req.tuple(i).global(j).tier_id()] = req.tuple(i).global(j).global_replication();
-          }
-          for (int j = 0; j < req.tuple(i).local_size(); j++) {
-            placement[key].local_replication_map_[req.tuple(i).local(j).ip()] = req.tuple(i).local(j).local_replication();
-          }
+          placement.merge(key, changes);
         }
       }
 
-      send_gossip(addr_keyset_map, pushers, serializer);
-
-      // remove keys
-      for (auto it = remove_set.begin(); it != remove_set.end(); it++) {
-        key_stat_map.erase(*it);
-        serializer->remove(*it);
-        local_changeset.erase(*it);
-      }
+      replica_trees.clear();
       auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
       working_time += time_elapsed;
       working_time_map[6] += time_elapsed;
       //cerr << "thread " + to_string(thread_id) + " leaving event 7\n";
     }
 
-    gossip_end = chrono::system_clock::now();
-    if (chrono::duration_cast<chrono::microseconds>(gossip_end-gossip_start).count() >= PERIOD) {
-      //cerr << "thread " + to_string(thread_id) + " entering event gossip\n";
+    // receives a step of an anti-entropy exchange
+    if (pollitems[7].revents & ZMQ_POLLIN) {
       auto work_start = chrono::system_clock::now();
-      // only gossip if we have changes
-      if (local_changeset.size() > 0) {
-        address_keyset_map addr_keyset_map;
+      communication::Anti_Entropy message;
+      message.ParseFromString(zmq_util::recv_string(&anti_entropy_puller));
+      process_anti_entropy(message, wt, replica_trees, key_stat_map, global_hash_ring_map, local_hash_ring_map, placement, pushers, serializer, seed, membership.epoch());
+      auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
+      working_time += time_elapsed;
+      working_time_map[8] += time_elapsed;
+    }
 
-        vector<unsigned> tier_ids;
-        for (unsigned i = MIN_TIER; i <= MAX_TIER; i++) {
-          tier_ids.push_back(i);
+    // receives an ack for a transfer chunk
+    if (pollitems[8].revents & ZMQ_POLLIN) {
+      auto work_start = chrono::system_clock::now();
+      communication::Transfer_Ack ack;
+      ack.ParseFromString(zmq_util::recv_string(&transfer_ack_puller));
+      auto dropped = process_transfer_ack(ack, transfers, removal_refs, logger);
+      // drop the keys every new owner has, unless placement moved them back
+      vector<unsigned> tier_ids;
+      for (unsigned i = MIN_TIER; i <= MAX_TIER; i++) {
+        tier_ids.push_back(i);
+      }
+      bool succeed;
+      for (auto it = dropped.begin(); it != dropped.end(); it++) {
+        auto stat = key_stat_map.find(*it);
+        if (stat == key_stat_map.end()) {
+          continue;
         }
-        bool succeed;
-        for (auto it = local_changeset.begin(); it != local_changeset.end(); it++) {
-          string key = *it;
-          auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+        auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), *it, stat->second.hash_, is_metadata(*it), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+        if (succeed && threads.find(wt) == threads.end()) {
+          key_stat_map.erase(stat);
+          key_access_map.erase(*it);
+          serializer->remove(*it);
+          local_changeset.erase(*it);
+        }
+      }
+      auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
+      working_time += time_elapsed;
+      working_time_map[9] += time_elapsed;
+    }
+
+    // scan a few more buckets for keys that have to move; the scan yields once
+    // its time budget is spent so that requests keep being served
+    if (scan.active_) {
+      auto work_start = chrono::system_clock::now();
+      if (key_stat_map.bucket_count() != scan.bucket_count_) {
+        scan.start(key_stat_map.bucket_count(), scan.tier_ids_);
+      }
+      auto budget_end = work_start + chrono::microseconds(MIGRATION_TIME_BUDGET);
+      bool succeed;
+      while (scan.bucket_ < scan.bucket_count_ && chrono::system_clock::now() < budget_end) {
+        for (auto it = key_stat_map.begin(scan.bucket_); it != key_stat_map.end(scan.bucket_); it++) {
+          // already on its way to its owners
+          if (removal_refs.find(it->first) != removal_refs.end()) {
+            continue;
+          }
+          auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), it->first, it->second.hash_, is_metadata(it->first), global_hash_ring_map, local_hash_ring_map, placement, pushers, scan.tier_ids_, succeed, seed);
           if (succeed) {
-            for (auto iter = threads.begin(); iter != threads.end(); iter++) {
-              if (iter->get_id() != wt.get_id()) {
-                addr_keyset_map[iter->get_gossip_connect_addr()].insert(key);
+            if (threads.find(wt) == threads.end()) {
+              for (auto iter = threads.begin(); iter != threads.end(); iter++) {
+                queue_transfer(it->first, *iter, true, transfers, removal_refs, wt, transfer_count);
               }
             }
           } else {
-            logger->info("Error: key missing replication factor in gossip send routine");
+            logger->info("Error: key missing replication factor in migration routine");
           }
         }
+        scan.bucket_ += 1;
+      }
+      if (scan.bucket_ == scan.bucket_count_) {
+        scan.active_ = false;
+      }
+      auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
+      working_time += time_elapsed;
+      working_time_map[9] += time_elapsed;
+    }
 
-        send_gossip(addr_keyset_map, pushers, serializer);
-        local_changeset.clear();
+    // stream the next chunk of each rebalancing transfer
+    if (transfers.size() > 0) {
+      auto work_start = chrono::system_clock::now();
+      send_transfer_chunks(transfers, limiter, pushers, serializer, key_stat_map, wt, membership.epoch(), logger);
+      auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
+      working_time += time_elapsed;
+      working_time_map[9] += time_elapsed;
+    }
+    if (depart_ack_addr != "" && !scan.active_ && transfers.size() == 0) {
+      logger->info("Keys handed off, acknowledging departure");
+      zmq_util::send_string(ip + "_" + to_string(SELF_TIER_ID), &pushers[depart_ack_addr]);
+      depart_ack_addr = "";
+    }
+
+    // gossip the local writes once the oldest is stale or they exceed the byte
+    // or key budget, then send them a chunk per iteration so that a large flush
+    // does not hold up requests
+    if (local_changeset.due(chrono::system_clock::now())) {
+      local_changeset.drain(gossip_queue);
+    }
+    if (gossip_queue.size() > 0) {
+      //cerr << "thread " + to_string(thread_id) + " entering event gossip\n";
+      auto work_start = chrono::system_clock::now();
+      key_address_list key_addresses;
+
+      vector<unsigned> tier_ids;
+      for (unsigned i = MIN_TIER; i <= MAX_TIER; i++) {
+        tier_ids.push_back(i);
+      }
+      bool succeed;
+      unsigned chunk_keys = 0;
+      unsigned long long chunk_bytes = 0;
+      while (gossip_queue.size() > 0 && chunk_keys < GOSSIP_CHUNK_KEYS && chunk_bytes < GOSSIP_CHUNK_BYTES) {
+        string key = gossip_queue.back();
+        gossip_queue.pop_back();
+        auto stat = key_stat_map.find(key);
+        // the key moved away since it was written
+        if (stat == key_stat_map.end()) {
+          continue;
+        }
+        chunk_keys += 1;
+        chunk_bytes += stat->second.size_;
+        auto threads = get_responsible_threads(wt.get_replication_factor_connect_addr(), key, stat->second.hash_, is_metadata(key), global_hash_ring_map, local_hash_ring_map, placement, pushers, tier_ids, succeed, seed);
+        if (succeed) {
+          for (auto iter = threads.begin(); iter != threads.end(); iter++) {
+            if (iter->get_id() != wt.get_id()) {
+              key_addresses.push_back(make_pair(key, iter->get_gossip_connect_addr()));
+            }
+          }
+        } else {
+          logger->info("Error: key missing replication factor in gossip send routine");
+        }
       }
-      gossip_start = chrono::system_clock::now();
+
+      send_gossip(key_addresses, pushers, serializer, key_stat_map, membership.epoch());
       auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
       working_time += time_elapsed;
       working_time_map[7] += time_elapsed;
       //cerr << "thread " + to_string(thread_id) + " leaving event gossip\n";
     }
 
+    // gossip only carries the writes a thread makes itself, so lost gossip and
+    // keys that missed a migration are repaired by periodically comparing trees
+    // with one replica of a random key
+    if (chrono::duration_cast<chrono::seconds>(chrono::system_clock::now()-anti_entropy_start).count() >= ANTI_ENTROPY_PERIOD) {
+      auto work_start = chrono::system_clock::now();
+      if (key_stat_map.size() > 0) {
+        auto stat = next(begin(key_stat_map), rand_r(&seed) % key_stat_map.size());
+        auto peers = get_replica_peers(stat->first, stat->second.hash_, wt, global_hash_ring_map, local_hash_ring_map, placement, pushers, seed);
+        if (peers.size() > 0) {
+          server_thread_t peer = peers[rand_r(&seed) % peers.size()];
+          merkle_tree& tree = get_replica_tree(peer, wt, replica_trees, key_stat_map, global_hash_ring_map, local_hash_ring_map, placement, pushers, seed);
+          communication::Anti_Entropy message;
+          message.set_ip(wt.get_ip());
+          message.set_tid(wt.get_tid());
+          communication::Anti_Entropy_Node* node = message.add_node();
+          node->set_index(1);
+          node->set_digest(tree.root());
+          string serialized_message;
+          message.SerializeToString(&serialized_message);
+          zmq_util::send_string(serialized_message, &pushers[peer.get_anti_entropy_connect_addr()]);
+        }
+      }
+      anti_entropy_start = chrono::system_clock::now();
+      auto time_elapsed = chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now()-work_start).count();
+      working_time += time_elapsed;
+      working_time_map[8] += time_elapsed;
+    }
+
     report_end = chrono::system_clock::now();
     auto duration = chrono::duration_cast<chrono::seconds>(report_end-report_start).count();
     if (duration >= SERVER_REPORT_THRESHOLD) {
       //cerr << "thread " + to_string(thread_id) + " entering event report\n";
       // report server stats
       epoch += 1;
-      string key = wt.get_ip() + "_" + to_string(wt.get_tid()) + "_" + to_string(SELF_TIER_ID) + "_stat";
       // compute total storage consumption
       unsigned long long consumption = 0;
       for (auto it = key_stat_map.begin(); it != key_stat_map.end(); it++) {
@@ -935,18 +1549,18 @@ void run(unsigned thread_id) {
       stat.set_storage_consumption(consumption/1000);
       stat.set_occupancy(occupancy);
       stat.set_epoch(epoch);
-      string serialized_stat;
-      stat.SerializeToString(&serialized_stat);
-
-      communication::Request req;
-      req.set_type("PUT");
-      prepare_put_tuple(req, key, serialized_stat, 0);
-
-      auto threads = get_responsible_threads_metadata(key, global_hash_ring_map[1], local_hash_ring_map[1]);
-      if (threads.size() != 0) {
-        string target_address = next(begin(threads), rand_r(&seed) % threads.size())->get_request_pulling_connect_addr();
-        push_request(req, pushers[target_address]);
+      unsigned long long transfer_keys_remaining = 0;
+      unsigned long long transfer_bytes_sent = 0;
+      for (auto it = transfers.begin(); it != transfers.end(); it++) {
+        transfer_keys_remaining += it->second.keys_.size() - it->second.acked_;
+        transfer_bytes_sent += it->second.bytes_sent_;
+        it->second.bytes_sent_ = 0;
       }
+      stat.set_transfer_keys_remaining(transfer_keys_remaining);
+      stat.set_transfer_bytes_sent(transfer_bytes_sent);
+      queue_latency.to_proto(*stat.mutable_queue_latency());
+      service_latency.to_proto(*stat.mutable_service_latency());
+      request_latency.to_proto(*stat.mutable_latency());
 
       /*if (epoch % 50 == 1) {
         for (auto it = key_stat_map.begin(); it != key_stat_map.end(); it++) {
@@ -955,42 +1569,27 @@ void run(unsigned thread_id) {
       }*/
       // compute key access stats
       communication::Key_Access access;
-      auto current_time = chrono::system_clock::now();
-      for (auto it = key_access_timestamp.begin(); it != key_access_timestamp.end(); it++) {
-        string key = it->first;
-        auto mset = &(it->second);
-        // garbage collect
-        for (auto set_iter = mset->rbegin(); set_iter != mset->rend(); set_iter++) {
-          if (chrono::duration_cast<std::chrono::seconds>(current_time-*set_iter).count() >= KEY_MONITORING_THRESHOLD) {
-            mset->erase(mset->begin(), set_iter.base());
-            break;
-          }
-        }
-        // update key_access_frequency
-        communication::Key_Access_Tuple* tp = access.add_tuple();
-        tp->set_key(key);
-        tp->set_access(mset->size());
-      }
-      // report key access stats
-      key = wt.get_ip() + "_" + to_string(wt.get_tid()) + "_" + to_string(SELF_TIER_ID) + "_access";
-      string serialized_access;
-      access.SerializeToString(&serialized_access);
-      req.Clear();
-      req.set_type("PUT");
-      prepare_put_tuple(req, key, serialized_access, 0);
-
-      threads = get_responsible_threads_metadata(key, global_hash_ring_map[1], local_hash_ring_map[1]);
-      if (threads.size() != 0) {
-        string target_address = next(begin(threads), rand_r(&seed) % threads.size())->get_request_pulling_connect_addr();
-        push_request(req, pushers[target_address]);
-      }
+      summarize_access(key_access_map, key_stat_map, cold_cursor, access_counter::current_time(), access);
+      // push the stats straight to the monitoring node
+      communication::Stats_Frame frame;
+      frame.set_ip(wt.get_ip());
+      frame.set_tid(wt.get_tid());
+      frame.set_tier_id(SELF_TIER_ID);
+      stats.encode(stat, access, frame);
+      string serialized_frame;
+      frame.SerializeToString(&serialized_frame);
+      zmq_util::send_string(serialized_frame, &pushers[mt.get_stats_connect_addr()]);
 
       report_start = chrono::system_clock::now();
       // reset
       working_time = 0;
-      for (unsigned i = 0; i < 8; i++) {
+      for (unsigned i = 0; i < 10; i++) {
         working_time_map[i] = 0;
       }
+      queue_latency.clear();
+      service_latency.clear();
+      request_latency.clear();
+      receiver.expire();
       //cerr << "thread " + to_string(thread_id) + " leaving event report\n";
     }
 
@@ -1006,6 +1605,7 @@ void run(unsigned thread_id) {
     for (auto it = remove_set.begin(); it != remove_set.end(); it++) {
       pending_request_map.erase(*it);
     }*/
+    retry_deadline = chrono::system_clock::time_point::max();
     for (auto it = pending_gossip_map.begin(); it != pending_gossip_map.end(); it++) {
       auto t = chrono::duration_cast<chrono::seconds>(chrono::system_clock::now()-it->second.first).count();
       if (t > RETRY_THRESHOLD) {
@@ -1015,6 +1615,7 @@ void run(unsigned thread_id) {
         // refresh time
         it->second.first = chrono::system_clock::now();
       }
+      retry_deadline = min(retry_deadline, it->second.first + chrono::seconds(RETRY_THRESHOLD + 1));
     }
   }
 }
@@ -1040,12 +1641,23 @@ int main(int argc, char* argv[]) {
   // debugging
   cerr << "worker thread number is " + to_string(THREAD_NUM) + "\n";
 
+  // the zmq context is shared by all worker threads, so its I/O threads are
+  // kept on the NUMA node of thread 0. zmq only starts them when the first
+  // socket is created, which would otherwise happen after the creating thread
+  // is bound to its core, so a throwaway socket starts them while this thread
+  // is bound to the whole node
+  bind_to_node(assign_core(0));
+  zmq::context_t context((THREAD_NUM + WORKERS_PER_IO_THREAD - 1) / WORKERS_PER_IO_THREAD);
+  {
+    zmq::socket_t io_thread_starter(context, ZMQ_PUSH);
+  }
+
   vector<thread> worker_threads;
 
   // start the initial threads based on THREAD_NUM
   for (unsigned thread_id = 1; thread_id < THREAD_NUM; thread_id++) {
-    worker_threads.push_back(thread(run, thread_id));
+    worker_threads.push_back(thread(run, thread_id, &context));
   }
 
-  run(0);
+  run(0, &context);
 }
\ No newline at end of file
@@ -2,6 +2,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include "test_KVS.h"
+#include "test_consistent_hash_map.h"
+#include "test_bounded_load.h"
+#include "test_key_hash.h"
+#include "test_rendezvous_hash.h"
+#include "test_membership_log.h"
+#include "test_merkle_tree.h"
+#include "test_access_counter.h"
+#include "test_stats_frame.h"
+#include "test_access_aggregator.h"
+#include "test_access_forecast.h"
+#include "test_latency_histogram.h"
+#include "test_management_client.h"
+#include "test_placement_table.h"
+#include "test_transfer_receiver.h"
 
 int main (int argc, char *argv[])
 {
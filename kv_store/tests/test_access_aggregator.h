@@ -0,0 +1,50 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "access_aggregator.h"
+
+TEST(AccessAggregatorTest, SumsThreadCounts) {
+	access_aggregator aggregator;
+	aggregator.update("a:0", "k", 3, 1);
+	aggregator.update("b:0", "k", 4, 1);
+	EXPECT_EQ(7, aggregator.total("k"));
+	aggregator.update("a:0", "k", 1, 1);
+	EXPECT_EQ(5, aggregator.total("k"));
+	aggregator.erase("b:0", "k");
+	EXPECT_EQ(1, aggregator.total("k"));
+	aggregator.remove_thread("a:0");
+	EXPECT_EQ(0, aggregator.size());
+	EXPECT_EQ(0, aggregator.keys(1).size());
+}
+
+TEST(AccessAggregatorTest, ColdKeysStayIndexed) {
+	access_aggregator aggregator;
+	// a key reported with no accesses is a demotion candidate
+	aggregator.update("a:0", "k", 0, 1);
+	EXPECT_EQ(1, aggregator.size());
+	const access_aggregator::index_t& index = aggregator.keys(1);
+	EXPECT_EQ(index.begin(), access_aggregator::below_end(index, 0));
+	EXPECT_EQ(1, distance(index.begin(), access_aggregator::below_end(index, 1)));
+}
+
+TEST(AccessAggregatorTest, IndexesByThresholdAndReplication) {
+	access_aggregator aggregator;
+	aggregator.update("a:0", "cold", 0, 1);
+	aggregator.update("a:0", "warm", 5, 0);
+	aggregator.update("a:0", "hot", 50, 0);
+	const access_aggregator::index_t& ebs = aggregator.keys(0);
+	auto it = access_aggregator::above(ebs, 5);
+	ASSERT_NE(ebs.end(), it);
+	EXPECT_EQ("hot", it->second);
+	EXPECT_EQ(ebs.end(), ++it);
+
+	aggregator.set_memory_replication("hot", 1);
+	EXPECT_EQ(1, aggregator.keys(0).size());
+	EXPECT_EQ(2, aggregator.keys(1).size());
+	// the new replication survives a count change
+	aggregator.update("b:0", "hot", 10, 0);
+	EXPECT_EQ(60, aggregator.total("hot"));
+	EXPECT_EQ("hot", aggregator.keys(1).rbegin()->second);
+	EXPECT_EQ(2, aggregator.memory_replications().size());
+}
@@ -0,0 +1,34 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "access_counter.h"
+
+TEST(AccessCounterTest, CountsWithinWindow) {
+	access_counter counter;
+	counter.record(1000);
+	counter.record(1000);
+	counter.record(1100);
+	EXPECT_EQ(3, counter.count(1100));
+	EXPECT_EQ(3, counter.count(1000 + KEY_MONITORING_THRESHOLD - 120));
+}
+
+TEST(AccessCounterTest, OldBucketsExpire) {
+	access_counter counter;
+	unsigned long long width = KEY_MONITORING_THRESHOLD / ACCESS_BUCKET_NUMBER;
+	counter.record(0);
+	counter.record(5 * width);
+	EXPECT_EQ(2, counter.count(5 * width));
+	// the first access falls out of the window before the second
+	EXPECT_EQ(1, counter.count(ACCESS_BUCKET_NUMBER * width));
+	EXPECT_EQ(0, counter.count((ACCESS_BUCKET_NUMBER + 5) * width));
+}
+
+TEST(AccessCounterTest, RecordClearsStaleBuckets) {
+	access_counter counter;
+	unsigned long long width = KEY_MONITORING_THRESHOLD / ACCESS_BUCKET_NUMBER;
+	counter.record(0);
+	counter.record(0);
+	counter.record(3 * ACCESS_BUCKET_NUMBER * width);
+	EXPECT_EQ(1, counter.count(3 * ACCESS_BUCKET_NUMBER * width));
+}
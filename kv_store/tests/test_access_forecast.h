@@ -0,0 +1,58 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "access_forecast.h"
+
+TEST(AccessForecastTest, RisingCountsPredictHigher) {
+	access_forecast forecast;
+	for (unsigned epoch = 0; epoch < 10; epoch++) {
+		forecast.observe("k", 10 * epoch, epoch);
+	}
+	EXPECT_GT(forecast.predict("k", 9), 90);
+	EXPECT_EQ(0, forecast.predict("missing", 9));
+}
+
+TEST(AccessForecastTest, UnchangedKeyMatchesStepwiseSmoothing) {
+	access_forecast lazy;
+	access_forecast stepwise;
+	lazy.observe("k", 100, 0);
+	stepwise.observe("k", 100, 0);
+	lazy.observe("k", 0, 1);
+	stepwise.observe("k", 0, 1);
+	// a dropped count fades out instead of vanishing at once
+	EXPECT_GT(lazy.predict("k", 1), 0);
+	// the count stays 0, but only one forecast hears about it every epoch
+	for (unsigned epoch = 2; epoch <= 6; epoch++) {
+		stepwise.observe("k", 0, epoch);
+	}
+	lazy.observe("k", 10, 7);
+	stepwise.observe("k", 10, 7);
+	EXPECT_NEAR(stepwise.predict("k", 7), lazy.predict("k", 7), 1e-9);
+}
+
+TEST(AccessForecastTest, TracksMoves) {
+	access_forecast forecast;
+	forecast.observe("k", 1, 0);
+	EXPECT_EQ(-1, forecast.since_moved("k", 3));
+	forecast.set_moved("k", 3);
+	EXPECT_EQ(2, forecast.since_moved("k", 5));
+	forecast.erase("k");
+	EXPECT_EQ(0, forecast.size());
+}
+
+TEST(AccessForecastTest, ExpiresSettledIdleKeys) {
+	access_forecast forecast;
+	forecast.observe("idle", 10, 0);
+	forecast.observe("idle", 0, 1);
+	forecast.observe("moved", 10, 0);
+	forecast.observe("moved", 0, 1);
+	forecast.set_moved("moved", 10);
+	forecast.observe("busy", 10, 0);
+	forecast.expire(1 + FORECAST_SETTLE_EPOCHS);
+	EXPECT_EQ(3, forecast.size());
+	forecast.expire(2 + FORECAST_SETTLE_EPOCHS);
+	EXPECT_EQ(2, forecast.size());
+	EXPECT_EQ(-1, forecast.since_moved("idle", 2 + FORECAST_SETTLE_EPOCHS));
+	EXPECT_EQ(FORECAST_SETTLE_EPOCHS - 8, forecast.since_moved("moved", 2 + FORECAST_SETTLE_EPOCHS));
+}
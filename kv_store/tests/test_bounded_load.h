@@ -0,0 +1,102 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "consistent_hash_map.hpp"
+#include "bounded_load.h"
+
+// a node with a number of virtual nodes; virtual nodes of the same node
+// compare equal
+struct load_node_t {
+	load_node_t(unsigned id, unsigned virtual_num) : id_(id), virtual_num_(virtual_num) {}
+	unsigned id_;
+	unsigned virtual_num_;
+};
+
+bool operator==(const load_node_t& l, const load_node_t& r) {
+	return l.id_ == r.id_;
+}
+
+struct load_hasher {
+	uint32_t operator()(const load_node_t& node) {
+		return get_key_hash(to_string(node.id_) + "_" + to_string(node.virtual_num_));
+	}
+	uint32_t operator()(const string& key) {
+		return get_key_hash(key);
+	}
+	typedef uint32_t result_type;
+};
+
+typedef consistent_hash_map<load_node_t, load_hasher> load_ring_t;
+
+class BoundedLoadTest : public ::testing::Test {
+protected:
+	load_ring_t ring;
+	BoundedLoadTest() {
+		for (unsigned id = 0; id < 5; id++) {
+			vector<load_node_t> virtual_nodes;
+			for (unsigned i = 0; i < 50; i++) {
+				virtual_nodes.push_back(load_node_t(id, i));
+			}
+			ring.insert(virtual_nodes);
+		}
+	}
+	// the ids of the replicas of key
+	vector<unsigned> replicas(const string& key, unsigned count) {
+		auto node_ids = bounded_load_replicas(ring, get_key_hash(key), count, [](const load_node_t& node) { return node.id_; });
+		vector<unsigned> ids;
+		for (auto it = node_ids.begin(); it != node_ids.end(); it++) {
+			ids.push_back(ring.node(*it).id_);
+		}
+		return ids;
+	}
+};
+
+TEST_F(BoundedLoadTest, NoSheddingFollowsTheRing) {
+	for (unsigned i = 0; i < 1000; i++) {
+		string key = "key_" + to_string(i);
+		auto ids = replicas(key, 3);
+		auto pos = ring.find(key);
+		auto preference = ring.preference_list(pos);
+		ASSERT_EQ(3, ids.size());
+		for (unsigned j = 0; j < 3; j++) {
+			EXPECT_EQ(ring.node(preference[j]).id_, ids[j]);
+		}
+	}
+}
+
+TEST_F(BoundedLoadTest, SkipsANodeThatShedsTheKey) {
+	ring.set_shed(load_node_t(2, 0), LOAD_SHED_SCALE);
+	for (unsigned i = 0; i < 1000; i++) {
+		auto ids = replicas("key_" + to_string(i), 3);
+		ASSERT_EQ(3, ids.size());
+		EXPECT_EQ(ids.end(), find(ids.begin(), ids.end(), 2));
+	}
+}
+
+TEST_F(BoundedLoadTest, FallsBackWhenTooFewNodesKeepTheKey) {
+	for (unsigned id = 1; id < 5; id++) {
+		ring.set_shed(load_node_t(id, 0), LOAD_SHED_SCALE);
+	}
+	for (unsigned i = 0; i < 1000; i++) {
+		auto ids = replicas("key_" + to_string(i), 3);
+		ASSERT_EQ(3, ids.size());
+		// the only node that keeps the key comes first
+		EXPECT_EQ(0, ids[0]);
+	}
+	// every node sheds the key, so the replicas are the nodes on the ring
+	ring.set_shed(load_node_t(0, 0), LOAD_SHED_SCALE);
+	auto ids = replicas("key", 5);
+	EXPECT_EQ(5, ids.size());
+}
+
+TEST_F(BoundedLoadTest, ShedsTheRequestedShare) {
+	unsigned shed = 0;
+	for (unsigned i = 0; i < 100000; i++) {
+		if (sheds_key(get_key_hash("key_" + to_string(i)), 7, LOAD_SHED_SCALE / 4)) {
+			shed += 1;
+		}
+	}
+	EXPECT_GT(shed, 24000);
+	EXPECT_LT(shed, 26000);
+}
@@ -0,0 +1,178 @@
+#include <map>
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "consistent_hash_map.hpp"
+
+// a physical node with a number of virtual nodes; virtual nodes of the same
+// physical node compare equal
+struct test_node_t {
+	test_node_t(unsigned id, unsigned virtual_num) : id_(id), virtual_num_(virtual_num) {}
+	unsigned id_;
+	unsigned virtual_num_;
+};
+
+bool operator==(const test_node_t& l, const test_node_t& r) {
+	return l.id_ == r.id_;
+}
+
+struct test_hasher {
+	uint32_t operator()(const test_node_t& node) {
+		return hash<string>{}(to_string(node.id_) + "_" + to_string(node.virtual_num_));
+	}
+	uint32_t operator()(const string& key) {
+		return hash<string>{}(key);
+	}
+	typedef uint32_t result_type;
+};
+
+typedef consistent_hash_map<test_node_t, test_hasher> test_ring_t;
+
+class ConsistentHashMapTest : public ::testing::Test {
+protected:
+	test_ring_t ring;
+	map<uint32_t, unsigned> reference;
+	void insert_node(unsigned id, unsigned virtual_count) {
+		vector<test_node_t> virtual_nodes;
+		for (unsigned i = 0; i < virtual_count; i++) {
+			virtual_nodes.push_back(test_node_t(id, i));
+			reference.insert(make_pair(test_hasher()(virtual_nodes.back()), id));
+		}
+		ring.insert(virtual_nodes);
+	}
+	void remove_node(unsigned id, unsigned virtual_count) {
+		vector<test_node_t> virtual_nodes;
+		for (unsigned i = 0; i < virtual_count; i++) {
+			virtual_nodes.push_back(test_node_t(id, i));
+		}
+		ring.erase(virtual_nodes);
+		for (auto it = reference.begin(); it != reference.end();) {
+			if (it->second == id) {
+				it = reference.erase(it);
+			} else {
+				it++;
+			}
+		}
+	}
+	// the ring must agree with a map based ring for every lookup
+	void check_lookups() {
+		ASSERT_EQ(reference.size(), ring.size());
+		for (unsigned i = 0; i < 10000; i++) {
+			uint32_t hash = rand();
+			auto expected = reference.lower_bound(hash);
+			if (expected == reference.end()) {
+				expected = reference.begin();
+			}
+			auto actual = ring.find(hash);
+			EXPECT_EQ(expected->first, actual->first);
+			EXPECT_EQ(expected->second, actual->second.id_);
+		}
+	}
+};
+
+TEST_F(ConsistentHashMapTest, Empty) {
+	EXPECT_TRUE(ring.empty());
+	EXPECT_TRUE(ring.find("key") == ring.end());
+}
+
+TEST_F(ConsistentHashMapTest, Lookup) {
+	for (unsigned id = 0; id < 10; id++) {
+		insert_node(id, 100);
+	}
+	EXPECT_EQ(10, ring.nodes().size());
+	check_lookups();
+}
+
+TEST_F(ConsistentHashMapTest, Iteration) {
+	for (unsigned id = 0; id < 5; id++) {
+		insert_node(id, 50);
+	}
+	auto expected = reference.begin();
+	for (auto it = ring.begin(); it != ring.end(); it++) {
+		EXPECT_EQ(expected->first, it->first);
+		EXPECT_EQ(expected->second, it->second.id_);
+		expected++;
+	}
+	EXPECT_TRUE(expected == reference.end());
+}
+
+TEST_F(ConsistentHashMapTest, InsertExisting) {
+	insert_node(0, 100);
+	vector<test_node_t> virtual_nodes;
+	for (unsigned i = 0; i < 100; i++) {
+		virtual_nodes.push_back(test_node_t(0, i));
+	}
+	EXPECT_EQ(0, ring.insert(virtual_nodes));
+	EXPECT_EQ(100, ring.size());
+}
+
+TEST_F(ConsistentHashMapTest, Erase) {
+	for (unsigned id = 0; id < 10; id++) {
+		insert_node(id, 100);
+	}
+	remove_node(3, 100);
+	remove_node(7, 100);
+	EXPECT_EQ(8, ring.nodes().size());
+	check_lookups();
+	remove_node(3, 100);
+	check_lookups();
+	insert_node(3, 100);
+	check_lookups();
+}
+
+TEST_F(ConsistentHashMapTest, PreferenceList) {
+	for (unsigned id = 0; id < 10; id++) {
+		insert_node(id, 100);
+	}
+	ASSERT_EQ(min(10, MAX_PREFERENCE_LIST_SIZE), ring.preference_list_size());
+	// every list must match a walk over the ring that skips repeated nodes
+	for (auto it = ring.begin(); it != ring.end(); it++) {
+		vector<unsigned> expected;
+		auto pos = it;
+		while (expected.size() < ring.preference_list_size()) {
+			if (find(expected.begin(), expected.end(), pos->second.id_) == expected.end()) {
+				expected.push_back(pos->second.id_);
+			}
+			if (++pos == ring.end()) {
+				pos = ring.begin();
+			}
+		}
+		auto node_ids = ring.preference_list(it);
+		for (unsigned i = 0; i < expected.size(); i++) {
+			EXPECT_EQ(expected[i], ring.node(node_ids[i]).id_);
+		}
+	}
+	remove_node(4, 100);
+	auto node_ids = ring.preference_list(ring.find("key"));
+	for (unsigned i = 0; i < ring.preference_list_size(); i++) {
+		EXPECT_NE(4, ring.node(node_ids[i]).id_);
+	}
+}
+
+TEST_F(ConsistentHashMapTest, PreferenceListFewNodes) {
+	insert_node(0, 100);
+	insert_node(1, 100);
+	ASSERT_EQ(2, ring.preference_list_size());
+	auto node_ids = ring.preference_list(ring.find("key"));
+	EXPECT_NE(node_ids[0], node_ids[1]);
+}
+
+TEST_F(ConsistentHashMapTest, ShedFollowsNode) {
+	insert_node(1, 50);
+	insert_node(2, 50);
+	insert_node(3, 50);
+	EXPECT_FALSE(ring.shedding());
+	ring.set_shed(test_node_t(3, 0), 100);
+	EXPECT_TRUE(ring.shedding());
+	// erasing node 1 renumbers the remaining nodes
+	remove_node(1, 50);
+	for (auto it = ring.begin(); it != ring.end(); it++) {
+		EXPECT_EQ(it->second.id_ == 3 ? 100 : 0, ring.shed(ring.node_id(it)));
+	}
+	remove_node(3, 50);
+	EXPECT_FALSE(ring.shedding());
+	// a node joining again starts without shedding
+	insert_node(3, 50);
+	EXPECT_FALSE(ring.shedding());
+}
@@ -0,0 +1,20 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "key_hash.h"
+
+TEST(KeyHashTest, Metadata) {
+	EXPECT_FALSE(is_metadata("00001234"));
+	EXPECT_FALSE(is_metadata("k"));
+	EXPECT_FALSE(is_metadata(""));
+	EXPECT_TRUE(is_metadata("k_replication"));
+	EXPECT_TRUE(is_metadata("_k"));
+	EXPECT_FALSE(is_metadata("k_"));
+}
+
+TEST(KeyHashTest, Crc32c) {
+	// the standard CRC-32C check value
+	EXPECT_EQ(0xE3069283u, get_key_hash("123456789"));
+	EXPECT_EQ(get_key_hash("00001234"), get_key_hash(string("00001234")));
+}
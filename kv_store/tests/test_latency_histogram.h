@@ -0,0 +1,47 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "latency_histogram.h"
+
+TEST(LatencyHistogramTest, BucketsCoverTheirValues) {
+	for (uint64_t value = 0; value < 100000; value++) {
+		unsigned index = latency_histogram::bucket(value);
+		EXPECT_LE(value, latency_histogram::bucket_upper(index));
+		if (index > 0) {
+			EXPECT_GT(value, latency_histogram::bucket_upper(index - 1));
+		}
+	}
+	EXPECT_EQ(latency_histogram::bucket_number() - 1, latency_histogram::bucket(~0ULL));
+}
+
+TEST(LatencyHistogramTest, PercentileIsWithinRelativeError) {
+	latency_histogram histogram;
+	EXPECT_EQ(0, histogram.percentile(0.99));
+	for (uint64_t value = 1; value <= 1000; value++) {
+		histogram.record(value);
+	}
+	EXPECT_EQ(1000, histogram.count());
+	uint64_t p50 = histogram.percentile(0.5);
+	EXPECT_GE(p50, 500);
+	EXPECT_LE(p50, 500 + 500 / 8);
+	uint64_t p99 = histogram.percentile(0.99);
+	EXPECT_GE(p99, 990);
+	EXPECT_LE(p99, 990 + 990 / 8);
+}
+
+TEST(LatencyHistogramTest, MergesThroughProto) {
+	latency_histogram fast;
+	latency_histogram slow;
+	fast.record(10, 99);
+	slow.record(5000);
+	communication::Latency_Histogram message;
+	slow.to_proto(message);
+	EXPECT_EQ(1, message.bucket_size());
+	fast.merge(message);
+	EXPECT_EQ(100, fast.count());
+	EXPECT_EQ(10, fast.percentile(0.5));
+	EXPECT_GE(fast.percentile(0.999), 5000);
+	fast.clear();
+	EXPECT_EQ(0, fast.count());
+}
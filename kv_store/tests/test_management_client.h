@@ -0,0 +1,124 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include "gtest/gtest.h"
+#include "management_client.h"
+
+// a local stand-in for the management server that answers each connection
+// with the next status in statuses and records the request lines
+class stub_management_server {
+	int fd_;
+	unsigned port_;
+	vector<int> statuses_;
+	vector<string> requests_;
+	thread thread_;
+
+	void serve() {
+		for (unsigned i = 0; i < statuses_.size(); i++) {
+			int connection = accept(fd_, NULL, NULL);
+			if (connection < 0) {
+				return;
+			}
+			string request;
+			char buffer[512];
+			while (request.find("\r\n\r\n") == string::npos) {
+				ssize_t n = recv(connection, buffer, sizeof(buffer), 0);
+				if (n <= 0) {
+					break;
+				}
+				request.append(buffer, n);
+			}
+			requests_.push_back(request.substr(0, request.find("\r\n")));
+			string response = "HTTP/1.0 " + to_string(statuses_[i]) + " Stub\r\n\r\n";
+			send(connection, response.data(), response.size(), MSG_NOSIGNAL);
+			close(connection);
+		}
+	}
+
+public:
+	stub_management_server(const vector<int>& statuses) : statuses_(statuses) {
+		fd_ = socket(AF_INET, SOCK_STREAM, 0);
+		struct sockaddr_in address;
+		memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = 0;
+		bind(fd_, (struct sockaddr*) &address, sizeof(address));
+		listen(fd_, 4);
+		socklen_t length = sizeof(address);
+		getsockname(fd_, (struct sockaddr*) &address, &length);
+		port_ = ntohs(address.sin_port);
+		thread_ = thread(&stub_management_server::serve, this);
+	}
+
+	~stub_management_server() {
+		shutdown(fd_, SHUT_RDWR);
+		thread_.join();
+		close(fd_);
+	}
+
+	string address() const {
+		return "127.0.0.1:" + to_string(port_);
+	}
+
+	// only safe once every expected request completed
+	const vector<string>& requests() const {
+		return requests_;
+	}
+};
+
+// run callbacks until none is pending or the deadline passes
+void wait_for_completion(management_client& client) {
+	for (unsigned i = 0; i < 500 && client.pending() > 0; i++) {
+		client.complete();
+		this_thread::sleep_for(chrono::milliseconds(10));
+	}
+}
+
+TEST(ManagementClientTest, RetriesServerErrors) {
+	stub_management_server server({500, 200, 200});
+	management_client client(server.address(), 1000, 10);
+	vector<int> statuses;
+	client.post("/add/memory/2", [&statuses](int status) { statuses.push_back(status); });
+	client.post("/remove/ebs/10.0.0.1", [&statuses](int status) { statuses.push_back(status); });
+	EXPECT_EQ(2, client.pending());
+	wait_for_completion(client);
+	ASSERT_EQ(2, statuses.size());
+	EXPECT_EQ(200, statuses[0]);
+	EXPECT_EQ(200, statuses[1]);
+	// the requests are sent concurrently, so either may have drawn the 500
+	const vector<string>& requests = server.requests();
+	ASSERT_EQ(3, requests.size());
+	unsigned adds = count(requests.begin(), requests.end(), "POST /add/memory/2 HTTP/1.1");
+	unsigned removes = count(requests.begin(), requests.end(), "POST /remove/ebs/10.0.0.1 HTTP/1.1");
+	EXPECT_GE(adds, 1);
+	EXPECT_GE(removes, 1);
+	EXPECT_EQ(3, adds + removes);
+}
+
+TEST(ManagementClientTest, GivesUpAfterRetries) {
+	stub_management_server server({503, 503, 503});
+	management_client client(server.address(), 1000, 10);
+	int result = -1;
+	client.post("/add/ebs/1", [&result](int status) { result = status; });
+	wait_for_completion(client);
+	EXPECT_EQ(503, result);
+	EXPECT_EQ(MANAGEMENT_RETRY, server.requests().size());
+}
+
+TEST(ManagementClientTest, ReportsUnreachableServer) {
+	unsigned port;
+	{
+		stub_management_server server({});
+		port = stoi(server.address().substr(server.address().rfind(':') + 1));
+	}
+	management_client client("127.0.0.1:" + to_string(port), 1000, 10);
+	int result = -1;
+	client.post("/add/memory/1", [&result](int status) { result = status; });
+	wait_for_completion(client);
+	EXPECT_EQ(0, result);
+	EXPECT_EQ(0, client.pending());
+}
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "membership_log.h"
+
+communication::Membership_Delta make_delta(unsigned long long epoch, bool join, string ip) {
+	communication::Membership_Delta delta;
+	delta.set_epoch(epoch);
+	delta.set_join(join);
+	delta.set_tier_id(1);
+	delta.set_ip(ip);
+	return delta;
+}
+
+TEST(MembershipLogTest, InOrder) {
+	membership_log log(3);
+	auto ready = log.add(make_delta(4, true, "a"));
+	ASSERT_EQ(1, ready.size());
+	EXPECT_EQ("a", ready[0].ip());
+	EXPECT_EQ(4, log.epoch());
+	EXPECT_FALSE(log.has_gap());
+}
+
+TEST(MembershipLogTest, HoldsBackUntilGapFilled) {
+	membership_log log(3);
+	EXPECT_EQ(0, log.add(make_delta(6, true, "c")).size());
+	EXPECT_EQ(0, log.add(make_delta(5, false, "b")).size());
+	EXPECT_TRUE(log.has_gap());
+	EXPECT_EQ(6, log.newest_epoch());
+
+	auto ready = log.add(make_delta(4, true, "a"));
+	ASSERT_EQ(3, ready.size());
+	EXPECT_EQ("a", ready[0].ip());
+	EXPECT_EQ("b", ready[1].ip());
+	EXPECT_EQ("c", ready[2].ip());
+	EXPECT_EQ(6, log.epoch());
+	EXPECT_FALSE(log.has_gap());
+}
+
+TEST(MembershipLogTest, DropsDuplicatesAndStale) {
+	membership_log log(3);
+	EXPECT_EQ(0, log.add(make_delta(2, true, "old")).size());
+	EXPECT_EQ(1, log.add(make_delta(4, true, "a")).size());
+	EXPECT_EQ(0, log.add(make_delta(4, true, "a")).size());
+	EXPECT_EQ(4, log.epoch());
+}
+
+TEST(MembershipLogTest, AppendAndResend) {
+	membership_log sequencer;
+	sequencer.append(true, 1, "a");
+	sequencer.append(true, 2, "b");
+	sequencer.append(false, 1, "a");
+	EXPECT_EQ(3, sequencer.epoch());
+
+	communication::Membership missed;
+	sequencer.get_deltas_since(1, missed);
+	ASSERT_EQ(2, missed.delta_size());
+	EXPECT_EQ(2, missed.delta(0).epoch());
+	EXPECT_EQ(3, missed.delta(1).epoch());
+	EXPECT_FALSE(missed.delta(1).join());
+}
+
+TEST(MembershipLogTest, SyncRequestedOncePerEpoch) {
+	membership_log log(3);
+	EXPECT_FALSE(log.need_sync(3));
+	EXPECT_TRUE(log.need_sync(5));
+	EXPECT_FALSE(log.need_sync(5));
+	EXPECT_FALSE(log.need_sync(4));
+	EXPECT_TRUE(log.need_sync(6));
+}
+
+TEST(MembershipLogTest, SyncRequestedAgainAfterTimeout) {
+	membership_log log(3);
+	auto now = chrono::steady_clock::now();
+	EXPECT_TRUE(log.need_sync(5, now));
+	EXPECT_FALSE(log.need_sync(5, now + chrono::milliseconds(MEMBERSHIP_SYNC_TIMEOUT - 1)));
+	EXPECT_TRUE(log.need_sync(5, now + chrono::milliseconds(MEMBERSHIP_SYNC_TIMEOUT)));
+	log.add(make_delta(4, true, "a"));
+	log.add(make_delta(5, true, "b"));
+	EXPECT_FALSE(log.need_sync(5, now + chrono::milliseconds(3 * MEMBERSHIP_SYNC_TIMEOUT)));
+}
+
+TEST(MembershipLogTest, DropsAppliedChanges) {
+	membership_log log(3);
+	log.add(make_delta(4, true, "a"));
+	log.add(make_delta(6, true, "c"));
+	EXPECT_EQ(1, log.size());
+	log.add(make_delta(5, true, "b"));
+	EXPECT_EQ(0, log.size());
+	EXPECT_EQ(6, log.epoch());
+
+	membership_log sequencer;
+	sequencer.append(true, 1, "a");
+	sequencer.append(true, 1, "b");
+	EXPECT_EQ(2, sequencer.size());
+}
@@ -0,0 +1,48 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "merkle_tree.h"
+
+TEST(MerkleTreeTest, OrderIndependent) {
+	merkle_tree a, b;
+	a.toggle(0x12345678, 10);
+	a.toggle(0x92345678, 20);
+	b.toggle(0x92345678, 20);
+	b.toggle(0x12345678, 10);
+	EXPECT_EQ(a.root(), b.root());
+	EXPECT_NE(merkle_tree().root(), a.root());
+}
+
+TEST(MerkleTreeTest, ToggleRemoves) {
+	merkle_tree tree;
+	uint64_t empty = tree.root();
+	tree.toggle(0xdeadbeef, 7);
+	tree.toggle(0xdeadbeef, 7);
+	EXPECT_EQ(empty, tree.root());
+}
+
+TEST(MerkleTreeTest, UpdateMatchesRebuild) {
+	merkle_tree updated, rebuilt;
+	updated.toggle(0x12345678, 10);
+	updated.update(0x12345678, 10, 30);
+	rebuilt.toggle(0x12345678, 30);
+	EXPECT_EQ(rebuilt.root(), updated.root());
+}
+
+TEST(MerkleTreeTest, DifferenceIsConfinedToOneLeaf) {
+	merkle_tree a, b;
+	a.toggle(0x12345678, 10);
+	b.toggle(0x12345678, 11);
+	unsigned leaf = a.leaf(0x12345678);
+	for (unsigned node = a.leaf_begin(); node < a.leaf_end(); node++) {
+		if (node == leaf) {
+			EXPECT_NE(a.digest(node), b.digest(node));
+		} else {
+			EXPECT_EQ(a.digest(node), b.digest(node));
+		}
+	}
+	// the path from the leaf to the root differs, nothing else does
+	EXPECT_NE(a.digest(leaf / 2), b.digest(leaf / 2));
+	EXPECT_EQ(a.digest(leaf ^ 1), b.digest(leaf ^ 1));
+}
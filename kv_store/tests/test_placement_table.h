@@ -0,0 +1,134 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include "gtest/gtest.h"
+#include "placement_table.h"
+
+key_info make_key_info(unsigned memory_replication, unsigned ebs_replication) {
+	key_info info;
+	info.set_global_replication(1, memory_replication);
+	info.set_global_replication(2, ebs_replication);
+	return info;
+}
+
+TEST(PlacementTableTest, MapOnlyStoresExceptions) {
+	placement_map placement;
+	EXPECT_TRUE(placement.find("a") == NULL);
+	EXPECT_EQ(0, placement.get("a").global_replication(1));
+	placement.set("a", make_key_info(2, 0));
+	placement.set("b", make_key_info(1, 0));
+	EXPECT_EQ(2, placement.size());
+
+	// keys that have the default are dropped from the table
+	placement.set_default(make_key_info(1, 0));
+	EXPECT_EQ(1, placement.size());
+	EXPECT_EQ(1, placement.find("c")->global_replication(1));
+
+	key_info changes;
+	changes.set_global_replication(1, 1);
+	placement.merge("a", changes);
+	EXPECT_EQ(0, placement.size());
+
+	changes.set_local_replication("10.0.0.1", 3);
+	placement.merge("d", changes);
+	EXPECT_EQ(1, placement.size());
+	EXPECT_EQ(3, placement.get("d").local_replication("10.0.0.1"));
+	EXPECT_EQ(DEFAULT_LOCAL_REPLICATION, placement.get("d").local_replication("10.0.0.2"));
+	EXPECT_EQ(0, placement.get("d").global_replication(2));
+}
+
+TEST(PlacementTableTest, MergeKeepsUnmentionedEntries) {
+	placement_table table(1, 16);
+	unordered_map<string, key_info> changes;
+	changes["a"] = make_key_info(1, 0);
+	changes["b"] = make_key_info(2, 1);
+	table.merge(changes);
+
+	changes.clear();
+	changes["a"].set_global_replication(2, 3);
+	changes["a"].set_local_replication("10.0.0.1", 2);
+	table.merge(changes);
+
+	placement_table::read_guard guard(table, 0);
+	const key_info* a = table.find("a");
+	ASSERT_TRUE(a != NULL);
+	EXPECT_EQ(1, a->global_replication(1));
+	EXPECT_EQ(3, a->global_replication(2));
+	EXPECT_EQ(2, a->local_replication("10.0.0.1"));
+	EXPECT_EQ(2, table.find("b")->global_replication(1));
+	EXPECT_TRUE(table.find("c") == NULL);
+}
+
+TEST(PlacementTableTest, TableFallsBackToDefault) {
+	placement_table table(1, 16);
+	table.set_default(make_key_info(1, 0));
+	unordered_map<string, key_info> changes;
+	changes["a"] = make_key_info(3, 1);
+	table.merge(changes);
+	placement_table::read_guard guard(table, 0);
+	EXPECT_EQ(3, table.find("a")->global_replication(1));
+	EXPECT_EQ(1, table.find("b")->global_replication(1));
+}
+
+TEST(PlacementTableTest, ReplacedShardsOutliveTheirReaders) {
+	placement_table table(2, 1);
+	unordered_map<string, key_info> changes;
+	changes["a"] = make_key_info(1, 0);
+	table.merge(changes);
+	EXPECT_EQ(0, table.retired());
+
+	{
+		placement_table::read_guard guard(table, 1);
+		const key_info* before = table.find("a");
+		changes["a"] = make_key_info(2, 0);
+		table.merge(changes);
+		// the reader may still use the shard it found
+		EXPECT_EQ(1, table.retired());
+		EXPECT_EQ(1, before->global_replication(1));
+		EXPECT_EQ(2, table.find("a")->global_replication(1));
+	}
+
+	// the next write frees the shard once the reader is done
+	changes["a"] = make_key_info(3, 0);
+	table.merge(changes);
+	EXPECT_EQ(0, table.retired());
+}
+
+TEST(PlacementTableTest, ReadersSeeWholeKeyInfos) {
+	placement_table table(4, 8);
+	unordered_map<string, key_info> changes;
+	for (unsigned i = 0; i < 100; i++) {
+		changes[to_string(i)] = make_key_info(0, 0);
+	}
+	table.merge(changes);
+
+	atomic<bool> stop(false);
+	atomic<unsigned> torn(0);
+	vector<thread> readers;
+	for (unsigned reader = 0; reader < 4; reader++) {
+		readers.push_back(thread([&table, &stop, &torn, reader] {
+			while (!stop.load()) {
+				placement_table::read_guard guard(table, reader);
+				for (unsigned i = 0; i < 100; i++) {
+					const key_info* info = table.find(to_string(i));
+					// the writer always sets both tiers to the same value
+					if (info->global_replication(1) != info->global_replication(2)) {
+						torn++;
+					}
+				}
+			}
+		}));
+	}
+	for (unsigned round = 1; round <= 200; round++) {
+		for (auto it = changes.begin(); it != changes.end(); it++) {
+			it->second = make_key_info(round, round);
+		}
+		table.merge(changes);
+	}
+	stop.store(true);
+	for (unsigned i = 0; i < readers.size(); i++) {
+		readers[i].join();
+	}
+	EXPECT_EQ(0, torn.load());
+}
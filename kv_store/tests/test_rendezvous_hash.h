@@ -0,0 +1,57 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "rendezvous_hash.hpp"
+
+TEST(RendezvousHashTest, TopBucketLeadsTopK) {
+	rendezvous_hash buckets(8);
+	for (unsigned i = 0; i < 1000; i++) {
+		string key = "key_" + to_string(i);
+		auto top = buckets.find(key, 3);
+		ASSERT_EQ(3, top.size());
+		EXPECT_EQ(buckets.find(key), top[0]);
+		EXPECT_NE(top[0], top[1]);
+		EXPECT_NE(top[1], top[2]);
+		EXPECT_NE(top[0], top[2]);
+	}
+}
+
+TEST(RendezvousHashTest, KeysUseRoutingHash) {
+	rendezvous_hash buckets(8);
+	for (unsigned i = 0; i < 1000; i++) {
+		string key = "key_" + to_string(i);
+		EXPECT_EQ(buckets.find(get_key_hash(key)), buckets.find(key));
+		EXPECT_EQ(buckets.find(get_key_hash(key), 3), buckets.find(key, 3));
+	}
+}
+
+TEST(RendezvousHashTest, CountLargerThanSize) {
+	rendezvous_hash buckets(4);
+	EXPECT_EQ(4, buckets.find("key", 10).size());
+}
+
+TEST(RendezvousHashTest, Balance) {
+	rendezvous_hash buckets(4);
+	vector<unsigned> load(4, 0);
+	for (unsigned i = 0; i < 40000; i++) {
+		load[buckets.find("key_" + to_string(i))]++;
+	}
+	for (unsigned i = 0; i < 4; i++) {
+		EXPECT_GT(load[i], 9000);
+		EXPECT_LT(load[i], 11000);
+	}
+}
+
+TEST(RendezvousHashTest, MinimalDisruption) {
+	// growing from 4 to 5 buckets only moves keys onto the new bucket
+	rendezvous_hash before(4);
+	rendezvous_hash after(5);
+	for (unsigned i = 0; i < 10000; i++) {
+		string key = "key_" + to_string(i);
+		unsigned b = after.find(key);
+		if (b != 4) {
+			EXPECT_EQ(before.find(key), b);
+		}
+	}
+}
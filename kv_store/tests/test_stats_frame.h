@@ -0,0 +1,73 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "stats_frame.h"
+
+communication::Key_Access make_access(unsigned hot, unsigned warm) {
+	communication::Key_Access access;
+	communication::Key_Access_Tuple* tp = access.add_tuple();
+	tp->set_key("hot");
+	tp->set_access(hot);
+	if (warm > 0) {
+		tp = access.add_tuple();
+		tp->set_key("warm");
+		tp->set_access(warm);
+	}
+	access.add_cold("cold");
+	return access;
+}
+
+communication::Server_Stat make_stat() {
+	communication::Server_Stat stat;
+	stat.set_storage_consumption(1);
+	stat.set_occupancy(0.5);
+	stat.set_epoch(1);
+	return stat;
+}
+
+TEST(StatsFrameTest, DeltaCarriesOnlyChanges) {
+	stats_encoder encoder;
+	stats_view view;
+	communication::Stats_Frame first, second;
+	encoder.encode(make_stat(), make_access(10, 5), first);
+	EXPECT_TRUE(first.full());
+	view.apply(first);
+	ASSERT_TRUE(view.synced());
+	EXPECT_EQ(3, view.access().size());
+
+	encoder.encode(make_stat(), make_access(12, 0), second);
+	EXPECT_FALSE(second.full());
+	ASSERT_EQ(1, second.access().tuple_size());
+	EXPECT_EQ("hot", second.access().tuple(0).key());
+	ASSERT_EQ(1, second.removed_size());
+	EXPECT_EQ("warm", second.removed(0));
+
+	view.apply(second);
+	EXPECT_EQ(12, view.access().at("hot"));
+	EXPECT_EQ(0, view.access().at("cold"));
+	EXPECT_EQ(0, view.access().count("warm"));
+}
+
+TEST(StatsFrameTest, MissedFrameWaitsForFullFrame) {
+	stats_encoder encoder;
+	stats_view view;
+	communication::Stats_Frame frame;
+	encoder.encode(make_stat(), make_access(10, 5), frame);
+	view.apply(frame);
+	frame.Clear();
+	// this frame is lost
+	encoder.encode(make_stat(), make_access(11, 5), frame);
+	for (unsigned i = 2; i < STATS_FULL_FRAME_INTERVAL; i++) {
+		frame.Clear();
+		encoder.encode(make_stat(), make_access(10 + i, 5), frame);
+		view.apply(frame);
+		EXPECT_FALSE(view.synced());
+	}
+	frame.Clear();
+	encoder.encode(make_stat(), make_access(100, 5), frame);
+	EXPECT_TRUE(frame.full());
+	view.apply(frame);
+	EXPECT_TRUE(view.synced());
+	EXPECT_EQ(100, view.access().at("hot"));
+}
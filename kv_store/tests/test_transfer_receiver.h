@@ -0,0 +1,61 @@
+#include <iostream>
+#include <stdio.h>
+#include <stdlib.h>
+#include "gtest/gtest.h"
+#include "transfer_receiver.h"
+
+TEST(TransferReceiverTest, AcksInOrderChunks) {
+	transfer_receiver receiver;
+	unsigned received = 0;
+	EXPECT_TRUE(receiver.receive("t", 0, 0, 10, received));
+	EXPECT_EQ(10, received);
+	EXPECT_TRUE(receiver.receive("t", 0, 10, 20, received));
+	EXPECT_EQ(20, received);
+}
+
+TEST(TransferReceiverTest, HoldsAcksAfterALostChunk) {
+	transfer_receiver receiver;
+	unsigned received = 0;
+	EXPECT_TRUE(receiver.receive("t", 0, 0, 10, received));
+	// the chunk with keys [10, 20) is lost
+	EXPECT_FALSE(receiver.receive("t", 0, 20, 30, received));
+	EXPECT_EQ(10, received);
+	// the sender resumes from the last acknowledged key
+	EXPECT_TRUE(receiver.receive("t", 10, 10, 20, received));
+	EXPECT_EQ(20, received);
+	EXPECT_TRUE(receiver.receive("t", 10, 20, 30, received));
+	EXPECT_EQ(30, received);
+}
+
+TEST(TransferReceiverTest, AcksRepeatedChunks) {
+	transfer_receiver receiver;
+	unsigned received = 0;
+	EXPECT_TRUE(receiver.receive("t", 0, 0, 10, received));
+	EXPECT_TRUE(receiver.receive("t", 0, 10, 20, received));
+	// the acks were lost and the sender resent from the start
+	EXPECT_TRUE(receiver.receive("t", 0, 0, 10, received));
+	EXPECT_EQ(20, received);
+}
+
+TEST(TransferReceiverTest, KeepsTransfersApart) {
+	transfer_receiver receiver;
+	unsigned received = 0;
+	EXPECT_TRUE(receiver.receive("a", 0, 0, 10, received));
+	EXPECT_FALSE(receiver.receive("b", 0, 10, 20, received));
+	EXPECT_EQ(2, receiver.size());
+}
+
+TEST(TransferReceiverTest, ExpiredTransferResumesFromSenderAcks) {
+	transfer_receiver receiver;
+	unsigned received = 0;
+	auto now = chrono::steady_clock::now();
+	EXPECT_TRUE(receiver.receive("t", 0, 0, 10, received, now));
+	receiver.expire(now + chrono::seconds(TRANSFER_RECEIVER_EXPIRY - 1));
+	EXPECT_EQ(1, receiver.size());
+	receiver.expire(now + chrono::seconds(TRANSFER_RECEIVER_EXPIRY));
+	EXPECT_EQ(0, receiver.size());
+	// the sender knows the first ten keys arrived
+	EXPECT_TRUE(receiver.receive("t", 10, 10, 20, received));
+	EXPECT_EQ(20, received);
+	EXPECT_FALSE(receiver.receive("u", 5, 10, 20, received));
+}